@@ -54,24 +54,14 @@
 
 #include "autopilot_interface.h"
 
-
-// ----------------------------------------------------------------------------------
-//   Time
-// ------------------- ---------------------------------------------------------------
-uint64_t
-get_time_usec()
-{
-	static struct timeval _time_stamp;
-	gettimeofday(&_time_stamp, NULL);
-	return _time_stamp.tv_sec*1000000 + _time_stamp.tv_usec;
-}
+#include <math.h>
 
 
 // ----------------------------------------------------------------------------------
 //   Setpoint Helper Functions
 // ----------------------------------------------------------------------------------
 
-// choose one of the next three
+// choose one of the next two, they start the type_mask over
 
 /*
  * Set target local ned position
@@ -122,29 +112,23 @@ set_velocity(float vx, float vy, float vz, mavlink_set_position_target_local_ned
  * Set target local ned acceleration
  *
  * Modifies a mavlink_set_position_target_local_ned_t struct with target AX AY AZ
- * accelerations in the Local NED frame, in meters per second squared.
+ * accelerations in the Local NED frame, in meters per second squared. Called
+ * after set_position() or set_velocity() it is a feed-forward the autopilot
+ * adds to its own controller.
  */
 void
 set_acceleration(float ax, float ay, float az, mavlink_set_position_target_local_ned_t &sp)
 {
-
-	// NOT IMPLEMENTED
-	fprintf(stderr,"set_acceleration doesn't work yet \n");
-	throw 1;
-
-
-	sp.type_mask =
-		MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_ACCELERATION &
-		MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_VELOCITY     ;
-
-	sp.coordinate_frame = MAV_FRAME_BODY_NED;
+	// use the acceleration, as an acceleration rather than a force
+	sp.type_mask &= ~(SETPOINT_IGNORE_ACCELERATION | SETPOINT_FORCE);
 
 	sp.afx  = ax;
 	sp.afy  = ay;
 	sp.afz  = az;
 }
 
-// the next two need to be called after one of the above
+// the next two need to be called after one of the above, the autopilot
+// follows either a yaw or a yaw rate so each one replaces the other
 
 /*
  * Set target local ned yaw
@@ -155,8 +139,8 @@ set_acceleration(float ax, float ay, float az, mavlink_set_position_target_local
 void
 set_yaw(float yaw, mavlink_set_position_target_local_ned_t &sp)
 {
-	sp.type_mask &=
-		MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_YAW_ANGLE ;
+	sp.type_mask &= ~SETPOINT_IGNORE_YAW;
+	sp.type_mask |=  SETPOINT_IGNORE_YAW_RATE;
 
 	sp.yaw  = yaw;
 
@@ -173,8 +157,8 @@ set_yaw(float yaw, mavlink_set_position_target_local_ned_t &sp)
 void
 set_yaw_rate(float yaw_rate, mavlink_set_position_target_local_ned_t &sp)
 {
-	sp.type_mask &=
-		MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_YAW_RATE ;
+	sp.type_mask &= ~SETPOINT_IGNORE_YAW_RATE;
+	sp.type_mask |=  SETPOINT_IGNORE_YAW;
 
 	sp.yaw_rate  = yaw_rate;
 }
@@ -188,33 +172,94 @@ set_yaw_rate(float yaw_rate, mavlink_set_position_target_local_ned_t &sp)
 //   Con/De structors
 // ------------------------------------------------------------------------------
 Autopilot_Interface::
-Autopilot_Interface(Serial_Port *serial_port_)
+Autopilot_Interface(Generic_Port *port_)
 {
 	// initialize attributes
 	write_count = 0;
-
-	reading_status = 0;      // whether the read thread is running
-	writing_status = 0;      // whether the write thread is running
+	setpoint_keepalive_usec = SETPOINT_KEEPALIVE_USEC; // resend period of the last setpoint
+	trajectory_rate_hz = TRAJECTORY_RATE_HZ;           // steps between the setpoints given
+	print_setpoints = true;
+	disable_unused_messages = true;
+	rate_check_usec = RATE_CHECK_USEC;
+
+	reading_status = 0;      // whether the event loop is running
+	writing_status = 0;      // whether setpoints are being streamed
 	control_status = 0;      // whether the autopilot is in offboard control mode
 	time_to_exit   = false;  // flag to signal thread exit
 
-	read_tid  = 0; // read thread id
-	write_tid = 0; // write thread id
+	event_tid = 0; // event loop thread id
 
 	system_id    = 0; // system id
 	autopilot_id = 0; // autopilot component id
 	companion_id = 0; // companion computer component id
 
-	current_messages.sysid  = system_id;
-	current_messages.compid = autopilot_id;
+	port = port_; // port management object
 
-	serial_port = serial_port_; // serial port management object
+	memset(&current_source, 0, sizeof(current_source));
+
+	// what start() and Offboard_Session need, anything else is opt in
+	track_message(MAVLINK_MSG_ID_HEARTBEAT);
+	track_message(MAVLINK_MSG_ID_LOCAL_POSITION_NED);
+	track_message(MAVLINK_MSG_ID_ATTITUDE);
+
+	// states looked up by the time of a frame, stamped by the clock service
+	history.clock = &clock;
+	track_history(MAVLINK_MSG_ID_LOCAL_POSITION_NED);
+	track_history(MAVLINK_MSG_ID_ATTITUDE);
+
+	// rates asked for on start(), anything else subscribed gets the default
+	memset(message_rate_hz, 0, sizeof(message_rate_hz));
+	set_message_rate(MAVLINK_MSG_ID_LOCAL_POSITION_NED, 30);
+	set_message_rate(MAVLINK_MSG_ID_ATTITUDE,           50);
+	for ( int i = 0; i < MESSAGE_ROUTER_MAX_ID; i++ )
+		message_count[i] = 0;
+
+	// setpoint hand off between update_setpoint() and the event loop
+	setpoint_pending     = false;
+	setpoint_update_usec = 0;
+	timer_period_usec    = 0;
+
+	if ( pthread_mutex_init(&setpoint_lock, NULL) )
+	{
+		printf("\n setpoint lock init failed\n");
+		throw 1;
+	}
+
+	// event loop descriptors, the port is added in start()
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	wake_fd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	sync_fd  = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	if ( epoll_fd < 0 || timer_fd < 0 || wake_fd < 0 || sync_fd < 0 )
+	{
+		printf("\n event loop init failed\n");
+		throw 1;
+	}
+
+	struct epoll_event event;
+	event.events  = EPOLLIN;
+	event.data.fd = timer_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event);
+	event.data.fd = wake_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+	event.data.fd = sync_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sync_fd, &event);
+
+	// a TIMESYNC that waits behind telemetry makes a long round trip
+	port->set_priority(MAVLINK_MSG_ID_TIMESYNC, PORT_PRIORITY_HIGH);
 
 }
 
 Autopilot_Interface::
 ~Autopilot_Interface()
-{}
+{
+	close(sync_fd);
+	close(wake_fd);
+	close(timer_fd);
+	close(epoll_fd);
+	pthread_mutex_destroy(&setpoint_lock);
+}
 
 
 // ------------------------------------------------------------------------------
@@ -224,12 +269,26 @@ void
 Autopilot_Interface::
 update_setpoint(mavlink_set_position_target_local_ned_t setpoint)
 {
-	current_setpoint = setpoint;
+	// hand the setpoint to the event loop and wake it up, as the target of
+	// the trajectory if there is one
+	pthread_mutex_lock(&setpoint_lock);
+	if ( trajectory_rate_hz > 0 )
+		trajectory.set_target(setpoint, get_monotonic_usec());
+	else
+		current_setpoint.publish(setpoint, get_monotonic_usec());
+	setpoint_pending     = true;
+	setpoint_update_usec = get_monotonic_usec();
+	pthread_mutex_unlock(&setpoint_lock);
+
+	wake();
+
+	if ( not print_setpoints )
+		return;
 
 	printf("Inside the update_setpoint method:\n");
-	printf("POSITION SETPOINT VELOCITY = [ %.4f , %.4f , %.4f ] \n", current_setpoint.vx, current_setpoint.vy, current_setpoint.vz);
-	printf("POSITION SETPOINT YAW = %.4f \n", current_setpoint.yaw);
-	printf("POSITION SETPOINT YAW RATE = %.4f \n", current_setpoint.yaw_rate);
+	printf("POSITION SETPOINT VELOCITY = [ %.4f , %.4f , %.4f ] \n", setpoint.vx, setpoint.vy, setpoint.vz);
+	printf("POSITION SETPOINT YAW = %.4f \n", setpoint.yaw);
+	printf("POSITION SETPOINT YAW RATE = %.4f \n", setpoint.yaw_rate);
 /*
 	std::stringstream ss;
 	ss << current_setpoint.coordinate_frame;
@@ -242,167 +301,557 @@ update_setpoint(mavlink_set_position_target_local_ned_t setpoint)
 
 }
 
+// The setpoint that was sent last, which lags the target of the trajectory
+mavlink_set_position_target_local_ned_t
+Autopilot_Interface::
+get_setpoint() const
+{
+	mavlink_set_position_target_local_ned_t sp;
+	current_setpoint.read(sp);
+	return sp;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Setpoint Latency
+// ------------------------------------------------------------------------------
+Latency_Stats
+Autopilot_Interface::
+get_setpoint_latency()
+{
+	pthread_mutex_lock(&setpoint_lock);
+	Latency_Stats stats = setpoint_latency;
+	pthread_mutex_unlock(&setpoint_lock);
+	return stats;
+}
+
+void
+Autopilot_Interface::
+print_setpoint_latency()
+{
+	Latency_Stats stats = get_setpoint_latency();
+	if ( not stats.count )
+		return;
+
+	printf("SETPOINT LATENCY (update to write): count %lu, mean %lu us, max %lu us, last %lu us\n",
+		   (unsigned long) stats.count,
+		   (unsigned long) (stats.total_usec / stats.count),
+		   (unsigned long) stats.max_usec,
+		   (unsigned long) stats.last_usec);
+}
+
 
 // ------------------------------------------------------------------------------
 //   Read Messages
 // ------------------------------------------------------------------------------
+// Called when the port is readable. Handles every message that arrived,
+// each one as soon as it is parsed.
 void
 Autopilot_Interface::
 read_messages()
 {
-	bool success;               // receive success flag
-	bool received_all = false;  // receive only one message
-	Time_Stamps this_timestamps;
+	mavlink_message_t messages[PORT_RX_BATCH];
 
-	// Blocking wait for new data
-	while ( !received_all and !time_to_exit )
+	// keep parsing while a full batch left bytes in the port's ring
+	do
 	{
-		// ----------------------------------------------------------------------
-		//   READ MESSAGE
-		// ----------------------------------------------------------------------
-		mavlink_message_t message;
-		success = serial_port->read_message(message);
+		int count = port->read_messages(messages, PORT_RX_BATCH);
 
-		// ----------------------------------------------------------------------
-		//   HANDLE MESSAGE
-		// ----------------------------------------------------------------------
-		if( success )
+		for ( int i = 0; i < count; i++ )
+			handle_message(messages[i]);
+	}
+	while ( port->rx_pending() and not time_to_exit );
+
+	return;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Handle Message
+// ------------------------------------------------------------------------------
+void
+Autopilot_Interface::
+handle_message(const mavlink_message_t &message)
+{
+	// Store message sysid and compid.
+	// Note this doesn't handle multiple message sources.
+	if ( message.sysid != current_source.sysid || message.compid != current_source.compid )
+	{
+		current_source.sysid  = message.sysid;
+		current_source.compid = message.compid;
+		current_messages.source.publish(current_source, get_monotonic_usec());
+	}
+
+	// Count it for check_message_rates()
+	if ( message.msgid < MESSAGE_ROUTER_MAX_ID )
+		message_count[message.msgid].fetch_add(1, std::memory_order_relaxed);
+
+	// send_command() waits on these
+	if ( message.msgid == MAVLINK_MSG_ID_COMMAND_ACK )
+	{
+		mavlink_command_ack_t ack;
+		mavlink_msg_command_ack_decode(&message, &ack);
+		current_messages.command_ack.publish(ack, get_monotonic_usec());
+	}
+
+	// the clock service answers requests and fits the replies
+	if ( message.msgid == MAVLINK_MSG_ID_TIMESYNC )
+		handle_timesync(message);
+
+	// Hand it to the subscribers of its ID, if there are any
+	if ( router.subscribed(message.msgid) )
+		router.dispatch(message, get_monotonic_usec());
+
+	return;
+}
+
+// ------------------------------------------------------------------------------
+//   Time Sync
+// ------------------------------------------------------------------------------
+void
+Autopilot_Interface::
+handle_timesync(const mavlink_message_t &message)
+{
+	mavlink_timesync_t timesync, reply;
+	mavlink_msg_timesync_decode(&message, &timesync);
+
+	if ( clock.handle_timesync(timesync, get_monotonic_usec(), reply) )
+		write_timesync(reply);
+}
+
+void
+Autopilot_Interface::
+write_timesync(const mavlink_timesync_t &timesync)
+{
+	mavlink_message_t message;
+	mavlink_msg_timesync_encode(system_id, companion_id, &message, &timesync);
+
+	if ( write_message(message) <= 0 )
+		fprintf(stderr,"WARNING: could not send TIMESYNC\n");
+}
+
+// ------------------------------------------------------------------------------
+//   Subscriptions
+// ------------------------------------------------------------------------------
+// Subscribe before start(), the event loop reads the table without locking.
+// Return 0 on success, -1 if the subscription does not fit.
+int
+Autopilot_Interface::
+subscribe(uint32_t msgid, Message_Callback callback, void *context)
+{
+	return router.subscribe(msgid, callback, context);
+}
+
+int
+Autopilot_Interface::
+subscribe(uint32_t msgid, Message_Queue *queue)
+{
+	return router.subscribe(msgid, queue);
+}
+
+// Keeps the latest copy of a message in its current_messages snapshot
+int
+Autopilot_Interface::
+track_message(uint32_t msgid)
+{
+	switch (msgid)
+	{
+		case MAVLINK_MSG_ID_HEARTBEAT:
+			return router.subscribe(msgid,
+				&snapshot_callback<mavlink_heartbeat_t, mavlink_msg_heartbeat_decode>,
+				&current_messages.heartbeat);
+
+		case MAVLINK_MSG_ID_SYS_STATUS:
+			return router.subscribe(msgid,
+				&snapshot_callback<mavlink_sys_status_t, mavlink_msg_sys_status_decode>,
+				&current_messages.sys_status);
+
+		case MAVLINK_MSG_ID_BATTERY_STATUS:
+			return router.subscribe(msgid,
+				&snapshot_callback<mavlink_battery_status_t, mavlink_msg_battery_status_decode>,
+				&current_messages.battery_status);
+
+		case MAVLINK_MSG_ID_RADIO_STATUS:
+			return router.subscribe(msgid,
+				&snapshot_callback<mavlink_radio_status_t, mavlink_msg_radio_status_decode>,
+				&current_messages.radio_status);
+
+		case MAVLINK_MSG_ID_LOCAL_POSITION_NED:
+			return router.subscribe(msgid,
+				&snapshot_callback<mavlink_local_position_ned_t, mavlink_msg_local_position_ned_decode>,
+				&current_messages.local_position_ned);
+
+		case MAVLINK_MSG_ID_GLOBAL_POSITION_INT:
+			return router.subscribe(msgid,
+				&snapshot_callback<mavlink_global_position_int_t, mavlink_msg_global_position_int_decode>,
+				&current_messages.global_position_int);
+
+		case MAVLINK_MSG_ID_POSITION_TARGET_LOCAL_NED:
+			return router.subscribe(msgid,
+				&snapshot_callback<mavlink_position_target_local_ned_t, mavlink_msg_position_target_local_ned_decode>,
+				&current_messages.position_target_local_ned);
+
+		case MAVLINK_MSG_ID_POSITION_TARGET_GLOBAL_INT:
+			return router.subscribe(msgid,
+				&snapshot_callback<mavlink_position_target_global_int_t, mavlink_msg_position_target_global_int_decode>,
+				&current_messages.position_target_global_int);
+
+		case MAVLINK_MSG_ID_HIGHRES_IMU:
+			return router.subscribe(msgid,
+				&snapshot_callback<mavlink_highres_imu_t, mavlink_msg_highres_imu_decode>,
+				&current_messages.highres_imu);
+
+		case MAVLINK_MSG_ID_ATTITUDE:
+			return router.subscribe(msgid,
+				&snapshot_callback<mavlink_attitude_t, mavlink_msg_attitude_decode>,
+				&current_messages.attitude);
+
+		default:
+			fprintf(stderr,"WARNING: no snapshot for message id %u, use subscribe()\n", msgid);
+			return -1;
+	}
+}
+
+// Keeps the last samples of a message in history, HIGHRES_IMU is opt in
+// as it needs a rate the radio link cannot spare
+int
+Autopilot_Interface::
+track_history(uint32_t msgid)
+{
+	switch (msgid)
+	{
+		case MAVLINK_MSG_ID_LOCAL_POSITION_NED:
+			return router.subscribe(msgid,
+				&history_callback<mavlink_local_position_ned_t, mavlink_msg_local_position_ned_decode>,
+				&history);
+
+		case MAVLINK_MSG_ID_HIGHRES_IMU:
+			return router.subscribe(msgid,
+				&history_callback<mavlink_highres_imu_t, mavlink_msg_highres_imu_decode>,
+				&history);
+
+		case MAVLINK_MSG_ID_ATTITUDE:
+			return router.subscribe(msgid,
+				&history_callback<mavlink_attitude_t, mavlink_msg_attitude_decode>,
+				&history);
+
+		default:
+			fprintf(stderr,"WARNING: no history for message id %u\n", msgid);
+			return -1;
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Message Rates
+// ------------------------------------------------------------------------------
+
+// Streams PX4 and ArduPilot send a companion computer unasked, these are
+// stopped by request_message_rates() unless somebody subscribed to them
+static const uint32_t default_streams[] = {
+	MAVLINK_MSG_ID_SYS_STATUS,
+	MAVLINK_MSG_ID_SYSTEM_TIME,
+	MAVLINK_MSG_ID_GPS_RAW_INT,
+	MAVLINK_MSG_ID_ATTITUDE,
+	MAVLINK_MSG_ID_ATTITUDE_QUATERNION,
+	MAVLINK_MSG_ID_LOCAL_POSITION_NED,
+	MAVLINK_MSG_ID_GLOBAL_POSITION_INT,
+	MAVLINK_MSG_ID_SERVO_OUTPUT_RAW,
+	MAVLINK_MSG_ID_RC_CHANNELS,
+	MAVLINK_MSG_ID_VFR_HUD,
+	MAVLINK_MSG_ID_ATTITUDE_TARGET,
+	MAVLINK_MSG_ID_POSITION_TARGET_LOCAL_NED,
+	MAVLINK_MSG_ID_POSITION_TARGET_GLOBAL_INT,
+	MAVLINK_MSG_ID_HIGHRES_IMU,
+	MAVLINK_MSG_ID_ALTITUDE,
+	MAVLINK_MSG_ID_BATTERY_STATUS,
+	MAVLINK_MSG_ID_ESTIMATOR_STATUS,
+	MAVLINK_MSG_ID_VIBRATION,
+	MAVLINK_MSG_ID_EXTENDED_SYS_STATE,
+};
+
+// Rate to ask for when the message is subscribed, call before start().
+// Returns 0, or -1 if the message ID can not be subscribed to.
+int
+Autopilot_Interface::
+set_message_rate(uint32_t msgid, float rate_hz)
+{
+	if ( msgid >= MESSAGE_ROUTER_MAX_ID || rate_hz < 0 )
+		return -1;
+
+	message_rate_hz[msgid] = rate_hz;
+	return 0;
+}
+
+float
+Autopilot_Interface::
+message_rate(uint32_t msgid) const
+{
+	return message_rate_hz[msgid] > 0 ? message_rate_hz[msgid] : MESSAGE_RATE_DEFAULT_HZ;
+}
+
+// Subscribed messages that are sent as a stream, the heartbeat always is
+bool
+Autopilot_Interface::
+stream_wanted(uint32_t msgid) const
+{
+	if ( msgid == MAVLINK_MSG_ID_HEARTBEAT || msgid == MAVLINK_MSG_ID_COMMAND_ACK ||
+	     msgid == MAVLINK_MSG_ID_TIMESYNC )
+		return false;
+
+	return router.subscribed(msgid);
+}
+
+/*
+ * Request Message Rates
+ *
+ * Asks the autopilot with MAV_CMD_SET_MESSAGE_INTERVAL to stream every
+ * subscribed message at its rate, then to stop the default streams that
+ * nobody subscribed to. Each command waits for its COMMAND_ACK, so this
+ * takes a few round trips of the link. An autopilot that accepts none of
+ * the intervals (older ArduPilot) is asked with REQUEST_DATA_STREAM for
+ * the stream groups the messages are in instead.
+ */
+void
+Autopilot_Interface::
+request_message_rates()
+{
+	printf("REQUEST MESSAGE RATES\n");
+
+	int requested = 0;
+	int accepted  = 0;
+
+	for ( uint32_t msgid = 0; msgid < MESSAGE_ROUTER_MAX_ID; msgid++ )
+	{
+		if ( not stream_wanted(msgid) )
+			continue;
+
+		requested++;
+		int result = set_message_interval(msgid, message_rate(msgid));
+
+		if ( result == MAV_RESULT_ACCEPTED )
 		{
+			accepted++;
+			printf("    message %3u at %.1f Hz\n", msgid, message_rate(msgid));
+		}
+		else if ( result < 0 && not accepted )
+		{
+			// nothing answered yet, do not wait on every other message too
+			break;
+		}
+		else
+			fprintf(stderr,"WARNING: autopilot did not set the rate of message %u (result %d)\n", msgid, result);
+	}
 
-			// Store message sysid and compid.
-			// Note this doesn't handle multiple message sources.
-			current_messages.sysid  = message.sysid;
-			current_messages.compid = message.compid;
+	if ( requested && not accepted )
+	{
+		fprintf(stderr,"WARNING: autopilot does not take message intervals, requesting data streams\n");
+		request_data_streams();
+		printf("\n");
+		return;
+	}
 
-			//printf("MessageID: %u\n", message.msgid);
-			// Handle Message ID
-			switch (message.msgid)
-			{
+	// free the link of what nobody reads
+	if ( disable_unused_messages )
+	{
+		for ( unsigned i = 0; i < sizeof(default_streams) / sizeof(default_streams[0]); i++ )
+		{
+			if ( not stream_wanted(default_streams[i]) )
+				set_message_interval(default_streams[i], 0);
+		}
+	}
 
-				case MAVLINK_MSG_ID_HEARTBEAT:
-				{
-					//printf("MAVLINK_MSG_ID_HEARTBEAT\n");
-					mavlink_msg_heartbeat_decode(&message, &(current_messages.heartbeat));
-					current_messages.time_stamps.heartbeat = get_time_usec();
-					this_timestamps.heartbeat = current_messages.time_stamps.heartbeat;
-					break;
-				}
+	printf("\n");
+}
 
-				case MAVLINK_MSG_ID_SYS_STATUS:
-				{
-					//printf("MAVLINK_MSG_ID_SYS_STATUS\n");
-					mavlink_msg_sys_status_decode(&message, &(current_messages.sys_status));
-					current_messages.time_stamps.sys_status = get_time_usec();
-					this_timestamps.sys_status = current_messages.time_stamps.sys_status;
-					break;
-				}
+// A rate of 0 stops the message, returns the MAV_RESULT or -1
+int
+Autopilot_Interface::
+set_message_interval(uint32_t msgid, float rate_hz)
+{
+	mavlink_command_long_t com;
+	memset(&com, 0, sizeof(com));
+	com.command = MAV_CMD_SET_MESSAGE_INTERVAL;
+	com.param1  = (float) msgid;
+	com.param2  = rate_hz > 0 ? 1000000.0f / rate_hz : -1;  // interval in us, -1 stops it
 
-				case MAVLINK_MSG_ID_BATTERY_STATUS:
-				{
-					//printf("MAVLINK_MSG_ID_BATTERY_STATUS\n");
-					mavlink_msg_battery_status_decode(&message, &(current_messages.battery_status));
-					current_messages.time_stamps.battery_status = get_time_usec();
-					this_timestamps.battery_status = current_messages.time_stamps.battery_status;
-					break;
-				}
+	return send_command(com);
+}
 
-				case MAVLINK_MSG_ID_RADIO_STATUS:
-				{
-					//printf("MAVLINK_MSG_ID_RADIO_STATUS\n");
-					mavlink_msg_radio_status_decode(&message, &(current_messages.radio_status));
-					current_messages.time_stamps.radio_status = get_time_usec();
-					this_timestamps.radio_status = current_messages.time_stamps.radio_status;
-					break;
-				}
+/*
+ * Fallback for autopilots without MAV_CMD_SET_MESSAGE_INTERVAL. Streams
+ * only come in groups here, so each group runs at the fastest rate any of
+ * its subscribed messages asked for, and messages outside the groups are
+ * left as they are. REQUEST_DATA_STREAM is not acknowledged.
+ */
+void
+Autopilot_Interface::
+request_data_streams()
+{
+	const int groups = MAV_DATA_STREAM_EXTRA3 + 1;
+	float group_rate_hz[groups];
+	memset(group_rate_hz, 0, sizeof(group_rate_hz));
 
-				case MAVLINK_MSG_ID_LOCAL_POSITION_NED:
-				{
-					//printf("MAVLINK_MSG_ID_LOCAL_POSITION_NED\n");
-					mavlink_msg_local_position_ned_decode(&message, &(current_messages.local_position_ned));
-					current_messages.time_stamps.local_position_ned = get_time_usec();
-					this_timestamps.local_position_ned = current_messages.time_stamps.local_position_ned;
-					break;
-				}
+	for ( uint32_t msgid = 0; msgid < MESSAGE_ROUTER_MAX_ID; msgid++ )
+	{
+		if ( not stream_wanted(msgid) )
+			continue;
 
-				case MAVLINK_MSG_ID_GLOBAL_POSITION_INT:
-				{
-					//printf("MAVLINK_MSG_ID_GLOBAL_POSITION_INT\n");
-					mavlink_msg_global_position_int_decode(&message, &(current_messages.global_position_int));
-					current_messages.time_stamps.global_position_int = get_time_usec();
-					this_timestamps.global_position_int = current_messages.time_stamps.global_position_int;
-					break;
-				}
+		int group;
+		switch ( msgid )
+		{
+			case MAVLINK_MSG_ID_HIGHRES_IMU:
+				group = MAV_DATA_STREAM_RAW_SENSORS;  break;
+			case MAVLINK_MSG_ID_SYS_STATUS:
+			case MAVLINK_MSG_ID_GPS_RAW_INT:
+				group = MAV_DATA_STREAM_EXTENDED_STATUS;  break;
+			case MAVLINK_MSG_ID_RC_CHANNELS:
+			case MAVLINK_MSG_ID_SERVO_OUTPUT_RAW:
+				group = MAV_DATA_STREAM_RC_CHANNELS;  break;
+			case MAVLINK_MSG_ID_LOCAL_POSITION_NED:
+			case MAVLINK_MSG_ID_GLOBAL_POSITION_INT:
+				group = MAV_DATA_STREAM_POSITION;  break;
+			case MAVLINK_MSG_ID_ATTITUDE:
+				group = MAV_DATA_STREAM_EXTRA1;  break;
+			case MAVLINK_MSG_ID_VFR_HUD:
+				group = MAV_DATA_STREAM_EXTRA2;  break;
+			case MAVLINK_MSG_ID_SYSTEM_TIME:
+			case MAVLINK_MSG_ID_BATTERY_STATUS:
+			case MAVLINK_MSG_ID_VIBRATION:
+				group = MAV_DATA_STREAM_EXTRA3;  break;
+			default:
+				fprintf(stderr,"WARNING: message %u is in no data stream\n", msgid);
+				continue;
+		}
 
-				case MAVLINK_MSG_ID_POSITION_TARGET_LOCAL_NED:
-				{
-					//printf("MAVLINK_MSG_ID_POSITION_TARGET_LOCAL_NED\n");
-					mavlink_msg_position_target_local_ned_decode(&message, &(current_messages.position_target_local_ned));
-					current_messages.time_stamps.position_target_local_ned = get_time_usec();
-					this_timestamps.position_target_local_ned = current_messages.time_stamps.position_target_local_ned;
-					break;
-				}
+		if ( message_rate(msgid) > group_rate_hz[group] )
+			group_rate_hz[group] = message_rate(msgid);
+	}
 
-				case MAVLINK_MSG_ID_POSITION_TARGET_GLOBAL_INT:
-				{
-					//printf("MAVLINK_MSG_ID_POSITION_TARGET_GLOBAL_INT\n");
-					mavlink_msg_position_target_global_int_decode(&message, &(current_messages.position_target_global_int));
-					current_messages.time_stamps.position_target_global_int = get_time_usec();
-					this_timestamps.position_target_global_int = current_messages.time_stamps.position_target_global_int;
-					break;
-				}
+	mavlink_request_data_stream_t request;
+	memset(&request, 0, sizeof(request));
+	request.target_system    = system_id;
+	request.target_component = autopilot_id;
 
-				case MAVLINK_MSG_ID_HIGHRES_IMU:
-				{
-					//printf("MAVLINK_MSG_ID_HIGHRES_IMU\n");
-					mavlink_msg_highres_imu_decode(&message, &(current_messages.highres_imu));
-					current_messages.time_stamps.highres_imu = get_time_usec();
-					this_timestamps.highres_imu = current_messages.time_stamps.highres_imu;
-					break;
-				}
+	mavlink_message_t message;
 
-				case MAVLINK_MSG_ID_ATTITUDE:
-				{
-					//printf("MAVLINK_MSG_ID_ATTITUDE\n");
-					mavlink_msg_attitude_decode(&message, &(current_messages.attitude));
-					current_messages.time_stamps.attitude = get_time_usec();
-					this_timestamps.attitude = current_messages.time_stamps.attitude;
-					break;
-				}
+	// stop everything first, then start the groups that are needed
+	if ( disable_unused_messages )
+	{
+		request.req_stream_id = MAV_DATA_STREAM_ALL;
+		request.start_stop    = 0;
+		mavlink_msg_request_data_stream_encode(system_id, companion_id, &message, &request);
+		write_message(message);
+	}
 
-				default:
-				{
-					//printf("Warning, did not handle message id %i\n",message.msgid);
-					break;
-				}
+	for ( int group = 0; group < groups; group++ )
+	{
+		if ( group_rate_hz[group] <= 0 )
+			continue;
+
+		request.req_stream_id    = group;
+		request.req_message_rate = (uint16_t) ceilf(group_rate_hz[group]);
+		request.start_stop       = 1;
+		mavlink_msg_request_data_stream_encode(system_id, companion_id, &message, &request);
+		write_message(message);
+
+		printf("    data stream %d at %u Hz\n", group, request.req_message_rate);
+	}
+}
+
+/*
+ * Check Message Rates
+ *
+ * Counts the subscribed messages over rate_check_usec and prints the
+ * rate each arrived at next to the rate asked for, with a warning for the
+ * ones under 80% of it. Messages nobody subscribed to that still arrive
+ * are summed up, they take link bandwidth for nothing.
+ */
+void
+Autopilot_Interface::
+check_message_rates()
+{
+	if ( not rate_check_usec )
+		return;
+
+	unsigned int counts[MESSAGE_ROUTER_MAX_ID];
+	for ( uint32_t msgid = 0; msgid < MESSAGE_ROUTER_MAX_ID; msgid++ )
+		counts[msgid] = message_count[msgid].load(std::memory_order_relaxed);
 
+	usleep(rate_check_usec);
 
-			} // end: switch msgid
+	printf("MESSAGE RATES\n");
 
-		} // end: if read message
+	float seconds = rate_check_usec / 1000000.0f;
+	unsigned int unused = 0;
 
-		// Check for receipt of all items
-		received_all =
-				this_timestamps.heartbeat                  &&
-				this_timestamps.battery_status             &&
-				this_timestamps.radio_status               &&
-				this_timestamps.local_position_ned         &&
-				this_timestamps.global_position_int        &&
-				this_timestamps.position_target_local_ned  &&
-				this_timestamps.position_target_global_int &&
-				this_timestamps.highres_imu                &&
-				this_timestamps.attitude                   &&
-				this_timestamps.sys_status;
+	for ( uint32_t msgid = 0; msgid < MESSAGE_ROUTER_MAX_ID; msgid++ )
+	{
+		unsigned int received = message_count[msgid].load(std::memory_order_relaxed) - counts[msgid];
 
-		// give the write thread time to use the port
-		if ( writing_status > false ) {
-			usleep(100); // look for components of batches at 10kHz
+		if ( stream_wanted(msgid) )
+		{
+			float rate_hz = received / seconds;
+			printf("    message %3u at %.1f Hz, asked for %.1f Hz\n", msgid, rate_hz, message_rate(msgid));
+			if ( rate_hz < 0.8f * message_rate(msgid) )
+				fprintf(stderr,"WARNING: message %u arrives slower than requested\n", msgid);
 		}
+		else if ( msgid != MAVLINK_MSG_ID_HEARTBEAT && msgid != MAVLINK_MSG_ID_COMMAND_ACK )
+			unused += received;
+	}
+
+	printf("    %.1f unused messages per second\n", unused / seconds);
+	printf("\n");
+}
 
-	} // end: while not received all
 
-	return;
+// ------------------------------------------------------------------------------
+//   Send Command
+// ------------------------------------------------------------------------------
+/*
+ * Sends a COMMAND_LONG to the autopilot and waits for its COMMAND_ACK,
+ * sending it again up to COMMAND_RETRIES times. The event loop publishes
+ * every ack to current_messages.command_ack, so do not call this from the
+ * event loop. Returns the MAV_RESULT, or -1 if nothing was acknowledged.
+ */
+int
+Autopilot_Interface::
+send_command(mavlink_command_long_t com)
+{
+	com.target_system    = system_id;
+	com.target_component = autopilot_id;
+
+	for ( int attempt = 0; attempt < COMMAND_RETRIES && not time_to_exit; attempt++ )
+	{
+		com.confirmation = attempt;
+
+		unsigned int version = current_messages.command_ack.version();
+
+		mavlink_message_t message;
+		mavlink_msg_command_long_encode(system_id, companion_id, &message, &com);
+		if ( write_message(message) <= 0 )
+			return -1;
+
+		uint64_t deadline = get_monotonic_usec() + COMMAND_ACK_TIMEOUT_USEC;
+		while ( get_monotonic_usec() < deadline && not time_to_exit )
+		{
+			if ( current_messages.command_ack.version() != version )
+			{
+				mavlink_command_ack_t ack;
+				current_messages.command_ack.read(ack);
+				version = current_messages.command_ack.version();
+
+				if ( ack.command == com.command )
+					return ack.result;
+			}
+			usleep(1000);
+		}
+	}
+
+	return -1;
 }
 
+
 // ------------------------------------------------------------------------------
 //   Write Message
 // ------------------------------------------------------------------------------
@@ -411,7 +860,7 @@ Autopilot_Interface::
 write_message(mavlink_message_t message)
 {
 	// do the write
-	int len = serial_port->write_message(message);
+	int len = port->write_message(message);
 
 	// book keep
 	write_count++;
@@ -432,11 +881,27 @@ write_setpoint()
 	// --------------------------------------------------------------------------
 
 	// pull from position target
-	mavlink_set_position_target_local_ned_t sp = current_setpoint;
+	pthread_mutex_lock(&setpoint_lock);
+	bool     was_pending = setpoint_pending;
+	uint64_t update_usec = setpoint_update_usec;
+	setpoint_pending = false;
+	pthread_mutex_unlock(&setpoint_lock);
+
+	mavlink_set_position_target_local_ned_t sp;
+	if ( trajectory_rate_hz > 0 )
+	{
+		// the next step towards the target
+		sp = trajectory.step(get_monotonic_usec());
+		pthread_mutex_lock(&setpoint_lock);
+		current_setpoint.publish(sp, get_monotonic_usec());
+		pthread_mutex_unlock(&setpoint_lock);
+	}
+	else
+		current_setpoint.read(sp);
 
 	// double check some system parameters
 	if ( not sp.time_boot_ms )
-		sp.time_boot_ms = (uint32_t) (get_time_usec()/1000);
+		sp.time_boot_ms = clock.autopilot_boot_ms();
 	sp.target_system    = system_id;
 	sp.target_component = autopilot_id;
 
@@ -459,6 +924,15 @@ write_setpoint()
 	// check the write
 	if ( len <= 0 )
 		fprintf(stderr,"WARNING: could not send POSITION_TARGET_LOCAL_NED \n");
+
+	// decision to wire latency of a new setpoint
+	else if ( was_pending )
+	{
+		uint64_t latency = get_monotonic_usec() - update_usec;
+		pthread_mutex_lock(&setpoint_lock);
+		setpoint_latency.add(latency);
+		pthread_mutex_unlock(&setpoint_lock);
+	}
 	//	else
 	//		printf("%lu POSITION_TARGET  = [ %f , %f , %f ] \n", write_count, position_target.x, position_target.y, position_target.z);
 
@@ -560,7 +1034,7 @@ toggle_offboard_control( bool flag )
 	mavlink_msg_command_long_encode(system_id, companion_id, &message, &com);
 
 	// Send the message
-	int len = serial_port->write_message(message);
+	int len = port->write_message(message);
 
 	// Done!
 	return len;
@@ -577,23 +1051,32 @@ start()
 	int result;
 
 	// --------------------------------------------------------------------------
-	//   CHECK SERIAL PORT
+	//   CHECK PORT
 	// --------------------------------------------------------------------------
 
-	if ( serial_port->status != 1 ) // SERIAL_PORT_OPEN
+	if ( port->status != PORT_OPEN )
 	{
-		fprintf(stderr,"ERROR: serial port not open\n");
+		fprintf(stderr,"ERROR: port not open\n");
 		throw 1;
 	}
 
 
 	// --------------------------------------------------------------------------
-	//   READ THREAD
+	//   EVENT LOOP
 	// --------------------------------------------------------------------------
 
-	printf("START READ THREAD \n");
+	printf("START EVENT LOOP \n");
+
+	struct epoll_event event;
+	event.events  = EPOLLIN;
+	event.data.fd = port->file_descriptor();
+	if ( epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event.data.fd, &event) )
+	{
+		fprintf(stderr,"ERROR: could not watch fd %d\n", event.data.fd);
+		throw 1;
+	}
 
-	result = pthread_create( &read_tid, NULL, &start_autopilot_interface_read_thread, this );
+	result = pthread_create( &event_tid, NULL, &start_autopilot_interface_event_thread, this );
 	if ( result ) throw result;
 
 	// now we're reading messages
@@ -606,11 +1089,12 @@ start()
 
 	printf("CHECK FOR MESSAGES\n");
 
-	while ( not current_messages.sysid )
+	Mavlink_Source source;
+	while ( not current_messages.source.read(source) )
 	{
 		if ( time_to_exit )
 			return;
-		usleep(500000); // check at 2Hz
+		usleep(10000); // check at 100Hz
 	}
 
 	printf("Found\n");
@@ -631,65 +1115,113 @@ start()
 	// System ID
 	if ( not system_id )
 	{
-		system_id = current_messages.sysid;
+		system_id = source.sysid;
 		printf("GOT VEHICLE SYSTEM ID: %i\n", system_id );
 	}
 
 	// Component ID
 	if ( not autopilot_id )
 	{
-		autopilot_id = current_messages.compid;
+		autopilot_id = source.compid;
 		printf("GOT AUTOPILOT COMPONENT ID: %i\n", autopilot_id);
 		printf("\n");
 	}
 
 	// --------------------------------------------------------------------------
-	//   GET INITIAL POSITION
+	//   SYNC CLOCKS
 	// --------------------------------------------------------------------------
 
-	
+	// the event loop keeps the TIMESYNC requests going from here on
+	arm_timesync();
+
+
+	// --------------------------------------------------------------------------
+	//   REQUEST MESSAGE RATES
+	// --------------------------------------------------------------------------
+
+	// ask for exactly what was subscribed, instead of hoping it is streamed
+	request_message_rates();
+
+
+	// --------------------------------------------------------------------------
+	//   GET INITIAL POSITION
+	// --------------------------------------------------------------------------
 
 	// Wait for initial position ned
-	while ( not ( current_messages.time_stamps.local_position_ned &&
-				  current_messages.time_stamps.attitude            )  )
+	uint64_t request_usec = get_monotonic_usec();
+	while ( not ( current_messages.local_position_ned.time_usec() &&
+				  current_messages.attitude.time_usec()            )  )
 	{
 
-		//printf("local position: %lu\n attitude: %lu\n", current_messages.time_stamps.local_position_ned, current_messages.time_stamps.attitude);
 		if ( time_to_exit )
 			return;
-		//printf("Waiting for initial position\n");
-		usleep(500000);
+
+		// a request may have been lost on the link, ask again
+		if ( get_monotonic_usec() - request_usec > STARTUP_RETRY_USEC )
+		{
+			fprintf(stderr,"WARNING: still waiting for%s%s, requesting again\n",
+					current_messages.local_position_ned.time_usec() ? "" : " LOCAL_POSITION_NED",
+					current_messages.attitude.time_usec()           ? "" : " ATTITUDE");
+			request_message_rates();
+			request_usec = get_monotonic_usec();
+		}
+
+		usleep(10000);
 	}
 
 	// copy initial position ned
-	Mavlink_Messages local_data = current_messages;
-	initial_position.x        = local_data.local_position_ned.x;
-	initial_position.y        = local_data.local_position_ned.y;
-	initial_position.z        = local_data.local_position_ned.z;
-	initial_position.vx       = local_data.local_position_ned.vx;
-	initial_position.vy       = local_data.local_position_ned.vy;
-	initial_position.vz       = local_data.local_position_ned.vz;
-	initial_position.yaw      = local_data.attitude.yaw;
-	initial_position.yaw_rate = local_data.attitude.yawspeed;
+	mavlink_local_position_ned_t local_position;
+	mavlink_attitude_t           attitude;
+	current_messages.local_position_ned.read(local_position);
+	current_messages.attitude.read(attitude);
+	initial_position.x        = local_position.x;
+	initial_position.y        = local_position.y;
+	initial_position.z        = local_position.z;
+	initial_position.vx       = local_position.vx;
+	initial_position.vy       = local_position.vy;
+	initial_position.vz       = local_position.vz;
+	initial_position.yaw      = attitude.yaw;
+	initial_position.yaw_rate = attitude.yawspeed;
 
 	printf("INITIAL POSITION XYZ = [ %.4f , %.4f , %.4f ] \n", initial_position.x, initial_position.y, initial_position.z);
 	printf("INITIAL POSITION YAW = %.4f \n", initial_position.yaw);
 	printf("\n");
 
-	// we need this before starting the write thread
+	// did the autopilot do what it was asked
+	check_message_rates();
+
+	// we need this before streaming setpoints
 
 
 	// --------------------------------------------------------------------------
-	//   WRITE THREAD
+	//   SETPOINT STREAM
 	// --------------------------------------------------------------------------
-	printf("START WRITE THREAD \n");
+	printf("START SETPOINT STREAM \n");
 
-	result = pthread_create( &write_tid, NULL, &start_autopilot_interface_write_thread, this );
-	if ( result ) throw result;
+	// never let the keep-alive fall under the 2Hz the Pixhawk needs
+	if ( setpoint_keepalive_usec > SETPOINT_KEEPALIVE_MAX_USEC )
+	{
+		fprintf(stderr,"WARNING: setpoint keep-alive of %lu us is too slow, using %d us\n",
+				(unsigned long) setpoint_keepalive_usec, SETPOINT_KEEPALIVE_MAX_USEC);
+		setpoint_keepalive_usec = SETPOINT_KEEPALIVE_MAX_USEC;
+	}
+	if ( trajectory_rate_hz > 0 and trajectory_rate_hz < 1000000.0f / SETPOINT_KEEPALIVE_MAX_USEC )
+	{
+		fprintf(stderr,"WARNING: trajectory rate of %.1f Hz is too slow, using %.1f Hz\n",
+				trajectory_rate_hz, 1000000.0f / SETPOINT_KEEPALIVE_MAX_USEC);
+		trajectory_rate_hz = 1000000.0f / SETPOINT_KEEPALIVE_MAX_USEC;
+	}
+
+	// the trajectory starts from rest
+	trajectory.reset();
+
+	// prepare an initial setpoint, just stay put
+	mavlink_set_position_target_local_ned_t sp =
+		Setpoint_Builder(MAV_FRAME_BODY_NED).velocity(0, 0, 0).yaw_rate(0).build();
 
-	// wait for it to be started
-	while ( not writing_status )
-		usleep(100000); // 10Hz
+	// the event loop writes it on the next wake up and keeps it alive from then on
+	writing_status = true;
+	update_setpoint(sp);
 
 	// now we're streaming setpoint commands
 	printf("\n");
@@ -713,57 +1245,39 @@ stop()
 	// --------------------------------------------------------------------------
 	printf("CLOSE THREADS\n");
 
-	// signal exit
+	// signal exit, and wake the event loop
 	time_to_exit = true;
+	wake();
 
 	// wait for exit
-	pthread_join(read_tid ,NULL);
-	pthread_join(write_tid,NULL);
+	if ( event_tid )
+		pthread_join(event_tid, NULL);
+	event_tid = 0;
 
-	// now the read and write threads are closed
+	// now the event loop is closed
+	print_setpoint_latency();
+	clock.print_status();
 	printf("\n");
 
-	// still need to close the serial_port separately
+	// still need to close the port separately
 }
 
 // ------------------------------------------------------------------------------
-//   Read Thread
+//   Event Thread
 // ------------------------------------------------------------------------------
 void
 Autopilot_Interface::
-start_read_thread()
+start_event_thread()
 {
 
 	if ( reading_status != 0 )
 	{
-		fprintf(stderr,"read thread already running\n");
-		return;
-	}
-	else
-	{
-		read_thread();
-		return;
-	}
-
-}
-
-
-// ------------------------------------------------------------------------------
-//   Write Thread
-// ------------------------------------------------------------------------------
-void
-Autopilot_Interface::
-start_write_thread(void)
-{
-	if ( not writing_status == false )
-	{
-		fprintf(stderr,"write thread already running\n");
+		fprintf(stderr,"event loop already running\n");
 		return;
 	}
-
 	else
 	{
-		write_thread();
+		event_thread();
 		return;
 	}
 
@@ -793,67 +1307,176 @@ handle_quit( int sig )
 
 
 // ------------------------------------------------------------------------------
-//   Read Thread
+//   Event Loop
 // ------------------------------------------------------------------------------
+/*
+ * Sleeps in epoll_wait() until one of its descriptors is ready:
+ *
+ *   port        - every message that arrived is parsed and published
+ *   wake_fd     - update_setpoint() or stop() was called
+ *   timer_fd    - no setpoint was written for setpoint_keepalive_usec, or
+ *                 the next step towards the trajectory target is due
+ *   sync_fd     - the next TIMESYNC request is due
+ *
+ * New setpoints are written right away, which restarts the keep-alive, so
+ * the timer only fires while the setpoint is not changing. With the
+ * trajectory generator the timer fires at trajectory_rate_hz while the
+ * steps are moving towards the target, and goes back to the keep-alive
+ * period once they have reached it. Pixhawk needs to
+ * see off-board commands at minimum 2Hz, otherwise it will go into fail safe.
+ */
 void
 Autopilot_Interface::
-read_thread()
+event_thread()
 {
 	reading_status = true;
 
-	while ( ! time_to_exit )
+	// pin and prioritize the thread if running in real-time mode
+	realtime_enter_thread(RT_THREAD_MAVLINK_READ);
+
+	int port_fd = port->file_descriptor();
+	struct epoll_event events[4];
+
+	while ( not time_to_exit )
 	{
-		read_messages();
-		usleep(100000); // Read batches at 10Hz
+		int ready = epoll_wait(epoll_fd, events, 4, -1);
+		if ( ready < 0 )
+		{
+			if ( errno == EINTR )
+				continue;
+			fprintf(stderr,"ERROR: epoll_wait failed (%d)\n", errno);
+			break;
+		}
+
+		for ( int i = 0; i < ready && not time_to_exit; i++ )
+		{
+			int fd = events[i].data.fd;
+			uint64_t value;
+
+			// ------------------------------------------------------------------
+			//   TELEMETRY
+			// ------------------------------------------------------------------
+			if ( fd == port_fd )
+			{
+				if ( events[i].events & (EPOLLERR | EPOLLHUP) )
+				{
+					fprintf(stderr,"ERROR: port fd %d hung up\n", port_fd);
+					epoll_ctl(epoll_fd, EPOLL_CTL_DEL, port_fd, NULL);
+					continue;
+				}
+				read_messages();
+			}
+
+			// ------------------------------------------------------------------
+			//   NEW SETPOINT
+			// ------------------------------------------------------------------
+			else if ( fd == wake_fd )
+			{
+				if ( read(wake_fd, &value, sizeof(value)) > 0 && writing_status )
+				{
+					write_setpoint();
+					arm_keepalive();
+				}
+			}
+
+			// ------------------------------------------------------------------
+			//   KEEP-ALIVE
+			// ------------------------------------------------------------------
+			else if ( fd == timer_fd )
+			{
+				if ( read(timer_fd, &value, sizeof(value)) > 0 && writing_status )
+				{
+					write_setpoint();
+
+					// the trajectory reached its target, or left it
+					if ( setpoint_period_usec() != timer_period_usec )
+						arm_keepalive();
+				}
+			}
+
+			// ------------------------------------------------------------------
+			//   TIME SYNC
+			// ------------------------------------------------------------------
+			else if ( fd == sync_fd )
+			{
+				if ( read(sync_fd, &value, sizeof(value)) > 0 )
+				{
+					write_timesync(clock.request(get_monotonic_usec()));
+					arm_timesync();
+				}
+			}
+		}
+
+		realtime_check_thread(RT_THREAD_MAVLINK_READ);
 	}
 
+	// signal end
 	reading_status = false;
+	writing_status = false;
 
 	return;
 }
 
 
 // ------------------------------------------------------------------------------
-//   Write Thread
+//   Helper Function - Wake Event Loop
 // ------------------------------------------------------------------------------
 void
 Autopilot_Interface::
-write_thread(void)
+wake()
 {
-	// signal startup
-	writing_status = 2;
+	uint64_t one = 1;
+	if ( write(wake_fd, &one, sizeof(one)) < 0 )
+		fprintf(stderr,"WARNING: could not wake the event loop\n");
+}
 
-	// prepare an initial setpoint, just stay put
-	mavlink_set_position_target_local_ned_t sp;
-	sp.type_mask = MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_VELOCITY &
-				   MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_YAW_RATE;
-	sp.coordinate_frame = MAV_FRAME_BODY_NED;
-	sp.vx       = 0.0;
-	sp.vy       = 0.0;
-	sp.vz       = 0.0;
-	sp.yaw_rate = 0.0;
 
-	// set position target
-	current_setpoint = sp;
+// ------------------------------------------------------------------------------
+//   Helper Function - Restart Keep-Alive Timer
+// ------------------------------------------------------------------------------
+void
+Autopilot_Interface::
+arm_keepalive()
+{
+	uint64_t usec = setpoint_period_usec();
 
-	// write a message and signal writing
-	write_setpoint();
-	writing_status = true;
+	struct itimerspec period;
+	period.it_interval.tv_sec  = usec / 1000000;
+	period.it_interval.tv_nsec = (usec % 1000000) * 1000;
+	period.it_value            = period.it_interval;
 
-	// Pixhawk needs to see off-board commands at minimum 2Hz,
-	// otherwise it will go into fail safe
-	while ( !time_to_exit )
-	{
-		usleep(250000);   // Stream at 4Hz
-		//sleep(1);
-		write_setpoint();
-	}
+	timerfd_settime(timer_fd, 0, &period, NULL);
+	timer_period_usec = usec;
+}
 
-	// signal end
-	writing_status = false;
+// Time between the setpoints the timer writes, the trajectory rate only
+// until its steps have reached the target
+uint64_t
+Autopilot_Interface::
+setpoint_period_usec() const
+{
+	if ( trajectory_rate_hz > 0 and not trajectory.settled() )
+		return (uint64_t) (1000000.0f / trajectory_rate_hz);
+	return setpoint_keepalive_usec;
+}
 
-	return;
 
+// ------------------------------------------------------------------------------
+//   Helper Function - Schedule Next TIMESYNC Request
+// ------------------------------------------------------------------------------
+void
+Autopilot_Interface::
+arm_timesync()
+{
+	uint64_t usec = clock.request_period_usec();
+
+	struct itimerspec period;
+	period.it_interval.tv_sec  = 0;
+	period.it_interval.tv_nsec = 0;
+	period.it_value.tv_sec     = usec / 1000000;
+	period.it_value.tv_nsec    = (usec % 1000000) * 1000;
+
+	timerfd_settime(sync_fd, 0, &period, NULL);
 }
 
 // End Autopilot_Interface
@@ -864,26 +1487,13 @@ write_thread(void)
 // ------------------------------------------------------------------------------
 
 void*
-start_autopilot_interface_read_thread(void *args)
-{
-	// takes an autopilot object argument
-	Autopilot_Interface *autopilot_interface = (Autopilot_Interface *)args;
-
-	// run the object's read thread
-	autopilot_interface->start_read_thread();
-
-	// done!
-	return NULL;
-}
-
-void*
-start_autopilot_interface_write_thread(void *args)
+start_autopilot_interface_event_thread(void *args)
 {
 	// takes an autopilot object argument
 	Autopilot_Interface *autopilot_interface = (Autopilot_Interface *)args;
 
-	// run the object's read thread
-	autopilot_interface->start_write_thread();
+	// run the object's event loop
+	autopilot_interface->start_event_thread();
 
 	// done!
 	return NULL;
@@ -55,11 +55,23 @@
 //   Includes
 // ------------------------------------------------------------------------------
 
-#include "serial_port.h"
+#include "generic_port.h"
+#include "realtime.h"
+#include "message_router.h"
+#include "trajectory_generator.h"
+#include "setpoint_builder.h"
+#include "clock_service.h"
+#include "state_history.h"
 
 #include <signal.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <string.h>
+#include <atomic>
 
 #include <common/mavlink.h>
 
@@ -109,6 +121,48 @@
 #define MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_YAW_ANGLE    0b0000100111111111
 #define MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_YAW_RATE     0b0000010111111111
 
+// Setpoint_Builder composes its masks from single bits, which have to give
+// the same masks as above
+static_assert(setpoint_type_mask(true,  false, false, false, false, false) ==
+              MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_POSITION, "position type_mask");
+static_assert(setpoint_type_mask(false, true,  false, false, false, false) ==
+              MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_VELOCITY, "velocity type_mask");
+static_assert(setpoint_type_mask(false, false, true,  false, false, false) ==
+              MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_ACCELERATION, "acceleration type_mask");
+static_assert(setpoint_type_mask(false, false, true,  true,  false, false) ==
+              MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_FORCE, "force type_mask");
+static_assert(setpoint_type_mask(false, false, false, false, true,  false) ==
+              MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_YAW_ANGLE, "yaw angle type_mask");
+static_assert(setpoint_type_mask(false, false, false, false, false, true) ==
+              MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_YAW_RATE, "yaw rate type_mask");
+static_assert(setpoint_type_mask(false, true,  true,  false, true,  false) ==
+              (MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_VELOCITY &
+               MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_ACCELERATION &
+               MAVLINK_MSG_SET_POSITION_TARGET_LOCAL_NED_YAW_ANGLE), "combined type_mask");
+
+// Pixhawk needs to see off-board commands at minimum 2Hz, otherwise it will go
+// into fail safe. The event loop resends the last setpoint at this period
+// when no new one has been given.
+#define SETPOINT_KEEPALIVE_USEC     250000
+#define SETPOINT_KEEPALIVE_MAX_USEC 500000
+
+// Rate the trajectory generator streams setpoints at while it is moving
+// towards a new target, once there the keep-alive period is used again
+#define TRAJECTORY_RATE_HZ 50
+
+// Rate asked for a subscribed message when set_message_rate() was not called
+#define MESSAGE_RATE_DEFAULT_HZ 10
+
+// A command is sent this many times, waiting this long for its COMMAND_ACK
+#define COMMAND_RETRIES          3
+#define COMMAND_ACK_TIMEOUT_USEC 250000
+
+// start() asks for the messages it waits on again this often
+#define STARTUP_RETRY_USEC 2000000
+
+// Time the received rates are measured over after they were requested
+#define RATE_CHECK_USEC 1000000
+
 
 // ------------------------------------------------------------------------------
 //   Prototypes
@@ -116,105 +170,110 @@
 
 
 // helper functions
-uint64_t get_time_usec();
 void set_position(float x, float y, float z, mavlink_set_position_target_local_ned_t &sp);
 void set_velocity(float vx, float vy, float vz, mavlink_set_position_target_local_ned_t &sp);
 void set_acceleration(float ax, float ay, float az, mavlink_set_position_target_local_ned_t &sp);
 void set_yaw(float yaw, mavlink_set_position_target_local_ned_t &sp);
 void set_yaw_rate(float yaw_rate, mavlink_set_position_target_local_ned_t &sp);
 
-void* start_autopilot_interface_read_thread(void *args);
-void* start_autopilot_interface_write_thread(void *args);
+void* start_autopilot_interface_event_thread(void *args);
 
 
 // ------------------------------------------------------------------------------
 //   Data Structures
 // ------------------------------------------------------------------------------
 
-struct Time_Stamps
+// Time from update_setpoint() until the setpoint was written to the port
+
+struct Latency_Stats
 {
-	Time_Stamps()
+	Latency_Stats()
 	{
-		reset_timestamps();
+		reset();
 	}
 
-	uint64_t heartbeat;
-	uint64_t sys_status;
-	uint64_t battery_status;
-	uint64_t radio_status;
-	uint64_t local_position_ned;
-	uint64_t global_position_int;
-	uint64_t position_target_local_ned;
-	uint64_t position_target_global_int;
-	uint64_t highres_imu;
-	uint64_t attitude;
+	uint64_t count;
+	uint64_t total_usec;
+	uint64_t max_usec;
+	uint64_t last_usec;
 
 	void
-	reset_timestamps()
+	add(uint64_t usec)
 	{
-		heartbeat = 0;
-		sys_status = 0;
-		battery_status = 0;
-		radio_status = 0;
-		local_position_ned = 0;
-		global_position_int = 0;
-		position_target_local_ned = 0;
-		position_target_global_int = 0;
-		highres_imu = 0;
-		attitude = 0;
+		count++;
+		total_usec += usec;
+		last_usec   = usec;
+		if ( usec > max_usec )
+			max_usec = usec;
+	}
+
+	void
+	reset()
+	{
+		count      = 0;
+		total_usec = 0;
+		max_usec   = 0;
+		last_usec  = 0;
 	}
 
 };
 
 
-// Struct containing information on the MAV we are currently connected to
+// System and component the messages come from
 
-struct Mavlink_Messages {
+struct Mavlink_Source {
 
 	int sysid;
 	int compid;
 
+};
+
+
+// Struct containing information on the MAV we are currently connected to.
+// The event loop publishes the latest copy of each tracked message, and
+// readers copy out only the messages they need without blocking it. Only
+// the source, heartbeat, local position and attitude are tracked unless
+// track_message() is called for the others.
+
+struct Mavlink_Messages {
+
+	// Message Source
+	Snapshot<Mavlink_Source> source;
+
 	// Heartbeat
-	mavlink_heartbeat_t heartbeat;
+	Snapshot<mavlink_heartbeat_t> heartbeat;
 
 	// System Status
-	mavlink_sys_status_t sys_status;
+	Snapshot<mavlink_sys_status_t> sys_status;
 
 	// Battery Status
-	mavlink_battery_status_t battery_status;
+	Snapshot<mavlink_battery_status_t> battery_status;
 
 	// Radio Status
-	mavlink_radio_status_t radio_status;
+	Snapshot<mavlink_radio_status_t> radio_status;
 
 	// Local Position
-	mavlink_local_position_ned_t local_position_ned;
+	Snapshot<mavlink_local_position_ned_t> local_position_ned;
 
 	// Global Position
-	mavlink_global_position_int_t global_position_int;
+	Snapshot<mavlink_global_position_int_t> global_position_int;
 
 	// Local Position Target
-	mavlink_position_target_local_ned_t position_target_local_ned;
+	Snapshot<mavlink_position_target_local_ned_t> position_target_local_ned;
 
 	// Global Position Target
-	mavlink_position_target_global_int_t position_target_global_int;
+	Snapshot<mavlink_position_target_global_int_t> position_target_global_int;
 
 	// HiRes IMU
-	mavlink_highres_imu_t highres_imu;
+	Snapshot<mavlink_highres_imu_t> highres_imu;
 
 	// Attitude
-	mavlink_attitude_t attitude;
-
-	// System Parameters?
+	Snapshot<mavlink_attitude_t> attitude;
 
+	// Command Acknowledgement, always kept
+	Snapshot<mavlink_command_ack_t> command_ack;
 
-	// Time Stamps
-	Time_Stamps time_stamps;
-
-	void
-	reset_timestamps()
-	{
-		time_stamps.reset_timestamps();
-	}
+	// System Parameters?
 
 };
 
@@ -225,11 +284,29 @@ struct Mavlink_Messages {
 /*
  * Autopilot Interface Class
  *
- * This starts two threads for read and write over MAVlink. The read thread
- * listens for any MAVlink message and pushes it to the current_messages
- * attribute.  The write thread at the moment only streams a position target
- * in the local NED frame (mavlink_set_position_target_local_ned_t), which
- * is changed by using the method update_setpoint().  Sending these messages
+ * This starts one event loop thread for read and write over MAVlink. It
+ * sleeps in epoll until the port is readable, a new setpoint is given or
+ * the keep-alive timer fires. Every MAVlink message is published to the
+ * current_messages attribute as soon as it is parsed, where each message
+ * is a Snapshot that other threads read without locking.  Only the
+ * message IDs somebody subscribed to are decoded, other components can
+ * subscribe() with a callback or a Message_Queue.  On start() the
+ * autopilot is asked to stream exactly the subscribed messages, at the
+ * rates given to set_message_rate(), and to stop the streams nobody uses.
+ * The loop at the moment only streams a position target in the local NED
+ * frame (mavlink_set_position_target_local_ned_t), which is changed by using the
+ * method update_setpoint().  A new setpoint wakes the loop so it is sent
+ * right away, otherwise the last one is resent from a timerfd every
+ * setpoint_keepalive_usec.  The loop also runs the TIMESYNC exchange of
+ * the clock service, so clock converts between the local, autopilot and
+ * camera clocks.  The attitude and local position are also kept in
+ * history for the last second, stamped on the local clock, so the state at
+ * the time a frame was captured can be looked up with history.attitude.at(),
+ * track_history() adds the other messages.  While trajectory_rate_hz is set the setpoint
+ * given is only the target of the trajectory generator, and the timerfd
+ * streams the steps towards it at that rate, so the velocity does not
+ * jump each time vision decides something new.  Once the steps reach the
+ * target the timerfd drops back to the keep-alive period.  Sending these messages
  * are only half the requirement to get response from the autopilot, a signal
  * to enter "offboard_control" mode is sent by using the enable_offboard_control()
  * method.  Signal the exit of this mode with disable_offboard_control().  It's
@@ -242,22 +319,43 @@ class Autopilot_Interface
 public:
 
 	Autopilot_Interface();
-	Autopilot_Interface(Serial_Port *serial_port_);
+	Autopilot_Interface(Generic_Port *port_);
 	~Autopilot_Interface();
 
 	char reading_status;
 	char writing_status;
 	char control_status;
     uint64_t write_count;
+	uint64_t setpoint_keepalive_usec;
+	float    trajectory_rate_hz;       // 0 streams the setpoints as given, set before start()
+	bool     print_setpoints;  // print every setpoint given to update_setpoint()
+	bool     disable_unused_messages;  // stop the streams nobody subscribed to
+	uint64_t rate_check_usec;          // 0 to not check the received rates
 
     int system_id;
 	int autopilot_id;
 	int companion_id;
 
 	Mavlink_Messages current_messages;
+	Trajectory_Generator trajectory;
+	Clock_Service        clock;
+	Vehicle_History      history;
 	mavlink_set_position_target_local_ned_t initial_position;
 
+	int  subscribe(uint32_t msgid, Message_Callback callback, void *context);
+	int  subscribe(uint32_t msgid, Message_Queue *queue);
+	int  track_message(uint32_t msgid);
+	int  track_history(uint32_t msgid);
+	int  set_message_rate(uint32_t msgid, float rate_hz);
+
+	void request_message_rates();
+	void check_message_rates();
+	int  send_command(mavlink_command_long_t com);
+
 	void update_setpoint(mavlink_set_position_target_local_ned_t setpoint);
+	mavlink_set_position_target_local_ned_t get_setpoint() const;
+	Latency_Stats get_setpoint_latency();
+	void print_setpoint_latency();
 	void read_messages();
 	int  write_message(mavlink_message_t message);
 
@@ -267,27 +365,50 @@ public:
 	void start();
 	void stop();
 
-	void start_read_thread();
-	void start_write_thread(void);
+	void start_event_thread();
 
 	void handle_quit( int sig );
 
 
 private:
 
-	Serial_Port *serial_port;
+	Generic_Port *port;
 
 	bool time_to_exit;
 
-	pthread_t read_tid;
-	pthread_t write_tid;
-
-	mavlink_set_position_target_local_ned_t current_setpoint;
-
-	void read_thread();
-	void write_thread(void);
+	pthread_t event_tid;
+	int       epoll_fd;   // waits on the port, wake_fd and timer_fd
+	int       timer_fd;   // setpoint keep-alive, or the trajectory steps
+	uint64_t  timer_period_usec;  // timer_fd was last armed with, 0 if never
+	int       wake_fd;    // eventfd, signals a new setpoint or exit
+	int       sync_fd;    // next TIMESYNC request
+
+	Mavlink_Source current_source;  // last source seen, event loop only
+	Message_Router router;          // subscribers of each message ID
+
+	float message_rate_hz[MESSAGE_ROUTER_MAX_ID];                 // 0 for the default rate
+	std::atomic<unsigned int> message_count[MESSAGE_ROUTER_MAX_ID];  // received, event loop writes
+
+	Snapshot<mavlink_set_position_target_local_ned_t> current_setpoint;  // publish under setpoint_lock
+	bool            setpoint_pending;      // a new setpoint has not been written yet
+	uint64_t        setpoint_update_usec;  // when the pending setpoint was given
+	Latency_Stats   setpoint_latency;
+	pthread_mutex_t setpoint_lock;
+
+	void event_thread();
+	void wake();
+	void arm_keepalive();
+	uint64_t setpoint_period_usec() const;
+	void handle_message(const mavlink_message_t &message);
+	void handle_timesync(const mavlink_message_t &message);
+	void write_timesync(const mavlink_timesync_t &timesync);
+	void arm_timesync();
 
 	int toggle_offboard_control( bool flag );
+	bool stream_wanted(uint32_t msgid) const;
+	float message_rate(uint32_t msgid) const;
+	int set_message_interval(uint32_t msgid, float rate_hz);
+	void request_data_streams();
 	void write_setpoint();
 
 };
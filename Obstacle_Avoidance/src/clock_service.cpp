@@ -0,0 +1,376 @@
+/**
+ * @file clock_service.cpp
+ *
+ * @brief Clock service functions
+ *
+ * Keeps every timestamp of the program on one monotonic clock, and relates
+ * it to the clock of the autopilot (from MAVLink TIMESYNC) and to the wall
+ * clock the ZED stamps its frames with
+ *
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "clock_service.h"
+
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+
+
+// ----------------------------------------------------------------------------------
+//   Time
+// ----------------------------------------------------------------------------------
+uint64_t
+get_time_usec()
+{
+	struct timeval time_stamp;
+	gettimeofday(&time_stamp, NULL);
+	return (uint64_t) time_stamp.tv_sec*1000000 + time_stamp.tv_usec;
+}
+
+uint64_t
+get_monotonic_usec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+
+// ----------------------------------------------------------------------------------
+//   Clock Service Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Clock_Service::
+Clock_Service()
+{
+	num_samples   = 0;
+	next_sample   = 0;
+	total_samples = 0;
+
+	// the wall clock is related right away, the autopilot once it answers
+	Clock_Estimate estimate;
+	estimate.synced           = false;
+	estimate.ref_local_usec   = get_monotonic_usec();
+	estimate.offset_usec      = 0;
+	estimate.drift            = 0;
+	estimate.rtt_usec         = 0;
+	estimate.fitted           = 0;
+	estimate.wall_offset_usec = wall_offset_usec();
+	current.publish(estimate, estimate.ref_local_usec);
+}
+
+Clock_Service::
+~Clock_Service()
+{}
+
+
+// ------------------------------------------------------------------------------
+//   Request
+// ------------------------------------------------------------------------------
+// TIMESYNC times are in nanoseconds, a request carries ours in ts1
+mavlink_timesync_t
+Clock_Service::
+request(uint64_t now_usec)
+{
+	mavlink_timesync_t timesync;
+	timesync.tc1 = 0;
+	timesync.ts1 = (int64_t) now_usec * 1000;
+	return timesync;
+}
+
+// Faster until the first samples are in
+uint64_t
+Clock_Service::
+request_period_usec() const
+{
+	if ( total_samples < TIMESYNC_STARTUP_SAMPLES )
+		return TIMESYNC_STARTUP_PERIOD_USEC;
+	return TIMESYNC_PERIOD_USEC;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Handle Timesync
+// ------------------------------------------------------------------------------
+// Returns true when reply should be sent back
+bool
+Clock_Service::
+handle_timesync(const mavlink_timesync_t &timesync, uint64_t now_usec, mavlink_timesync_t &reply)
+{
+	// --------------------------------------------------------------------------
+	//   REQUEST FROM THE AUTOPILOT
+	// --------------------------------------------------------------------------
+	if ( timesync.tc1 == 0 )
+	{
+		reply.tc1 = (int64_t) now_usec * 1000;
+		reply.ts1 = timesync.ts1;
+		return true;
+	}
+
+	// --------------------------------------------------------------------------
+	//   REPLY TO ONE OF OURS
+	// --------------------------------------------------------------------------
+
+	// ts1 is our clock when we asked, anything else was not our request
+	int64_t sent_usec = timesync.ts1 / 1000;
+	int64_t rtt_usec  = (int64_t) now_usec - sent_usec;
+	if ( rtt_usec < 0 || rtt_usec > TIMESYNC_MAX_RTT_USEC )
+		return false;
+
+	Clock_Sample sample;
+	sample.local_usec  = sent_usec + rtt_usec / 2;
+	sample.offset_usec = timesync.tc1 / 1000.0 - (double) sample.local_usec;
+	sample.rtt_usec    = rtt_usec;
+
+	// a clock that jumped far off the line was restarted, start over
+	Clock_Estimate estimate;
+	current.read(estimate);
+	if ( estimate.synced )
+	{
+		double predicted = estimate.offset_usec +
+			estimate.drift * ((double) sample.local_usec - (double) estimate.ref_local_usec);
+		if ( fabs(sample.offset_usec - predicted) > TIMESYNC_RESET_USEC )
+		{
+			fprintf(stderr,"WARNING: autopilot clock jumped by %.0f ms, syncing again\n",
+			        (sample.offset_usec - predicted) / 1000);
+			num_samples   = 0;
+			next_sample   = 0;
+			total_samples = 0;
+		}
+	}
+
+	add_sample(sample);
+	fit(now_usec);
+
+	return false;
+}
+
+void
+Clock_Service::
+add_sample(const Clock_Sample &sample)
+{
+	samples[next_sample] = sample;
+	next_sample = (next_sample + 1) % TIMESYNC_SAMPLES;
+	if ( num_samples < TIMESYNC_SAMPLES )
+		num_samples++;
+	total_samples++;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Fit
+// ------------------------------------------------------------------------------
+/*
+ * A round trip that sat in a queue on either side is longer and its
+ * midpoint is off, so only the ones within TIMESYNC_RTT_MARGIN_USEC of
+ * the shortest are used. Once they span TIMESYNC_DRIFT_SPAN_USEC a line
+ * is fitted through them by least squares, before that the last drift is
+ * kept and only the offset is averaged.
+ */
+void
+Clock_Service::
+fit(uint64_t now_usec)
+{
+	if ( not num_samples )
+		return;
+
+	Clock_Estimate previous;
+	current.read(previous);
+
+	uint64_t min_rtt   = UINT64_MAX;
+	uint64_t ref_usec  = 0;
+	uint64_t first_usec = UINT64_MAX;
+	for ( int i = 0; i < num_samples; i++ )
+		if ( samples[i].rtt_usec < min_rtt )
+			min_rtt = samples[i].rtt_usec;
+
+	// times are taken from the newest sample used, to keep the sums small
+	for ( int i = 0; i < num_samples; i++ )
+	{
+		if ( samples[i].rtt_usec > min_rtt + TIMESYNC_RTT_MARGIN_USEC )
+			continue;
+		if ( samples[i].local_usec > ref_usec )
+			ref_usec = samples[i].local_usec;
+		if ( samples[i].local_usec < first_usec )
+			first_usec = samples[i].local_usec;
+	}
+
+	double sum_t = 0, sum_o = 0, sum_tt = 0, sum_to = 0;
+	int n = 0;
+	for ( int i = 0; i < num_samples; i++ )
+	{
+		if ( samples[i].rtt_usec > min_rtt + TIMESYNC_RTT_MARGIN_USEC )
+			continue;
+		double t = (double) samples[i].local_usec - (double) ref_usec;
+		double o = samples[i].offset_usec;
+		sum_t  += t;
+		sum_o  += o;
+		sum_tt += t * t;
+		sum_to += t * o;
+		n++;
+	}
+
+	Clock_Estimate estimate;
+	estimate.synced         = true;
+	estimate.ref_local_usec = ref_usec;
+	estimate.rtt_usec       = min_rtt;
+	estimate.fitted         = n;
+	estimate.drift          = previous.synced ? previous.drift : 0;
+
+	// --------------------------------------------------------------------------
+	//   OFFSET AND DRIFT
+	// --------------------------------------------------------------------------
+	double denominator = n * sum_tt - sum_t * sum_t;
+	if ( n >= 3 && ref_usec - first_usec >= TIMESYNC_DRIFT_SPAN_USEC && denominator > 0 )
+	{
+		double drift = (n * sum_to - sum_t * sum_o) / denominator;
+		if ( fabs(drift) <= TIMESYNC_MAX_DRIFT )
+			estimate.drift = drift;
+	}
+
+	// the offset at ref_usec, with the drift taken out of every sample
+	estimate.offset_usec = (sum_o - estimate.drift * sum_t) / n;
+
+	estimate.wall_offset_usec = wall_offset_usec();
+
+	current.publish(estimate, now_usec);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Estimate
+// ------------------------------------------------------------------------------
+bool
+Clock_Service::
+synced() const
+{
+	Clock_Estimate estimate;
+	current.read(estimate);
+	return estimate.synced;
+}
+
+Clock_Estimate
+Clock_Service::
+estimate() const
+{
+	Clock_Estimate estimate;
+	current.read(estimate);
+	return estimate;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Conversions
+// ------------------------------------------------------------------------------
+// 0 until the autopilot has answered
+uint64_t
+Clock_Service::
+local_to_autopilot_usec(uint64_t local_usec) const
+{
+	Clock_Estimate estimate;
+	current.read(estimate);
+	if ( not estimate.synced )
+		return 0;
+
+	double offset = estimate.offset_usec +
+		estimate.drift * ((double) local_usec - (double) estimate.ref_local_usec);
+	return (uint64_t) llround((double) local_usec + offset);
+}
+
+// 0 until the autopilot has answered
+uint64_t
+Clock_Service::
+autopilot_to_local_usec(uint64_t autopilot_usec) const
+{
+	Clock_Estimate estimate;
+	current.read(estimate);
+	if ( not estimate.synced )
+		return 0;
+
+	// the drift is taken at the local time the offset alone gives, which
+	// is off by far less than a microsecond
+	double local  = (double) autopilot_usec - estimate.offset_usec;
+	double offset = estimate.offset_usec +
+		estimate.drift * (local - (double) estimate.ref_local_usec);
+	return (uint64_t) llround((double) autopilot_usec - offset);
+}
+
+uint64_t
+Clock_Service::
+boot_ms_to_local_usec(uint32_t time_boot_ms) const
+{
+	return autopilot_to_local_usec((uint64_t) time_boot_ms * 1000);
+}
+
+// Now on the autopilot clock, or on the local one until it has answered
+uint32_t
+Clock_Service::
+autopilot_boot_ms() const
+{
+	uint64_t now = get_monotonic_usec();
+	uint64_t autopilot_usec = local_to_autopilot_usec(now);
+	return (uint32_t) ((autopilot_usec ? autopilot_usec : now) / 1000);
+}
+
+uint64_t
+Clock_Service::
+wall_to_local_usec(uint64_t wall_usec) const
+{
+	Clock_Estimate estimate;
+	current.read(estimate);
+	return wall_usec - estimate.wall_offset_usec;
+}
+
+// The ZED stamps frames with the wall clock in nanoseconds
+uint64_t
+Clock_Service::
+zed_to_local_usec(uint64_t zed_ns) const
+{
+	return wall_to_local_usec(zed_ns / 1000);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Print Status
+// ------------------------------------------------------------------------------
+void
+Clock_Service::
+print_status() const
+{
+	Clock_Estimate estimate;
+	current.read(estimate);
+
+	if ( not estimate.synced )
+	{
+		printf("CLOCK SYNC: no TIMESYNC replies from the autopilot\n");
+		return;
+	}
+
+	printf("CLOCK SYNC: autopilot clock %+.3f ms from the local one, drift %+.2f ppm, round trip %.2f ms (%d samples fitted)\n",
+	       estimate.offset_usec / 1000, estimate.drift * 1e6,
+	       estimate.rtt_usec / 1000.0, estimate.fitted);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Wall Clock Offset
+// ------------------------------------------------------------------------------
+// The wall clock is read between two reads of the local clock, and taken
+// as read halfway between them
+int64_t
+Clock_Service::
+wall_offset_usec()
+{
+	uint64_t before = get_monotonic_usec();
+	uint64_t wall   = get_time_usec();
+	uint64_t after  = get_monotonic_usec();
+	return (int64_t) wall - (int64_t) ((before + after) / 2);
+}
@@ -0,0 +1,167 @@
+/**
+ * @file clock_service.h
+ *
+ * @brief Clock service definition
+ *
+ * Keeps every timestamp of the program on one monotonic clock, and relates
+ * it to the clock of the autopilot (from MAVLink TIMESYNC) and to the wall
+ * clock the ZED stamps its frames with
+ *
+ */
+
+#ifndef CLOCK_SERVICE_H_
+#define CLOCK_SERVICE_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <stdio.h>
+#include <stdint.h>
+
+#include <common/mavlink.h>
+
+#include "snapshot.h"
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// TIMESYNC requests are sent this often, faster until there are a few samples
+#define TIMESYNC_PERIOD_USEC         1000000
+#define TIMESYNC_STARTUP_PERIOD_USEC 100000
+#define TIMESYNC_STARTUP_SAMPLES     10
+
+// Round trips the offset and drift are fitted over
+#define TIMESYNC_SAMPLES 32
+
+// A round trip longer than this is not used at all, and one longer than
+// the shortest in the window by more than the margin is left out of the fit
+#define TIMESYNC_MAX_RTT_USEC    100000
+#define TIMESYNC_RTT_MARGIN_USEC 2000
+
+// Local time the samples have to span before a drift is fitted
+#define TIMESYNC_DRIFT_SPAN_USEC 5000000
+
+// Crystals are far better than this, a larger drift is a bad fit
+#define TIMESYNC_MAX_DRIFT 0.0005
+
+// An offset this far from the prediction means the autopilot rebooted
+#define TIMESYNC_RESET_USEC 500000
+
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+// wall clock, only for logs, jumps when the time is set
+uint64_t get_time_usec();
+
+// the clock every timestamp of the program is on, never jumps
+uint64_t get_monotonic_usec();
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+// One TIMESYNC round trip
+
+struct Clock_Sample {
+
+	uint64_t local_usec;   // halfway through the round trip
+	double   offset_usec;  // autopilot clock minus local clock
+	uint64_t rtt_usec;
+
+};
+
+// Relation of the autopilot and wall clocks to the local monotonic one
+
+struct Clock_Estimate {
+
+	bool     synced;            // there is an autopilot offset
+	uint64_t ref_local_usec;    // local time the offset is at
+	double   offset_usec;       // autopilot minus local at ref_local_usec
+	double   drift;             // change of the offset per local microsecond
+	uint64_t rtt_usec;          // shortest round trip that was fitted
+	int      fitted;            // samples in the fit
+	int64_t  wall_offset_usec;  // wall clock minus local clock
+
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Clock Service Class
+// ----------------------------------------------------------------------------------
+/*
+ * Clock Service Class
+ *
+ * The local clock is CLOCK_MONOTONIC, which every other timestamp in the
+ * program is taken from. The autopilot clock is its time since boot, the
+ * one in time_boot_ms and in its TIMESYNC replies.
+ *
+ * The owner of the link sends request() now and then and hands every
+ * TIMESYNC that arrives to handle_timesync(). A reply to one of ours gives
+ * the offset of the autopilot clock halfway through the round trip. The
+ * round trips that were not held up in a queue (the ones close to the
+ * shortest) are fitted with a line, which gives the offset and its drift,
+ * so the conversion stays good between samples. A request from the
+ * autopilot is answered with the local clock.
+ *
+ * The ZED stamps its frames with the wall clock, in nanoseconds. The wall
+ * clock is related to the local one each time a sample is fitted, so a
+ * step of the wall clock only lasts until the next sample.
+ *
+ * Only the owner of the link calls request() and handle_timesync(), the
+ * conversions can be used from any thread. They read the estimate from a
+ * Snapshot and never block.
+ */
+class Clock_Service
+{
+
+public:
+
+	Clock_Service();
+	~Clock_Service();
+
+	// owner of the link only
+	mavlink_timesync_t request(uint64_t now_usec);
+	bool handle_timesync(const mavlink_timesync_t &timesync, uint64_t now_usec,
+	                     mavlink_timesync_t &reply);
+	uint64_t request_period_usec() const;
+
+	// any thread
+	bool synced() const;
+	Clock_Estimate estimate() const;
+
+	uint64_t local_to_autopilot_usec(uint64_t local_usec) const;
+	uint64_t autopilot_to_local_usec(uint64_t autopilot_usec) const;
+	uint64_t boot_ms_to_local_usec(uint32_t time_boot_ms) const;
+	uint32_t autopilot_boot_ms() const;
+
+	uint64_t wall_to_local_usec(uint64_t wall_usec) const;
+	uint64_t zed_to_local_usec(uint64_t zed_ns) const;
+
+	void print_status() const;
+
+private:
+
+	Snapshot<Clock_Estimate> current;
+
+	// owner of the link only
+	Clock_Sample samples[TIMESYNC_SAMPLES];
+	int          num_samples;
+	int          next_sample;
+	uint64_t     total_samples;
+
+	void add_sample(const Clock_Sample &sample);
+	void fit(uint64_t now_usec);
+
+	static int64_t wall_offset_usec();
+
+};
+
+
+#endif // CLOCK_SERVICE_H_
@@ -0,0 +1,115 @@
+/**
+ * @file depth_grid.cpp
+ *
+ * @brief Depth grid functions
+ *
+ * Per frame aggregation of the depth image into square cells, counting the
+ * pixels of each cell that fall into each depth band
+ *
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "depth_grid.h"
+
+#include <algorithm>
+
+
+// ----------------------------------------------------------------------------------
+//   Depth Grid Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Depth_Grid::
+Depth_Grid(int image_width_, int image_height_, int cell_size_,
+           const float *band_limits_, int num_bands_)
+{
+	image_width  = image_width_;
+	image_height = image_height_;
+	cell_size    = cell_size_;
+
+	cols = (image_width  + cell_size - 1) / cell_size;
+	rows = (image_height + cell_size - 1) / cell_size;
+
+	if ( num_bands_ < 1 || num_bands_ > DEPTH_GRID_MAX_BANDS )
+	{
+		fprintf(stderr,"ERROR: depth grid needs between 1 and %d bands\n", DEPTH_GRID_MAX_BANDS);
+		throw 1;
+	}
+
+	num_bands = num_bands_;
+	for ( int b = 0; b < num_bands; b++ )
+		band_limits[b] = band_limits_[b];
+
+	counts    = new int[num_bands * cols * rows];
+	integrals = new int[num_bands * (cols + 1) * (rows + 1)];
+
+	clear();
+	std::fill(integrals, integrals + num_bands * (cols + 1) * (rows + 1), 0);
+}
+
+Depth_Grid::
+~Depth_Grid()
+{
+	delete[] counts;
+	delete[] integrals;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Clear
+// ------------------------------------------------------------------------------
+void
+Depth_Grid::
+clear()
+{
+	std::fill(counts, counts + num_bands * cols * rows, 0);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Build Summed Area Tables
+// ------------------------------------------------------------------------------
+void
+Depth_Grid::
+build_integrals()
+{
+	const int stride = cols + 1;
+
+	for ( int b = 0; b < num_bands; b++ )
+	{
+		const int *cell  = counts    + b * cols * rows;
+		int       *table = integrals + b * stride * (rows + 1);
+
+		for ( int r = 0; r < rows; r++ )
+		{
+			int row_sum = 0;
+			for ( int c = 0; c < cols; c++ )
+			{
+				row_sum += cell[r * cols + c];
+				table[(r + 1) * stride + (c + 1)] = table[r * stride + (c + 1)] + row_sum;
+			}
+		}
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Window Sum
+// ------------------------------------------------------------------------------
+// Pixels of the band in cells [col0, col1) x [row0, row1)
+int
+Depth_Grid::
+band_sum(int band, int col0, int row0, int col1, int row1) const
+{
+	const int stride = cols + 1;
+	const int *table = integrals + band * stride * (rows + 1);
+
+	return table[row1 * stride + col1] - table[row0 * stride + col1]
+	     - table[row1 * stride + col0] + table[row0 * stride + col0];
+}
@@ -0,0 +1,86 @@
+/**
+ * @file depth_grid.h
+ *
+ * @brief Depth grid definition
+ *
+ * Per frame aggregation of the depth image into square cells, counting the
+ * pixels of each cell that fall into each depth band. Everything that
+ * searches the image for free space works from this one grid instead of
+ * making its own pass over the pixels.
+ *
+ */
+
+#ifndef DEPTH_GRID_H_
+#define DEPTH_GRID_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <stdio.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+#define DEPTH_GRID_MAX_BANDS 8
+
+
+// ----------------------------------------------------------------------------------
+//   Depth Grid Class
+// ----------------------------------------------------------------------------------
+/*
+ * Depth Grid Class
+ *
+ * Band b holds the pixels with a depth in (band_limits[b-1], band_limits[b]],
+ * band 0 holds everything up to band_limits[0] (including pixels that are
+ * too close to be measured). Pixels past the last band are not counted.
+ * After the pixel loop, build_integrals() makes a summed area table for each
+ * band so any window of cells can be counted with four lookups.
+ */
+class Depth_Grid
+{
+
+public:
+
+	Depth_Grid(int image_width_, int image_height_, int cell_size_,
+	           const float *band_limits_, int num_bands_);
+	~Depth_Grid();
+
+	int image_width;
+	int image_height;
+	int cell_size;
+	int cols;
+	int rows;
+	int num_bands;
+	float band_limits[DEPTH_GRID_MAX_BANDS];
+
+	void clear();
+
+	// called for every pixel closer than max_depth()
+	void add_pixel(int x, int y, float depth)
+	{
+		int band = 0;
+		while ( band < num_bands - 1 && depth > band_limits[band] )
+			band++;
+		counts[band * cols * rows + (y / cell_size) * cols + (x / cell_size)]++;
+	}
+
+	float max_depth() const { return band_limits[num_bands - 1]; }
+
+	const int* band_counts(int band) const { return counts + band * cols * rows; }
+
+	void build_integrals();
+	int  band_sum(int band, int col0, int row0, int col1, int row1) const;
+
+private:
+
+	int *counts;     // pixels of each band in each cell, band major
+	int *integrals;  // summed area table of each band, (cols+1) x (rows+1)
+
+};
+
+
+#endif // DEPTH_GRID_H_
@@ -0,0 +1,219 @@
+/**
+ * @file frame_alignment.cpp
+ *
+ * @brief Frame alignment functions
+ *
+ * Relates the pixels of a depth frame to the level frame the velocity
+ * setpoints are flown in, from the attitude of the vehicle when the frame
+ * was captured and the turn it makes before the setpoint reaches it
+ *
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "frame_alignment.h"
+
+#include <math.h>
+
+
+// ----------------------------------------------------------------------------------
+//   Frame Alignment Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Frame_Alignment::
+Frame_Alignment(float fx, float fy, float cx, float cy)
+{
+	focal_x  = fx;
+	focal_y  = fy;
+	center_x = cx;
+	center_y = cy;
+	latency  = 0;
+
+	level();
+}
+
+Frame_Alignment::
+~Frame_Alignment()
+{}
+
+
+// ------------------------------------------------------------------------------
+//   Update
+// ------------------------------------------------------------------------------
+/*
+ * The attitude at capture_usec is interpolated from the history, or the
+ * newest one is used if the frame is newer than it. ATTITUDE carries body
+ * rates, the heading turns at (q sin(roll) + r cos(roll)) / cos(pitch).
+ * Returns false, and leaves the frame level, if there is no attitude yet.
+ */
+bool
+Frame_Alignment::
+update(const History<mavlink_attitude_t, HISTORY_ATTITUDE_LENGTH> &attitude,
+       uint64_t capture_usec)
+{
+	mavlink_attitude_t state;
+	uint64_t state_usec;
+	if ( not attitude.at(capture_usec, state) && not attitude.latest(state, state_usec) )
+	{
+		level();
+		return false;
+	}
+
+	double cos_pitch = cos(state.pitch);
+	if ( fabs(cos_pitch) < 1e-3 )
+	{
+		level();
+		return false;
+	}
+
+	double heading_rate = (state.pitchspeed * sin(state.roll) + state.yawspeed * cos(state.roll)) / cos_pitch;
+	double horizon = fmin(latency, (double) FRAME_MAX_PREDICTION_USEC) / 1e6;
+
+	yaw = state.yaw;
+	set_rotation(state.roll, state.pitch, (float) (heading_rate * horizon));
+	return true;
+}
+
+void
+Frame_Alignment::
+level()
+{
+	yaw = 0;
+	set_rotation(0, 0, 0);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Latency
+// ------------------------------------------------------------------------------
+// Time from the capture of a frame until its setpoint is written
+void
+Frame_Alignment::
+measure_latency(uint64_t usec)
+{
+	if ( latency == 0 )
+		latency = usec;
+	else
+		latency += FRAME_LATENCY_SMOOTHING * ((double) usec - latency);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Direction
+// ------------------------------------------------------------------------------
+// The unit direction towards pixel (x, y) in the y z plane of the setpoint
+// frame, false if the pixel is straight ahead
+bool
+Frame_Alignment::
+direction(float x, float y, float &vy, float &vz) const
+{
+	float ray[3] = { 1, (x - center_x) / focal_x, (y - center_y) / focal_y };
+
+	float ry = rotation[1][0] * ray[0] + rotation[1][1] * ray[1] + rotation[1][2] * ray[2];
+	float rz = rotation[2][0] * ray[0] + rotation[2][1] * ray[1] + rotation[2][2] * ray[2];
+
+	float length = sqrtf(ry * ry + rz * rz);
+	if ( length < 1e-6 )
+	{
+		vy = 0;
+		vz = 0;
+		return false;
+	}
+
+	vy = ry / length;
+	vz = rz / length;
+	return true;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Closing Speed
+// ------------------------------------------------------------------------------
+/*
+ * How fast a velocity in north, east and down moves towards pixel (x, y).
+ * The velocity is turned into the setpoint frame by the predicted heading,
+ * the same frame the ray of the pixel is rotated into.
+ */
+float
+Frame_Alignment::
+closing_speed(float x, float y, float north, float east, float down) const
+{
+	float ray[3] = { 1, (x - center_x) / focal_x, (y - center_y) / focal_y };
+	float length = sqrtf(ray[0] * ray[0] + ray[1] * ray[1] + ray[2] * ray[2]);
+
+	float heading = yaw + heading_change;
+	float velocity[3] = {  cosf(heading) * north + sinf(heading) * east,
+	                      -sinf(heading) * north + cosf(heading) * east,
+	                       down };
+
+	float speed = 0;
+	for ( int i = 0; i < 3; i++ )
+	{
+		float r = rotation[i][0] * ray[0] + rotation[i][1] * ray[1] + rotation[i][2] * ray[2];
+		speed += r * velocity[i];
+	}
+	return speed / length;
+}
+
+// Distance along the ray of pixel (x, y) to a point at depth along the
+// camera axis, the depth the ZED measures
+float
+Frame_Alignment::
+range(float x, float y, float depth) const
+{
+	float ray[3] = { 1, (x - center_x) / focal_x, (y - center_y) / focal_y };
+	return depth * sqrtf(ray[0] * ray[0] + ray[1] * ray[1] + ray[2] * ray[2]);
+}
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Rotation
+// ------------------------------------------------------------------------------
+/*
+ * Body to level is R = Ry(pitch) Rx(roll), then the level frame at the
+ * capture is turned into the one of the predicted heading by Rz(-change).
+ * The reference point is the setpoint frame x axis taken back into the
+ * camera, which is the first row of the rotation.
+ */
+void
+Frame_Alignment::
+set_rotation(float roll_, float pitch_, float heading_change_)
+{
+	roll           = roll_;
+	pitch          = pitch_;
+	heading_change = heading_change_;
+
+	float cr = cosf(roll),  sr = sinf(roll);
+	float cp = cosf(pitch), sp = sinf(pitch);
+	float ch = cosf(heading_change), sh = sinf(heading_change);
+
+	// Ry(pitch) Rx(roll)
+	float level[3][3] = {
+		{  cp, sp * sr, sp * cr },
+		{   0,      cr,    -sr  },
+		{ -sp, cp * sr, cp * cr }
+	};
+
+	// Rz(-heading_change) level
+	for ( int j = 0; j < 3; j++ )
+	{
+		rotation[0][j] =  ch * level[0][j] + sh * level[1][j];
+		rotation[1][j] = -sh * level[0][j] + ch * level[1][j];
+		rotation[2][j] =  level[2][j];
+	}
+
+	// a reference behind the camera would never be reached, keep the center
+	if ( rotation[0][0] <= 1e-3 )
+	{
+		ref_x = center_x;
+		ref_y = center_y;
+		return;
+	}
+	ref_x = center_x + focal_x * rotation[0][1] / rotation[0][0];
+	ref_y = center_y + focal_y * rotation[0][2] / rotation[0][0];
+}
@@ -0,0 +1,105 @@
+/**
+ * @file frame_alignment.h
+ *
+ * @brief Frame alignment definition
+ *
+ * Relates the pixels of a depth frame to the level frame the velocity
+ * setpoints are flown in, from the attitude of the vehicle when the frame
+ * was captured and the turn it makes before the setpoint reaches it
+ *
+ */
+
+#ifndef FRAME_ALIGNMENT_H_
+#define FRAME_ALIGNMENT_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "state_history.h"
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// Weight of the newest latency measured in the smoothed latency
+#define FRAME_LATENCY_SMOOTHING 0.1
+
+// The heading is never predicted further ahead than this
+#define FRAME_MAX_PREDICTION_USEC 500000
+
+
+// ----------------------------------------------------------------------------------
+//   Frame Alignment Class
+// ----------------------------------------------------------------------------------
+/*
+ * Frame Alignment Class
+ *
+ * The camera looks along the body x axis, with the image x to the body y
+ * (right) and the image y to the body z (down). A velocity in
+ * MAV_FRAME_BODY_NED is flown in the level frame turned to the heading of
+ * the vehicle, so a pixel is only straight ahead, left or above in that
+ * frame once the roll and pitch of the frame are taken out, and the turn
+ * of the heading until the setpoint is flown.
+ *
+ * update() is called once per frame with the time it was captured. It
+ * looks the attitude up in the history, predicts the heading over the
+ * smoothed pipeline latency and keeps the rotation from the camera to the
+ * frame the setpoint will be flown in. Everything per pixel stays in image
+ * coordinates, only the reference point (the pixel the vehicle will be
+ * heading at) and the direction of each selected pixel go through it.
+ */
+class Frame_Alignment
+{
+
+public:
+
+	Frame_Alignment(float fx, float fy, float cx, float cy);
+	~Frame_Alignment();
+
+	bool update(const History<mavlink_attitude_t, HISTORY_ATTITUDE_LENGTH> &attitude,
+	            uint64_t capture_usec);
+	void level();
+
+	void measure_latency(uint64_t usec);
+	uint64_t latency_usec() const { return (uint64_t) latency; }
+
+	float reference_x() const { return ref_x; }
+	float reference_y() const { return ref_y; }
+	bool  direction(float x, float y, float &vy, float &vz) const;
+	float closing_speed(float x, float y, float north, float east, float down) const;
+	float range(float x, float y, float depth) const;
+
+	// along the camera axis, how fast the depth of a still point falls
+	float forward_speed(float north, float east, float down) const { return closing_speed(center_x, center_y, north, east, down); }
+
+	// of the last update(), in radians
+	float roll;
+	float pitch;
+	float yaw;
+	float heading_change;
+
+private:
+
+	float focal_x;       // camera intrinsics, in pixels
+	float focal_y;
+	float center_x;
+	float center_y;
+
+	float rotation[3][3];  // camera to the frame the setpoint is flown in
+	float ref_x;
+	float ref_y;
+
+	double latency;        // smoothed capture to write, in microseconds
+
+	void set_rotation(float roll_, float pitch_, float heading_change_);
+
+};
+
+
+#endif // FRAME_ALIGNMENT_H_
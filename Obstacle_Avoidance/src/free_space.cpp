@@ -0,0 +1,174 @@
+/**
+ * @file free_space.cpp
+ *
+ * @brief Free space search functions
+ *
+ * Finds obstacle free rectangles in a downsampled obstacle mask of the
+ * depth image, as an alternative to the fixed lattice of sections
+ *
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "free_space.h"
+
+#include <algorithm>
+
+
+// ----------------------------------------------------------------------------------
+//   Free Space Search Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Free_Space_Search::
+Free_Space_Search(const Depth_Grid *grid_)
+{
+	grid = grid_;
+
+	image_width  = grid->image_width;
+	image_height = grid->image_height;
+	cell_size    = grid->cell_size;
+	cols         = grid->cols;
+	rows         = grid->rows;
+
+	heights = new int[cols];
+	stack   = new int[cols + 1];
+}
+
+Free_Space_Search::
+~Free_Space_Search()
+{
+	delete[] heights;
+	delete[] stack;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Find Free Rectangle
+// ------------------------------------------------------------------------------
+/*
+ * Returns the free rectangle that best fits the goal and is at least
+ * min_width x min_height pixels. For FREE_SPACE_LARGEST the whole rectangle
+ * is returned, for FREE_SPACE_CLOSEST_TO_CENTER a min_width x min_height box
+ * inside of it, placed as close to the image center as possible. Only the
+ * closest band of the grid is used as the obstacle mask.
+ */
+Free_Rect
+Free_Space_Search::
+find(Free_Space_Goal goal, int min_width, int min_height, float max_cell_fraction)
+{
+	Free_Rect best;
+	best.found  = false;
+	best.x      = 0;
+	best.y      = 0;
+	best.width  = 0;
+	best.height = 0;
+	long best_score = 0;
+
+	int min_cols = (min_width  + cell_size - 1) / cell_size;
+	int min_rows = (min_height + cell_size - 1) / cell_size;
+	int max_count = (int) (max_cell_fraction * cell_size * cell_size);
+
+	const int *counts = grid->band_counts(0);
+	std::fill(heights, heights + cols, 0);
+
+	for ( int r = 0; r < rows; r++ )
+	{
+		// ----------------------------------------------------------------------
+		//   UPDATE HISTOGRAM
+		// ----------------------------------------------------------------------
+		const int *row_counts = counts + r * cols;
+		for ( int c = 0; c < cols; c++ )
+		{
+			if ( row_counts[c] > max_count )
+				heights[c] = 0;
+			else
+				heights[c]++;
+		}
+
+		// ----------------------------------------------------------------------
+		//   LARGEST RECTANGLES IN HISTOGRAM
+		// ----------------------------------------------------------------------
+		// Every bar is pushed and popped once. When a bar is popped, the
+		// rectangle of its height reaching from the bar below it on the
+		// stack to the current column is maximal in width.
+		int top = 0;
+		for ( int c = 0; c <= cols; c++ )
+		{
+			int h = ( c < cols ) ? heights[c] : 0;
+
+			while ( top > 0 && heights[stack[top - 1]] >= h )
+			{
+				int height = heights[stack[--top]];
+				int left   = ( top > 0 ) ? stack[top - 1] + 1 : 0;
+
+				if ( height > 0 )
+					_consider(goal, left, c - 1, r, height, min_cols, min_rows,
+					          min_width, min_height, best, best_score);
+			}
+
+			stack[top++] = c;
+		}
+	}
+
+	return best;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Score Candidate Rectangle
+// ------------------------------------------------------------------------------
+void
+Free_Space_Search::
+_consider(Free_Space_Goal goal, int left, int right, int bottom, int height,
+          int min_cols, int min_rows, int min_width, int min_height,
+          Free_Rect &best, long &best_score)
+{
+	int width = right - left + 1;
+	if ( width < min_cols || height < min_rows )
+		return;
+
+	// rectangle in pixels, clipped to the image
+	int x0 = left * cell_size;
+	int y0 = (bottom - height + 1) * cell_size;
+	int x1 = std::min((right + 1) * cell_size, image_width);
+	int y1 = std::min((bottom + 1) * cell_size, image_height);
+	long area = (long) width * height;
+
+	if ( goal == FREE_SPACE_LARGEST )
+	{
+		if ( best.found && area <= best_score )
+			return;
+
+		best.found  = true;
+		best.x      = x0;
+		best.y      = y0;
+		best.width  = x1 - x0;
+		best.height = y1 - y0;
+		best_score  = area;
+		return;
+	}
+
+	// place the footprint inside the rectangle as close to the center as it goes
+	int cx = std::min(std::max(image_width  / 2, x0 + min_width  / 2), x1 - min_width  / 2);
+	int cy = std::min(std::max(image_height / 2, y0 + min_height / 2), y1 - min_height / 2);
+	long dx = cx - image_width  / 2;
+	long dy = cy - image_height / 2;
+
+	// closest first, larger surrounding free space breaks ties
+	long score = -(dx * dx + dy * dy) * ((long) cols * rows + 1) + area;
+	if ( best.found && score <= best_score )
+		return;
+
+	best.found  = true;
+	best.x      = cx - min_width  / 2;
+	best.y      = cy - min_height / 2;
+	best.width  = min_width;
+	best.height = min_height;
+	best_score  = score;
+}
@@ -0,0 +1,91 @@
+/**
+ * @file free_space.h
+ *
+ * @brief Free space search definition
+ *
+ * Finds obstacle free rectangles in a downsampled obstacle mask of the
+ * depth image, as an alternative to the fixed lattice of sections
+ *
+ */
+
+#ifndef FREE_SPACE_H_
+#define FREE_SPACE_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <stdio.h>
+
+#include "depth_grid.h"
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+// What the search should look for
+enum Free_Space_Goal
+{
+	FREE_SPACE_LARGEST = 0,        // the largest free rectangle
+	FREE_SPACE_CLOSEST_TO_CENTER   // the free footprint closest to the image center
+};
+
+// A free rectangle in image pixels
+struct Free_Rect
+{
+	bool found;
+	int  x;
+	int  y;
+	int  width;
+	int  height;
+
+	int center_x() const { return x + width / 2; }
+	int center_y() const { return y + height / 2; }
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Free Space Search Class
+// ----------------------------------------------------------------------------------
+/*
+ * Free Space Search Class
+ *
+ * Works from the closest band of the Depth_Grid, which is filled in inside
+ * the existing pixel loop. find() marks a cell as blocked when too many of
+ * its pixels are obstacles and runs the row histogram / stack method over
+ * the mask, which visits every maximal free rectangle in time linear in the
+ * number of cells.
+ */
+class Free_Space_Search
+{
+
+public:
+
+	Free_Space_Search(const Depth_Grid *grid_);
+	~Free_Space_Search();
+
+	Free_Rect find(Free_Space_Goal goal, int min_width, int min_height, float max_cell_fraction);
+
+private:
+
+	const Depth_Grid *grid;
+
+	int image_width;
+	int image_height;
+	int cell_size;
+	int cols;
+	int rows;
+
+	int *heights;  // free cells above (and including) the current row in each column
+	int *stack;    // column indices with increasing heights
+
+	void _consider(Free_Space_Goal goal, int left, int right, int bottom, int height,
+	               int min_cols, int min_rows, int min_width, int min_height,
+	               Free_Rect &best, long &best_score);
+
+};
+
+
+#endif // FREE_SPACE_H_
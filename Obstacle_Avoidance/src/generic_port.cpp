@@ -0,0 +1,629 @@
+/**
+ * @file generic_port.cpp
+ *
+ * @brief Generic port functions
+ *
+ * The MAVLink side of a connection to the autopilot. Buffering, parsing
+ * and the writer thread live here, the transports only move bytes.
+ *
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "generic_port.h"
+#include "realtime.h"
+#include "clock_service.h"
+
+#include <string.h>
+#include <time.h>
+#include <atomic>
+
+
+// ------------------------------------------------------------------------------
+//   Channels
+// ------------------------------------------------------------------------------
+// MAVLink keeps the parser state and the sequence numbers of each channel,
+// so every port needs its own. Channel 0 is left to the senders that do not
+// say which channel they use.
+static std::atomic<int> next_channel(1);
+
+
+// ----------------------------------------------------------------------------------
+//   Generic Port Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Generic_Port::
+Generic_Port()
+{
+	// Initialize attributes
+	debug  = false;
+	fd     = -1;
+	status = PORT_CLOSED;
+	half_duplex = false;
+
+	rx_channel = next_channel++;
+	if ( rx_channel >= MAVLINK_COMM_NUM_BUFFERS )
+	{
+		fprintf(stderr,"WARNING: more ports than MAVLink channels, parsing on channel %d twice\n", MAVLINK_COMM_NUM_BUFFERS - 1);
+		rx_channel = MAVLINK_COMM_NUM_BUFFERS - 1;
+	}
+
+	lastStatus.packet_rx_drop_count = 0;
+	rx_dropped_reported = 0;
+
+	rx_head = 0;
+	rx_tail = 0;
+
+	for ( int i = 0; i < PORT_PRIORITIES; i++ )
+	{
+		tx_queue[i].head = 0;
+		tx_queue[i].tail = 0;
+	}
+	tx_exit    = false;
+	tx_dropped = 0;
+	write_tid  = 0;
+
+	tx_tokens        = 0;
+	tx_token_usec    = 0;
+	rx_bytes_per_sec = 0;
+	rx_rate_bytes    = 0;
+	rx_rate_usec     = 0;
+
+	// what keeps the vehicle flying goes first
+	memset(tx_priority, PORT_PRIORITY_NORMAL, sizeof(tx_priority));
+	set_priority(MAVLINK_MSG_ID_HEARTBEAT,                     PORT_PRIORITY_HIGH);
+	set_priority(MAVLINK_MSG_ID_SET_POSITION_TARGET_LOCAL_NED, PORT_PRIORITY_HIGH);
+	set_priority(MAVLINK_MSG_ID_SET_ATTITUDE_TARGET,           PORT_PRIORITY_HIGH);
+	set_priority(MAVLINK_MSG_ID_COMMAND_LONG,                  PORT_PRIORITY_HIGH);
+	set_priority(MAVLINK_MSG_ID_COMMAND_ACK,                   PORT_PRIORITY_HIGH);
+
+	// Start transmit queue lock, the writer waits on the monotonic clock
+	pthread_condattr_t attr;
+	int result = pthread_mutex_init(&tx_lock, NULL) ||
+	             pthread_condattr_init(&attr) ||
+	             pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) ||
+	             pthread_cond_init(&tx_cond, &attr);
+	if ( result != 0 )
+	{
+		printf("\n mutex init failed\n");
+		throw 1;
+	}
+	pthread_condattr_destroy(&attr);
+}
+
+Generic_Port::
+~Generic_Port()
+{
+	// destroy transmit queue lock
+	pthread_cond_destroy(&tx_cond);
+	pthread_mutex_destroy(&tx_lock);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Read from Port
+// ------------------------------------------------------------------------------
+int
+Generic_Port::
+read_message(mavlink_message_t &message)
+{
+	return read_messages(&message, 1);
+}
+
+// Returns how many messages were parsed into messages[]
+int
+Generic_Port::
+read_messages(mavlink_message_t *messages, int max_messages)
+{
+	mavlink_status_t status = lastStatus;
+	int count = 0;
+
+	// --------------------------------------------------------------------------
+	//   READ FROM PORT
+	// --------------------------------------------------------------------------
+
+	// only go to the port once everything buffered has been parsed
+	if ( rx_head == rx_tail )
+	{
+		int result = _read_port();
+
+		// Couldn't read from port
+		if ( result <= 0 )
+		{
+			fprintf(stderr, "ERROR: Could not read from fd %d\n", fd);
+			return 0;
+		}
+	}
+
+
+	// --------------------------------------------------------------------------
+	//   PARSE MESSAGES
+	// --------------------------------------------------------------------------
+	while ( rx_tail != rx_head && count < max_messages )
+	{
+		uint8_t cp = rx_buffer[rx_tail & (PORT_RX_BUFFER_SIZE - 1)];
+		rx_tail++;
+
+		// the parsing, framing tells a bad CRC apart from an incomplete message
+		uint8_t result = mavlink_frame_char(rx_channel, cp, &messages[count], &status);
+		if ( result == MAVLINK_FRAMING_OK )
+		{
+			link.received(messages[count]);
+			if ( debug )
+				_report_message(messages[count]);
+			count++;
+		}
+		else if ( result == MAVLINK_FRAMING_BAD_CRC || result == MAVLINK_FRAMING_BAD_SIGNATURE )
+			link.crc_error(messages[count]);
+	}
+
+	// check for dropped packets
+	uint64_t dropped = link.rx_dropped();
+	if ( dropped != rx_dropped_reported && debug )
+	{
+		printf("ERROR: DROPPED %lu PACKETS\n", (unsigned long) (dropped - rx_dropped_reported));
+	}
+	rx_dropped_reported = dropped;
+	lastStatus = status;
+
+	// Done!
+	return count;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Debugging Report
+// ------------------------------------------------------------------------------
+void
+Generic_Port::
+_report_message(const mavlink_message_t &message)
+{
+	// Report info
+	printf("Received message from port with ID #%d (sys:%d|comp:%d):\n", message.msgid, message.sysid, message.compid);
+
+	fprintf(stderr,"Received port data: ");
+	unsigned int i;
+	uint8_t buffer[MAVLINK_MAX_PACKET_LEN];
+
+	// check message is write length
+	unsigned int messageLength = mavlink_msg_to_send_buffer(buffer, &message);
+
+	// message length error
+	if (messageLength > MAVLINK_MAX_PACKET_LEN)
+	{
+		fprintf(stderr, "\nFATAL ERROR: MESSAGE LENGTH IS LARGER THAN BUFFER SIZE\n");
+	}
+
+	// print out the buffer
+	else
+	{
+		for (i=0; i<messageLength; i++)
+		{
+			unsigned char v=buffer[i];
+			fprintf(stderr,"%02x ", v);
+		}
+		fprintf(stderr,"\n");
+	}
+}
+
+// ------------------------------------------------------------------------------
+//   Write to Port
+// ------------------------------------------------------------------------------
+int
+Generic_Port::
+write_message(const mavlink_message_t &message)
+{
+	int priority = ( message.msgid < LINK_MONITOR_MAX_ID ) ? tx_priority[message.msgid] : PORT_PRIORITY_NORMAL;
+
+	return write_message(message, priority);
+}
+
+int
+Generic_Port::
+write_message(const mavlink_message_t &message, int priority)
+{
+	uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+
+	// Translate message to buffer
+	unsigned len = mavlink_msg_to_send_buffer(buf, &message);
+
+	// Queue buffer for the writer thread, does not wait on the port
+	int bytesQueued = _write_port(buf, len, message.msgid, priority);
+
+	return bytesQueued;
+}
+
+// Priority write_message() gives a message ID, returns 0 or -1
+int
+Generic_Port::
+set_priority(uint32_t msgid, int priority)
+{
+	if ( msgid >= LINK_MONITOR_MAX_ID || priority < 0 || priority >= PORT_PRIORITIES )
+		return -1;
+
+	tx_priority[msgid] = priority;
+	return 0;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Convenience Functions
+// ------------------------------------------------------------------------------
+void
+Generic_Port::
+start()
+{
+	open_port();
+
+	// --------------------------------------------------------------------------
+	//   WRITE THREAD
+	// --------------------------------------------------------------------------
+	tx_exit = false;
+
+	int result = pthread_create( &write_tid, NULL, &start_generic_port_write_thread, this );
+	if ( result ) throw result;
+}
+
+void
+Generic_Port::
+stop()
+{
+	// let the writer send what is queued, then stop it
+	if ( write_tid )
+	{
+		pthread_mutex_lock(&tx_lock);
+		tx_exit = true;
+		pthread_cond_signal(&tx_cond);
+		pthread_mutex_unlock(&tx_lock);
+
+		pthread_join(write_tid, NULL);
+		write_tid = 0;
+	}
+
+	if ( tx_dropped )
+		fprintf(stderr,"WARNING: %u messages did not fit in the transmit queue\n", tx_dropped);
+
+	link.print_report();
+
+	close_port();
+}
+
+
+// ------------------------------------------------------------------------------
+//   Quit Handler
+// ------------------------------------------------------------------------------
+void
+Generic_Port::
+handle_quit( int sig )
+{
+	try {
+		stop();
+	}
+	catch (int error) {
+		fprintf(stderr,"Warning, could not stop port\n");
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Read Port
+// ------------------------------------------------------------------------------
+// Fills the free space of the receive ring with everything the port has,
+// one read for however many bytes arrived
+int
+Generic_Port::
+_read_port()
+{
+	unsigned space = PORT_RX_BUFFER_SIZE - (rx_head - rx_tail);
+	if ( not space )
+		return 0;
+
+	// the free space can wrap around the end of the ring
+	unsigned start = rx_head & (PORT_RX_BUFFER_SIZE - 1);
+	unsigned first = PORT_RX_BUFFER_SIZE - start;
+	if ( first > space )
+		first = space;
+
+	struct iovec iov[2];
+	iov[0].iov_base = rx_buffer + start;
+	iov[0].iov_len  = first;
+	iov[1].iov_base = rx_buffer;
+	iov[1].iov_len  = space - first;
+
+	// blocks until at least one byte arrives
+	int result = _receive(iov, ( space > first ) ? 2 : 1);
+
+	if ( result > 0 )
+	{
+		rx_head += result;
+		link.received_bytes(result);
+	}
+
+	return result;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Queue Bytes for the Write Thread
+// ------------------------------------------------------------------------------
+// Returns the number of bytes queued, 0 if the queue was too full to take
+// the whole message
+int
+Generic_Port::
+_write_port(const uint8_t *buf, unsigned len, uint32_t msgid, int priority)
+{
+	if ( priority < 0 || priority >= PORT_PRIORITIES )
+		priority = PORT_PRIORITY_NORMAL;
+
+	Tx_Queue &queue = tx_queue[priority];
+
+	uint8_t header[4] = { (uint8_t) len, (uint8_t) (len >> 8), (uint8_t) msgid, (uint8_t) (msgid >> 8) };
+
+	pthread_mutex_lock(&tx_lock);
+
+	unsigned space = PORT_TX_BUFFER_SIZE - (queue.head - queue.tail);
+	if ( sizeof(header) + len > space )
+	{
+		tx_dropped++;
+		link.send_dropped(msgid);
+		pthread_mutex_unlock(&tx_lock);
+		return 0;
+	}
+
+	for ( unsigned i = 0; i < sizeof(header); i++ )
+		queue.buffer[(queue.head + i) & (PORT_TX_BUFFER_SIZE - 1)] = header[i];
+	queue.head += sizeof(header);
+
+	for ( unsigned i = 0; i < len; i++ )
+		queue.buffer[(queue.head + i) & (PORT_TX_BUFFER_SIZE - 1)] = buf[i];
+	queue.head += len;
+
+	pthread_cond_signal(&tx_cond);
+	pthread_mutex_unlock(&tx_lock);
+
+	return len;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Write Thread
+// ------------------------------------------------------------------------------
+void
+Generic_Port::
+start_write_thread()
+{
+	_write_thread();
+}
+
+void
+Generic_Port::
+_write_thread()
+{
+	uint8_t chunk[PORT_PRIORITIES * PORT_TX_BUFFER_SIZE];
+
+	// pin and prioritize the thread if running in real-time mode
+	realtime_enter_thread(RT_THREAD_MAVLINK_WRITE);
+
+	tx_token_usec = get_monotonic_usec();
+	rx_rate_usec  = tx_token_usec;
+	rx_rate_bytes = link.rx_bytes();
+
+	while ( true )
+	{
+		// ----------------------------------------------------------------------
+		//   TAKE QUEUED MESSAGES
+		// ----------------------------------------------------------------------
+		pthread_mutex_lock(&tx_lock);
+
+		bool queued = false;
+		for ( int p = 0; p < PORT_PRIORITIES; p++ )
+			queued = queued || tx_queue[p].head != tx_queue[p].tail;
+
+		if ( not queued )
+		{
+			if ( tx_exit )
+			{
+				// asked to exit and nothing is left to send
+				pthread_mutex_unlock(&tx_lock);
+				break;
+			}
+			pthread_cond_wait(&tx_cond, &tx_lock);
+			pthread_mutex_unlock(&tx_lock);
+			continue;
+		}
+
+		// what is queued at high priority goes out at once, the rest only
+		// while the budget lasts (and all of it when exiting)
+		float budget = _tx_budget(get_monotonic_usec());
+		bool  paced  = budget > 0 && not tx_exit;
+
+		unsigned len = 0;
+		for ( int p = 0; p < PORT_PRIORITIES; p++ )
+			len += _take_queued(p, chunk + len, sizeof(chunk) - len, paced && p != PORT_PRIORITY_HIGH);
+
+		if ( not len )
+		{
+			// only paced messages are waiting, sleep until the budget covers
+			// the next one or something new is queued
+			unsigned next = 0;
+			for ( int p = 0; p < PORT_PRIORITIES && not next; p++ )
+				next = _next_length(p);
+
+			uint64_t wait_usec = (uint64_t) ((next - tx_tokens) * 1000000.0f / budget) + 1;
+			uint64_t wake_usec = get_monotonic_usec() + wait_usec;
+
+			struct timespec wake;
+			wake.tv_sec  = wake_usec / 1000000;
+			wake.tv_nsec = (wake_usec % 1000000) * 1000;
+			pthread_cond_timedwait(&tx_cond, &tx_lock, &wake);
+
+			pthread_mutex_unlock(&tx_lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&tx_lock);
+
+		// ----------------------------------------------------------------------
+		//   WRITE TO PORT
+		// ----------------------------------------------------------------------
+		// the queue lock is not held, so new messages can be queued meanwhile
+		unsigned written = 0;
+		while ( written < len )
+		{
+			int result = _send(chunk + written, len - written);
+			if ( result < 0 )
+			{
+				if ( errno == EINTR )
+					continue;
+				fprintf(stderr, "ERROR: Could not write to fd %d\n", fd);
+				break;
+			}
+			written += result;
+		}
+
+		realtime_check_thread(RT_THREAD_MAVLINK_WRITE);
+	}
+
+	return;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Transmit Budget
+// ------------------------------------------------------------------------------
+// Refills the token bucket and returns the bytes per second that may be
+// sent, 0 if the link has no capacity set
+float
+Generic_Port::
+_tx_budget(uint64_t now)
+{
+	if ( not link.capacity )
+		return 0;
+
+	// what the other side sends comes off a shared link, measured each second
+	if ( now - rx_rate_usec >= 1000000 )
+	{
+		uint64_t rx_bytes = link.rx_bytes();
+		rx_bytes_per_sec = (rx_bytes - rx_rate_bytes) * 1000000.0f / (now - rx_rate_usec);
+		rx_rate_bytes = rx_bytes;
+		rx_rate_usec  = now;
+	}
+
+	float budget = link.capacity;
+	if ( half_duplex )
+		budget -= rx_bytes_per_sec;
+
+	// setpoints still need room when the link is full
+	if ( budget < link.capacity / 10.0f )
+		budget = link.capacity / 10.0f;
+
+	tx_tokens += budget * (now - tx_token_usec) / 1000000.0f;
+	tx_token_usec = now;
+
+	float burst = budget / PORT_TX_BURST_DIVISOR;
+	if ( burst < MAVLINK_MAX_PACKET_LEN )
+		burst = MAVLINK_MAX_PACKET_LEN;
+	if ( tx_tokens > burst )
+		tx_tokens = burst;
+
+	return budget;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Take Queued Messages
+// ------------------------------------------------------------------------------
+// Moves whole messages of one priority into out, while they fit and, when
+// paced, while there are tokens for them. Holds tx_lock.
+unsigned
+Generic_Port::
+_take_queued(int priority, uint8_t *out, unsigned space, bool paced)
+{
+	Tx_Queue &queue = tx_queue[priority];
+	unsigned taken = 0;
+
+	while ( queue.head != queue.tail )
+	{
+		uint8_t header[4];
+		for ( unsigned i = 0; i < sizeof(header); i++ )
+			header[i] = queue.buffer[(queue.tail + i) & (PORT_TX_BUFFER_SIZE - 1)];
+
+		unsigned len   = header[0] | (header[1] << 8);
+		uint32_t msgid = header[2] | (header[3] << 8);
+
+		if ( len > space - taken )
+			break;
+		if ( paced && tx_tokens < len )
+			break;
+
+		queue.tail += sizeof(header);
+		for ( unsigned i = 0; i < len; i++ )
+			out[taken + i] = queue.buffer[(queue.tail + i) & (PORT_TX_BUFFER_SIZE - 1)];
+		queue.tail += len;
+		taken      += len;
+
+		// high priority messages may take the bucket below zero, which
+		// holds the paced ones back until it has refilled
+		if ( link.capacity )
+			tx_tokens -= len;
+		link.sent(msgid, len);
+	}
+
+	return taken;
+}
+
+// Length of the next message of one priority, 0 if none. Holds tx_lock.
+unsigned
+Generic_Port::
+_next_length(int priority)
+{
+	Tx_Queue &queue = tx_queue[priority];
+	if ( queue.head == queue.tail )
+		return 0;
+
+	return queue.buffer[queue.tail & (PORT_TX_BUFFER_SIZE - 1)] |
+	       (queue.buffer[(queue.tail + 1) & (PORT_TX_BUFFER_SIZE - 1)] << 8);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Transport Defaults
+// ------------------------------------------------------------------------------
+// Byte stream transports read and write the file descriptor directly
+int
+Generic_Port::
+_receive(const struct iovec *iov, int iovcnt)
+{
+	return readv(fd, iov, iovcnt);
+}
+
+int
+Generic_Port::
+_send(const uint8_t *buf, unsigned len)
+{
+	return static_cast<int>(write(fd, buf, len));
+}
+
+
+// ------------------------------------------------------------------------------
+//  Pthread Starter Helper Functions
+// ------------------------------------------------------------------------------
+
+void*
+start_generic_port_write_thread(void *args)
+{
+	// takes a port object argument
+	Generic_Port *port = (Generic_Port *)args;
+
+	// run the object's write thread
+	port->start_write_thread();
+
+	// done!
+	return NULL;
+}
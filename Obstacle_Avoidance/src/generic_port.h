@@ -0,0 +1,183 @@
+/**
+ * @file generic_port.h
+ *
+ * @brief Generic port definition
+ *
+ * The MAVLink side of a connection to the autopilot. Buffering, parsing
+ * and the writer thread live here, the transports only move bytes.
+ *
+ */
+
+#ifndef GENERIC_PORT_H_
+#define GENERIC_PORT_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <stdio.h>   // Standard input/output definitions
+#include <unistd.h>  // UNIX standard function definitions
+#include <pthread.h> // This uses POSIX Threads
+#include <signal.h>
+#include <errno.h>   // Error number definitions
+#include <sys/uio.h> // readv
+
+#include <common/mavlink.h>
+
+#include "link_monitor.h"
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// Bytes that can wait in the receive ring between reads, a power of two
+#define PORT_RX_BUFFER_SIZE 4096
+
+// Most messages handed back by one call to read_messages()
+#define PORT_RX_BATCH 32
+
+// Bytes that can wait in each transmit queue for the writer thread, a power of two
+#define PORT_TX_BUFFER_SIZE 4096
+
+// Transmit priorities, a lower number is sent first
+#define PORT_PRIORITY_HIGH   0  // setpoints, heartbeats and commands, never held back
+#define PORT_PRIORITY_NORMAL 1  // everything else, sent within what is left of the budget
+#define PORT_PRIORITIES      2
+
+// Unused budget saved up for a burst, in parts of a second
+#define PORT_TX_BURST_DIVISOR 10
+
+
+// Status flags
+#define PORT_OPEN   1
+#define PORT_CLOSED 0
+#define PORT_ERROR -1
+
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+void* start_generic_port_write_thread(void *args);
+
+
+// ----------------------------------------------------------------------------------
+//   Generic Port Class
+// ----------------------------------------------------------------------------------
+/*
+ * Generic Port Class
+ *
+ * Base of Serial_Port, UDP_Port and PTY_Port. A transport opens its file
+ * descriptor in open_port(), and only overrides _receive() and _send() if
+ * plain readv() and write() do not fit it.
+ *
+ * Reading pulls everything the port has available in one read into a
+ * receive ring, and read_messages() parses every complete MAVLink message
+ * out of the ring in one pass and returns them as a batch. Bytes of a
+ * message that has not fully arrived stay in the parser, and bytes left
+ * over once the batch is full stay in the ring for the next call.
+ *
+ * Reading and writing never share a lock. Only the caller of
+ * read_messages() reads the port, and write_message() only copies the
+ * message into a transmit queue and returns. A writer thread owns the
+ * write side of the port and sends whatever is queued, so a write never
+ * waits behind a read that is blocked on a quiet link.
+ *
+ * There is one transmit queue per priority. When the link has a capacity
+ * (a serial port sets it from its baud rate) the writer paces itself to
+ * it with a token bucket, so the kernel buffer of the port never holds
+ * more than a moment of traffic. High priority messages are sent as soon
+ * as they are queued whatever the budget, and the other queue only gets
+ * what they leave of it, so setpoints are never starved by telemetry
+ * requests or other traffic. With half_duplex set the bytes received are
+ * taken off the budget too, as on a telemetry radio.
+ *
+ * Traffic in both directions is counted in link.
+ */
+class Generic_Port
+{
+
+public:
+
+	Generic_Port();
+	virtual ~Generic_Port();
+
+	bool debug;
+	int  status;
+	bool half_duplex;   // sending and receiving share the capacity
+
+	Link_Monitor link;
+
+	int read_message(mavlink_message_t &message);
+	int read_messages(mavlink_message_t *messages, int max_messages);
+	int write_message(const mavlink_message_t &message);
+	int write_message(const mavlink_message_t &message, int priority);
+	int set_priority(uint32_t msgid, int priority);
+
+	virtual void start();
+	virtual void stop();
+
+	void start_write_thread();
+
+	int  file_descriptor() const { return fd; }
+	int  channel() const { return rx_channel; }
+	bool rx_pending() const { return rx_head != rx_tail; }
+
+	void handle_quit( int sig );
+
+protected:
+
+	int  fd;
+
+	virtual void open_port() = 0;    // throws EXIT_FAILURE if it could not open
+	virtual void close_port() = 0;
+
+	virtual int _receive(const struct iovec *iov, int iovcnt);
+	virtual int _send(const uint8_t *buf, unsigned len);
+
+private:
+
+	int              rx_channel;              // MAVLink channel of this port
+	mavlink_status_t lastStatus;
+	uint64_t         rx_dropped_reported;     // for debug
+
+	uint8_t  rx_buffer[PORT_RX_BUFFER_SIZE];  // receive ring, reader only
+	unsigned rx_head;                         // next byte to fill
+	unsigned rx_tail;                         // next byte to parse
+
+	// each message is queued behind a 4 byte header, its length and ID
+	struct Tx_Queue {
+		uint8_t  buffer[PORT_TX_BUFFER_SIZE];
+		unsigned head;                        // next byte to queue
+		unsigned tail;                        // next byte to write
+	};
+	Tx_Queue tx_queue[PORT_PRIORITIES];
+	uint8_t  tx_priority[LINK_MONITOR_MAX_ID];
+	bool     tx_exit;                         // writer thread should stop
+	unsigned tx_dropped;                      // messages that did not fit
+	pthread_t       write_tid;
+	pthread_mutex_t tx_lock;                  // guards the queues, never held during I/O
+	pthread_cond_t  tx_cond;
+
+	// token bucket of the writer thread
+	float    tx_tokens;                       // bytes that may be sent now
+	uint64_t tx_token_usec;
+	float    rx_bytes_per_sec;                // for half_duplex
+	uint64_t rx_rate_bytes;
+	uint64_t rx_rate_usec;
+
+	int   _read_port();
+	void  _report_message(const mavlink_message_t &message);
+	int   _write_port(const uint8_t *buf, unsigned len, uint32_t msgid, int priority);
+	void  _write_thread();
+	float _tx_budget(uint64_t now);
+	unsigned _take_queued(int priority, uint8_t *out, unsigned space, bool paced);
+	unsigned _next_length(int priority);
+
+};
+
+
+
+#endif // GENERIC_PORT_H_
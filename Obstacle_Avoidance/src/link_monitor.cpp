@@ -0,0 +1,283 @@
+/**
+ * @file link_monitor.cpp
+ *
+ * @brief Link monitor functions
+ *
+ * Counts the traffic of a port in each direction and for each message ID,
+ * so the load on the link is known before it runs out
+ *
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "link_monitor.h"
+#include "clock_service.h"
+
+#include <string.h>
+
+
+// ----------------------------------------------------------------------------------
+//   Link Monitor Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Link_Monitor::
+Link_Monitor()
+{
+	capacity = 0;
+
+	Link_Counters *directions[2] = { &rx, &tx };
+	for ( int d = 0; d < 2; d++ )
+	{
+		Link_Counters &counters = *directions[d];
+		counters.bytes      = 0;
+		counters.messages   = 0;
+		counters.dropped    = 0;
+		counters.crc_errors = 0;
+		for ( int i = 0; i < LINK_MONITOR_MAX_ID; i++ )
+		{
+			counters.id_messages[i] = 0;
+			counters.id_bytes[i]    = 0;
+			counters.id_errors[i]   = 0;
+		}
+	}
+
+	num_sources = 0;
+
+	last_usec        = get_monotonic_usec();
+	last_rx_bytes    = 0;
+	last_tx_bytes    = 0;
+	last_rx_messages = 0;
+	last_tx_messages = 0;
+
+	report_usec = last_usec;
+	memset(report_rx,       0, sizeof(report_rx));
+	memset(report_tx,       0, sizeof(report_tx));
+	memset(report_rx_bytes, 0, sizeof(report_rx_bytes));
+	memset(report_tx_bytes, 0, sizeof(report_tx_bytes));
+}
+
+Link_Monitor::
+~Link_Monitor()
+{}
+
+
+// ------------------------------------------------------------------------------
+//   Frame Length
+// ------------------------------------------------------------------------------
+// Bytes the message took on the link
+unsigned int
+Link_Monitor::
+frame_length(const mavlink_message_t &message)
+{
+	// MAVLink 1 has a 6 byte header, MAVLink 2 a 10 byte one, both a 2 byte CRC
+	unsigned int length = message.len + 2;
+	if ( message.magic == MAVLINK_STX_MAVLINK1 )
+		length += 6;
+	else
+	{
+		length += 10;
+		if ( message.incompat_flags & MAVLINK_IFLAG_SIGNED )
+			length += MAVLINK_SIGNATURE_BLOCK_LEN;
+	}
+	return length;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Count
+// ------------------------------------------------------------------------------
+// Only one thread counts into each direction, so a load and a store will do
+void
+Link_Monitor::
+count(Link_Counters &counters, uint32_t msgid, unsigned int len)
+{
+	counters.messages.store(counters.messages.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+	if ( msgid < LINK_MONITOR_MAX_ID )
+	{
+		counters.id_messages[msgid].store(counters.id_messages[msgid].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		counters.id_bytes[msgid].store(counters.id_bytes[msgid].load(std::memory_order_relaxed) + len, std::memory_order_relaxed);
+	}
+}
+
+void
+Link_Monitor::
+received_bytes(unsigned int len)
+{
+	rx.bytes.store(rx.bytes.load(std::memory_order_relaxed) + len, std::memory_order_relaxed);
+}
+
+void
+Link_Monitor::
+received(const mavlink_message_t &message)
+{
+	count(rx, message.msgid, frame_length(message));
+
+	// --------------------------------------------------------------------------
+	//   SEQUENCE GAPS
+	// --------------------------------------------------------------------------
+	for ( int i = 0; i < num_sources; i++ )
+	{
+		Source &source = sources[i];
+		if ( source.sysid != message.sysid || source.compid != message.compid )
+			continue;
+
+		// every sender numbers its messages, modulo 256. A message from
+		// behind the last one was reordered (by a priority queue like ours)
+		// rather than dropped, and is not counted. A run of them means the
+		// sender restarted or the link was out for a while, the loss can't
+		// be told then, so the sequence is picked up where it is.
+		uint8_t gap = (uint8_t) (message.seq - source.last_seq - 1);
+		if ( gap >= 128 && ++source.behind < LINK_MONITOR_RESYNC )
+			return;
+		source.behind = 0;
+		if ( gap && gap < 128 )
+			rx.dropped.store(rx.dropped.load(std::memory_order_relaxed) + gap, std::memory_order_relaxed);
+		source.last_seq = message.seq;
+		return;
+	}
+
+	if ( num_sources < LINK_MONITOR_MAX_SOURCES )
+	{
+		Source &source = sources[num_sources++];
+		source.sysid    = message.sysid;
+		source.compid   = message.compid;
+		source.last_seq = message.seq;
+		source.behind   = 0;
+	}
+}
+
+void
+Link_Monitor::
+crc_error(const mavlink_message_t &message)
+{
+	rx.crc_errors.store(rx.crc_errors.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+	if ( message.msgid < LINK_MONITOR_MAX_ID )
+		rx.id_errors[message.msgid].store(rx.id_errors[message.msgid].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void
+Link_Monitor::
+sent(uint32_t msgid, unsigned int len)
+{
+	tx.bytes.store(tx.bytes.load(std::memory_order_relaxed) + len, std::memory_order_relaxed);
+	count(tx, msgid, len);
+}
+
+// Called under the lock of the transmit queue, by any thread writing
+void
+Link_Monitor::
+send_dropped(uint32_t msgid)
+{
+	tx.dropped.fetch_add(1, std::memory_order_relaxed);
+
+	if ( msgid < LINK_MONITOR_MAX_ID )
+		tx.id_errors[msgid].fetch_add(1, std::memory_order_relaxed);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Rates
+// ------------------------------------------------------------------------------
+Link_Rates
+Link_Monitor::
+rates()
+{
+	Link_Rates rates;
+
+	uint64_t now = get_monotonic_usec();
+	float seconds = (now - last_usec) / 1000000.0f;
+	if ( seconds <= 0 )
+		seconds = 1e-6f;
+
+	uint64_t rx_bytes    = rx.bytes.load(std::memory_order_relaxed);
+	uint64_t tx_bytes    = tx.bytes.load(std::memory_order_relaxed);
+	uint64_t rx_messages = rx.messages.load(std::memory_order_relaxed);
+	uint64_t tx_messages = tx.messages.load(std::memory_order_relaxed);
+
+	rates.rx_bytes_per_sec    = (rx_bytes - last_rx_bytes) / seconds;
+	rates.tx_bytes_per_sec    = (tx_bytes - last_tx_bytes) / seconds;
+	rates.rx_messages_per_sec = (rx_messages - last_rx_messages) / seconds;
+	rates.tx_messages_per_sec = (tx_messages - last_tx_messages) / seconds;
+	rates.rx_load = capacity ? rates.rx_bytes_per_sec / capacity : 0;
+	rates.tx_load = capacity ? rates.tx_bytes_per_sec / capacity : 0;
+
+	rates.rx_dropped    = rx.dropped.load(std::memory_order_relaxed);
+	rates.rx_crc_errors = rx.crc_errors.load(std::memory_order_relaxed);
+	rates.tx_dropped    = tx.dropped.load(std::memory_order_relaxed);
+
+	last_usec        = now;
+	last_rx_bytes    = rx_bytes;
+	last_tx_bytes    = tx_bytes;
+	last_rx_messages = rx_messages;
+	last_tx_messages = tx_messages;
+
+	return rates;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Print Report
+// ------------------------------------------------------------------------------
+// Totals and the traffic of every message ID since the previous report
+void
+Link_Monitor::
+print_report()
+{
+	float seconds = (get_monotonic_usec() - report_usec) / 1000000.0f;
+	if ( seconds <= 0 )
+		seconds = 1e-6f;
+	report_usec = get_monotonic_usec();
+
+	Link_Rates rate = rates();
+
+	printf("LINK REPORT\n");
+	if ( capacity )
+		printf("    capacity   : %u B/s each way\n", capacity);
+	printf("    received   : %7.0f B/s %6.1f msg/s %5.1f%%, %lu dropped, %lu bad CRC\n",
+	       rate.rx_bytes_per_sec, rate.rx_messages_per_sec, rate.rx_load * 100,
+	       (unsigned long) rate.rx_dropped, (unsigned long) rate.rx_crc_errors);
+	printf("    sent       : %7.0f B/s %6.1f msg/s %5.1f%%, %lu dropped\n",
+	       rate.tx_bytes_per_sec, rate.tx_messages_per_sec, rate.tx_load * 100,
+	       (unsigned long) rate.tx_dropped);
+
+	for ( int msgid = 0; msgid < LINK_MONITOR_MAX_ID; msgid++ )
+	{
+		uint32_t rx_messages = rx.id_messages[msgid].load(std::memory_order_relaxed);
+		uint32_t tx_messages = tx.id_messages[msgid].load(std::memory_order_relaxed);
+		uint32_t rx_bytes    = rx.id_bytes[msgid].load(std::memory_order_relaxed);
+		uint32_t tx_bytes    = tx.id_bytes[msgid].load(std::memory_order_relaxed);
+		uint32_t rx_errors   = rx.id_errors[msgid].load(std::memory_order_relaxed);
+		uint32_t tx_errors   = tx.id_errors[msgid].load(std::memory_order_relaxed);
+
+		if ( rx_messages != report_rx[msgid] )
+			printf("    rx id %3d : %7.0f B/s %6.1f msg/s, %u bad CRC\n", msgid,
+			       (rx_bytes - report_rx_bytes[msgid]) / seconds,
+			       (rx_messages - report_rx[msgid]) / seconds, rx_errors);
+		else if ( rx_errors )
+			printf("    rx id %3d : %u bad CRC\n", msgid, rx_errors);
+
+		if ( tx_messages != report_tx[msgid] || tx_errors )
+			printf("    tx id %3d : %7.0f B/s %6.1f msg/s, %u dropped\n", msgid,
+			       (tx_bytes - report_tx_bytes[msgid]) / seconds,
+			       (tx_messages - report_tx[msgid]) / seconds, tx_errors);
+
+		report_rx[msgid]       = rx_messages;
+		report_tx[msgid]       = tx_messages;
+		report_rx_bytes[msgid] = rx_bytes;
+		report_tx_bytes[msgid] = tx_bytes;
+	}
+
+	if ( rate.rx_load > LINK_MONITOR_WARN_LOAD || rate.tx_load > LINK_MONITOR_WARN_LOAD )
+		fprintf(stderr,"WARNING: link is %.0f%% loaded, use a faster baud rate or fewer messages\n",
+		        100 * (rate.rx_load > rate.tx_load ? rate.rx_load : rate.tx_load));
+
+	printf("\n");
+}
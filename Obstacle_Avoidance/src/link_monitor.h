@@ -0,0 +1,158 @@
+/**
+ * @file link_monitor.h
+ *
+ * @brief Link monitor definition
+ *
+ * Counts the traffic of a port in each direction and for each message ID,
+ * so the load on the link is known before it runs out
+ *
+ */
+
+#ifndef LINK_MONITOR_H_
+#define LINK_MONITOR_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+
+#include <common/mavlink.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// Message IDs below this are counted one by one, the rest only in the totals
+#define LINK_MONITOR_MAX_ID 512
+
+// Senders whose sequence numbers are followed to find dropped messages
+#define LINK_MONITOR_MAX_SOURCES 8
+
+// Messages in a row from behind the last one after which a sender is taken
+// to have restarted or lost over half a lap, and is followed from there
+#define LINK_MONITOR_RESYNC 2
+
+// Share of the capacity above which the report warns
+#define LINK_MONITOR_WARN_LOAD 0.8f
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+// Rates since the previous call to Link_Monitor::rates(), and totals
+
+struct Link_Rates {
+
+	float rx_bytes_per_sec;
+	float tx_bytes_per_sec;
+	float rx_messages_per_sec;
+	float tx_messages_per_sec;
+	float rx_load;             // share of the capacity, 0 if it is not limited
+	float tx_load;
+
+	uint64_t rx_dropped;       // gaps in the sequence numbers
+	uint64_t rx_crc_errors;
+	uint64_t tx_dropped;       // did not fit in the transmit queue
+
+};
+
+// Traffic in one direction, one thread counts and any thread reads
+
+struct Link_Counters {
+
+	std::atomic<uint64_t> bytes;
+	std::atomic<uint64_t> messages;
+	std::atomic<uint64_t> dropped;     // sequence gaps on receive, a full queue on send
+	std::atomic<uint64_t> crc_errors;  // receive only
+
+	std::atomic<uint32_t> id_messages[LINK_MONITOR_MAX_ID];
+	std::atomic<uint32_t> id_bytes[LINK_MONITOR_MAX_ID];
+	std::atomic<uint32_t> id_errors[LINK_MONITOR_MAX_ID];  // bad CRC on receive, dropped on send
+
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Link Monitor Class
+// ----------------------------------------------------------------------------------
+/*
+ * Link Monitor Class
+ *
+ * The reader of the port counts what it receives and the writer thread
+ * what it sends, each direction has a single writer so the counters are
+ * plain relaxed atomics. Received bytes are counted as they are read, so
+ * noise and broken frames take their share of the link too, and each
+ * message is counted by its frame length under its ID.
+ *
+ * Dropped messages are found from gaps in the sequence number of each
+ * sender. A bad CRC is also what a message from a dialect this program was
+ * not built with looks like, the report lists the message IDs.
+ *
+ * capacity is the bytes per second the link carries in each direction,
+ * a serial port sets it from its baud rate. rates() and print_report()
+ * measure from the previous call, so only one thread should call them.
+ */
+class Link_Monitor
+{
+
+public:
+
+	Link_Monitor();
+	~Link_Monitor();
+
+	unsigned int capacity;   // bytes per second each way, 0 if not limited
+
+	// receive side, the reader of the port only
+	void received_bytes(unsigned int len);
+	void received(const mavlink_message_t &message);
+	void crc_error(const mavlink_message_t &message);
+
+	// send side, the writer thread only
+	void sent(uint32_t msgid, unsigned int len);
+	void send_dropped(uint32_t msgid);
+
+	uint64_t rx_bytes() const { return rx.bytes.load(std::memory_order_relaxed); }
+	uint64_t rx_dropped() const { return rx.dropped.load(std::memory_order_relaxed); }
+
+	Link_Rates rates();
+	void print_report();
+
+	static unsigned int frame_length(const mavlink_message_t &message);
+
+private:
+
+	Link_Counters rx;
+	Link_Counters tx;
+
+	struct Source {
+		int     sysid;
+		int     compid;
+		uint8_t last_seq;
+		int     behind;    // messages in a row from behind last_seq
+	};
+	Source   sources[LINK_MONITOR_MAX_SOURCES];  // reader only
+	int      num_sources;
+
+	// totals at the previous call to rates() and print_report()
+	uint64_t last_usec;
+	uint64_t last_rx_bytes, last_tx_bytes;
+	uint64_t last_rx_messages, last_tx_messages;
+	uint64_t report_usec;
+	uint32_t report_rx[LINK_MONITOR_MAX_ID];
+	uint32_t report_tx[LINK_MONITOR_MAX_ID];
+	uint32_t report_rx_bytes[LINK_MONITOR_MAX_ID];
+	uint32_t report_tx_bytes[LINK_MONITOR_MAX_ID];
+
+	void count(Link_Counters &counters, uint32_t msgid, unsigned int len);
+
+};
+
+
+
+#endif // LINK_MONITOR_H_
@@ -0,0 +1,187 @@
+/**
+ * @file message_router.cpp
+ *
+ * @brief Message router functions
+ *
+ * Hands received MAVLink messages only to the components that subscribed
+ * to their message ID
+ *
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "message_router.h"
+
+#include <string.h>
+
+
+// ----------------------------------------------------------------------------------
+//   Message Queue Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Message_Queue::
+Message_Queue()
+{
+	head       = 0;
+	tail       = 0;
+	drop_count = 0;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Push, event loop only
+// ------------------------------------------------------------------------------
+bool
+Message_Queue::
+push(const mavlink_message_t &message, uint64_t time_usec)
+{
+	unsigned int h = head.load(std::memory_order_relaxed);
+	if ( h - tail.load(std::memory_order_acquire) >= MESSAGE_QUEUE_SIZE )
+	{
+		drop_count.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	Queued_Message &slot = slots[h & (MESSAGE_QUEUE_SIZE - 1)];
+	slot.message   = message;
+	slot.time_usec = time_usec;
+
+	head.store(h + 1, std::memory_order_release);
+	return true;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Pop, consumer only
+// ------------------------------------------------------------------------------
+bool
+Message_Queue::
+pop(Queued_Message &queued)
+{
+	unsigned int t = tail.load(std::memory_order_relaxed);
+	if ( t == head.load(std::memory_order_acquire) )
+		return false;
+
+	queued = slots[t & (MESSAGE_QUEUE_SIZE - 1)];
+
+	tail.store(t + 1, std::memory_order_release);
+	return true;
+}
+
+unsigned int
+Message_Queue::
+size() const
+{
+	return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+}
+
+
+// ----------------------------------------------------------------------------------
+//   Message Router Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Message_Router::
+Message_Router()
+{
+	memset(route_index, 0, sizeof(route_index));
+	memset(routes, 0, sizeof(routes));
+	num_routes = 0;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Subscribe
+// ------------------------------------------------------------------------------
+// Both return 0 on success, -1 if the subscription does not fit
+int
+Message_Router::
+subscribe(uint32_t msgid, Message_Callback callback, void *context)
+{
+	Subscriber subscriber;
+	subscriber.callback = callback;
+	subscriber.context  = context;
+	subscriber.queue    = NULL;
+
+	return _add(msgid, subscriber);
+}
+
+int
+Message_Router::
+subscribe(uint32_t msgid, Message_Queue *queue)
+{
+	Subscriber subscriber;
+	subscriber.callback = NULL;
+	subscriber.context  = NULL;
+	subscriber.queue    = queue;
+
+	return _add(msgid, subscriber);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Dispatch
+// ------------------------------------------------------------------------------
+void
+Message_Router::
+dispatch(const mavlink_message_t &message, uint64_t time_usec) const
+{
+	if ( not subscribed(message.msgid) )
+		return;
+
+	const Route &route = routes[route_index[message.msgid] - 1];
+	for ( int i = 0; i < route.count; i++ )
+	{
+		const Subscriber &subscriber = route.subscribers[i];
+
+		if ( subscriber.queue )
+			subscriber.queue->push(message, time_usec);
+		else
+			subscriber.callback(message, time_usec, subscriber.context);
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Add Subscriber
+// ------------------------------------------------------------------------------
+int
+Message_Router::
+_add(uint32_t msgid, const Subscriber &subscriber)
+{
+	if ( msgid >= MESSAGE_ROUTER_MAX_ID )
+	{
+		fprintf(stderr,"ERROR: can not subscribe to message id %u, the router stops at %d\n",
+				msgid, MESSAGE_ROUTER_MAX_ID);
+		return -1;
+	}
+
+	if ( not route_index[msgid] )
+	{
+		if ( num_routes >= MESSAGE_ROUTER_MAX_ROUTES )
+		{
+			fprintf(stderr,"ERROR: no route left for message id %u\n", msgid);
+			return -1;
+		}
+		route_index[msgid] = (uint8_t) ++num_routes;
+	}
+
+	Route &route = routes[route_index[msgid] - 1];
+	if ( route.count >= MESSAGE_ROUTER_MAX_SUBSCRIBERS )
+	{
+		fprintf(stderr,"ERROR: message id %u already has %d subscribers\n",
+				msgid, MESSAGE_ROUTER_MAX_SUBSCRIBERS);
+		return -1;
+	}
+
+	route.subscribers[route.count++] = subscriber;
+	return 0;
+}
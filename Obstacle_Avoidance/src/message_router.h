@@ -0,0 +1,169 @@
+/**
+ * @file message_router.h
+ *
+ * @brief Message router definition
+ *
+ * Hands received MAVLink messages only to the components that subscribed
+ * to their message ID
+ *
+ */
+
+#ifndef MESSAGE_ROUTER_H_
+#define MESSAGE_ROUTER_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+
+#include <common/mavlink.h>
+
+#include "snapshot.h"
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// Message IDs below this can be subscribed to, covers the common message set
+#define MESSAGE_ROUTER_MAX_ID 512
+
+// Message IDs that can have subscribers at the same time
+#define MESSAGE_ROUTER_MAX_ROUTES 32
+
+// Subscribers of one message ID
+#define MESSAGE_ROUTER_MAX_SUBSCRIBERS 4
+
+// Messages a Message_Queue holds, a power of two
+#define MESSAGE_QUEUE_SIZE 64
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+// Called on the event loop for every message of a subscribed ID, has to be quick
+typedef void (*Message_Callback)(const mavlink_message_t &message, uint64_t time_usec, void *context);
+
+// A message as it was received
+struct Queued_Message
+{
+	mavlink_message_t message;
+	uint64_t          time_usec;
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Message Queue Class
+// ----------------------------------------------------------------------------------
+/*
+ * Message Queue Class
+ *
+ * Single producer, single consumer ring. The event loop pushes, one
+ * consumer thread pops whenever it is ready, and neither ever waits on the
+ * other. When the consumer falls behind, new messages are dropped and
+ * counted rather than overwriting ones it has not seen.
+ */
+class Message_Queue
+{
+
+public:
+
+	Message_Queue();
+
+	bool push(const mavlink_message_t &message, uint64_t time_usec);
+	bool pop(Queued_Message &queued);
+
+	unsigned int size() const;
+	unsigned int dropped() const { return drop_count.load(std::memory_order_relaxed); }
+
+private:
+
+	Queued_Message slots[MESSAGE_QUEUE_SIZE];
+
+	std::atomic<unsigned int> head;        // next slot to push, producer only writes
+	std::atomic<unsigned int> tail;        // next slot to pop, consumer only writes
+	std::atomic<unsigned int> drop_count;
+
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Message Router Class
+// ----------------------------------------------------------------------------------
+/*
+ * Message Router Class
+ *
+ * Keeps the subscribers of each message ID. dispatch() looks the ID up in
+ * a table, so a message nobody subscribed to costs one array read and is
+ * never decoded. Subscribers either get a callback with the raw message,
+ * which they decode themselves, or have it pushed to their Message_Queue.
+ *
+ * Subscribe before the event loop starts, dispatch() reads the table
+ * without locking.
+ */
+class Message_Router
+{
+
+public:
+
+	Message_Router();
+
+	int subscribe(uint32_t msgid, Message_Callback callback, void *context);
+	int subscribe(uint32_t msgid, Message_Queue *queue);
+
+	bool subscribed(uint32_t msgid) const
+	{
+		return msgid < MESSAGE_ROUTER_MAX_ID && route_index[msgid];
+	}
+
+	void dispatch(const mavlink_message_t &message, uint64_t time_usec) const;
+
+private:
+
+	struct Subscriber
+	{
+		Message_Callback callback;
+		void            *context;
+		Message_Queue   *queue;
+	};
+
+	struct Route
+	{
+		int        count;
+		Subscriber subscribers[MESSAGE_ROUTER_MAX_SUBSCRIBERS];
+	};
+
+	uint8_t route_index[MESSAGE_ROUTER_MAX_ID];  // 0 when nobody subscribed, else route + 1
+	Route   routes[MESSAGE_ROUTER_MAX_ROUTES];
+	int     num_routes;
+
+	int _add(uint32_t msgid, const Subscriber &subscriber);
+
+};
+
+
+// ------------------------------------------------------------------------------
+//   Typed Subscribers
+// ------------------------------------------------------------------------------
+
+// Decodes a message into its struct and publishes it to the Snapshot<T>
+// given as the context, e.g.
+//   router.subscribe(MAVLINK_MSG_ID_ATTITUDE,
+//                    &snapshot_callback<mavlink_attitude_t, mavlink_msg_attitude_decode>,
+//                    &attitude_snapshot);
+template <typename T, void (*Decode)(const mavlink_message_t*, T*)>
+void
+snapshot_callback(const mavlink_message_t &message, uint64_t time_usec, void *context)
+{
+	T decoded;
+	Decode(&message, &decoded);
+	((Snapshot<T>*) context)->publish(decoded, time_usec);
+}
+
+
+#endif // MESSAGE_ROUTER_H_
@@ -0,0 +1,137 @@
+/**
+ * @file multi_scale.cpp
+ *
+ * @brief Multi-scale window search functions
+ *
+ * Evaluates candidate windows whose size follows the size of the vehicle
+ * projected at the depth of each band of the Depth_Grid
+ *
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "multi_scale.h"
+
+#include <algorithm>
+
+
+// ----------------------------------------------------------------------------------
+//   Multi-Scale Search Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Multi_Scale_Search::
+Multi_Scale_Search(const Depth_Grid *grid_, float fx, float fy,
+                   float vehicle_width_, float vehicle_height_, int stride_cells_)
+{
+	grid         = grid_;
+	stride_cells = std::max(stride_cells_, 1);
+
+	// the window of each band is the vehicle projected at its depth, the
+	// vehicle size is in the same units as the depth and the focal lengths
+	// in pixels
+	const int cell = grid->cell_size;
+
+	for ( int b = 0; b < grid->num_bands; b++ )
+	{
+		// band 0 starts at the camera, so it is sized at its far edge
+		float depth = ( b == 0 ) ? grid->band_limits[0] : grid->band_limits[b - 1];
+
+		int half_w = (int) (fx * vehicle_width_  / depth / 2 / cell + 0.5f);
+		int half_h = (int) (fy * vehicle_height_ / depth / 2 / cell + 0.5f);
+
+		// keep every window inside of the image and at least one cell across
+		half_cols[b] = std::min(std::max(half_w, 1), grid->cols / 2);
+		half_rows[b] = std::min(std::max(half_h, 1), grid->rows / 2);
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Find Best Window
+// ------------------------------------------------------------------------------
+/*
+ * Every center on the lattice is checked band by band until a band's window
+ * has too many pixels in it. The best candidate is the one that is clear the
+ * deepest, then the one with the lowest percentage, then the one closest to
+ * the center of the image.
+ */
+Scale_Candidate
+Multi_Scale_Search::
+find(float max_fraction) const
+{
+	Scale_Candidate best;
+	best.found       = false;
+	best.center_x    = 0;
+	best.center_y    = 0;
+	best.half_width  = 0;
+	best.half_height = 0;
+	best.clear_bands = 0;
+	best.occupancy   = 0;
+	long best_distance = 0;
+
+	const int cell     = grid->cell_size;
+	const int center_x = grid->image_width  / 2;
+	const int center_y = grid->image_height / 2;
+
+	// the largest window has to fit, so it decides the range of centers
+	for ( int cy = half_rows[0]; cy <= grid->rows - half_rows[0]; cy += stride_cells )
+	{
+		for ( int cx = half_cols[0]; cx <= grid->cols - half_cols[0]; cx += stride_cells )
+		{
+			// ------------------------------------------------------------------
+			//   CHECK EACH BAND
+			// ------------------------------------------------------------------
+			int   clear = 0;
+			float worst = 0;
+			for ( int b = 0; b < grid->num_bands; b++ )
+			{
+				int c0 = std::max(cx - half_cols[b], 0);
+				int r0 = std::max(cy - half_rows[b], 0);
+				int c1 = std::min(cx + half_cols[b], grid->cols);
+				int r1 = std::min(cy + half_rows[b], grid->rows);
+
+				float fraction = (float) grid->band_sum(b, c0, r0, c1, r1)
+				               / ((c1 - c0) * (r1 - r0) * cell * cell);
+				if ( fraction >= max_fraction )
+					break;
+
+				worst = std::max(worst, fraction);
+				clear++;
+			}
+
+			if ( clear == 0 )
+				continue;
+
+			// ------------------------------------------------------------------
+			//   COMPARE
+			// ------------------------------------------------------------------
+			long dx = cx * cell - center_x;
+			long dy = cy * cell - center_y;
+			long distance = dx * dx + dy * dy;
+
+			bool better = not best.found ||
+			              clear > best.clear_bands ||
+			              ( clear == best.clear_bands && worst < best.occupancy ) ||
+			              ( clear == best.clear_bands && worst == best.occupancy && distance < best_distance );
+			if ( not better )
+				continue;
+
+			best.found       = true;
+			best.center_x    = cx * cell;
+			best.center_y    = cy * cell;
+			best.half_width  = half_cols[clear - 1] * cell;
+			best.half_height = half_rows[clear - 1] * cell;
+			best.clear_bands = clear;
+			best.occupancy   = worst;
+			best_distance    = distance;
+		}
+	}
+
+	return best;
+}
@@ -0,0 +1,81 @@
+/**
+ * @file multi_scale.h
+ *
+ * @brief Multi-scale window search definition
+ *
+ * Evaluates candidate windows whose size follows the size of the vehicle
+ * projected at the depth of each band of the Depth_Grid
+ *
+ */
+
+#ifndef MULTI_SCALE_H_
+#define MULTI_SCALE_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <stdio.h>
+
+#include "depth_grid.h"
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+// The best window found, in image pixels
+struct Scale_Candidate
+{
+	bool  found;
+	int   center_x;
+	int   center_y;
+	int   half_width;   // of the window at the deepest clear band
+	int   half_height;
+	int   clear_bands;  // how many depth bands the window is clear through
+	float occupancy;    // worst band percentage of the window
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Multi-Scale Search Class
+// ----------------------------------------------------------------------------------
+/*
+ * Multi-Scale Search Class
+ *
+ * The opening the vehicle needs gets smaller in the image the farther away
+ * it is. Each depth band of the grid gets its own window size, the vehicle
+ * size projected through the camera at the near edge of that band (band 0
+ * uses its far edge, which matches the original fixed sections). For a
+ * candidate center, band b is checked with its own window, so near
+ * obstacles are checked against the large window and far ones against the
+ * smaller one. The candidate is clear through the first bands that stay
+ * under the percentage threshold. The window sizes are found once, from
+ * the band limits the grid was made with.
+ *
+ * All of the windows are counted from the summed area tables of the grid,
+ * so adding scales does not add a pass over the pixels.
+ */
+class Multi_Scale_Search
+{
+
+public:
+
+	Multi_Scale_Search(const Depth_Grid *grid_, float fx, float fy,
+	                   float vehicle_width_, float vehicle_height_, int stride_cells_);
+
+	Scale_Candidate find(float max_fraction) const;
+
+private:
+
+	const Depth_Grid *grid;
+	int stride_cells;
+
+	int half_cols[DEPTH_GRID_MAX_BANDS];  // half of the window size of each band, in cells
+	int half_rows[DEPTH_GRID_MAX_BANDS];
+
+};
+
+
+#endif // MULTI_SCALE_H_
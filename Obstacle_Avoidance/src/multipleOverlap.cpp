@@ -15,16 +15,32 @@
 #include <time.h>
 #include <sys/time.h>
 #include <sstream>
+#include <algorithm>
 #include <common/mavlink.h>
 
 #include "autopilot_interface.h"
 #include "serial_port.h"
+#include "udp_port.h"
+#include "pty_port.h"
+#include "offboard_session.h"
+#include "realtime.h"
+#include "depth_grid.h"
+#include "free_space.h"
+#include "multi_scale.h"
+#include "frame_alignment.h"
+#include "occupancy_grid.h"
+#include "path_planner.h"
+#include "section_motion.h"
 
 using namespace sl;
 using namespace std;
 
-#define DIS_THRESH 6		//Threshold for the depth values. Represents 6 feet
-#define PER_THRESH 15		//Threshold for the percentage of pixels in a section that are below the DIS_THRESH
+#define DIS_THRESH 6		//Threshold for the depth values when the UAV is not moving. Represents 6 feet
+#define MAX_DIS_THRESH 40	//The threshold is never moved past this, the ZED is too noisy farther out (in feet)
+#define TTC_HORIZON 4		//This is how far ahead a collision is detected. The threshold is the speed times this (in seconds)
+#define APPROACH_SPEED 5	//A section whose near depth falls this much faster than the UAV flies into it is blocked (in feet per second)
+#define MOTION_THRESH 18	//The motion of each section is followed with the pixels under this fixed depth, the far edge of the depth bands (in feet)
+#define PER_THRESH 15		//Threshold for the percentage of pixels in a section that are below the distance threshold
 #define HALF_WIDTH 314	//This is half of the width of each rectangle (in pixels)
 #define HALF_HEIGHT 126	//This is half of the height of each rectangle (in pixels)
 #define NUM_RECT 17		//This is the number of rectangles in each row and column
@@ -34,10 +50,54 @@ using namespace std;
 #define CENTER_WIDTH (WIDTH / 2)	//This is the width of the center point of the screen
 #define CENTER_HEIGHT (HEIGHT / 2)	//This is the height of the center point of the screen
 #define TOTAL_PIXELS (HALF_WIDTH * HALF_HEIGHT * 4)	//This is the total number of pixels in a rectangle
+#define STEP_WIDTH ((WIDTH - 2 * HALF_WIDTH) / (NUM_RECT - 1))	//This is the distance between the centers of neighboring rectangles in a row (in pixels)
+#define STEP_HEIGHT ((HEIGHT - 2 * HALF_HEIGHT) / (NUM_RECT - 1))	//This is the distance between the centers of neighboring rectangles in a column (in pixels)
+#define SMOOTHING 0.4		//This is how much weight the newest frame has in the smoothed percentages (1 turns smoothing off)
+#define HYSTERESIS 3		//This is how many percentage points better a new section must be before the UAV switches to it
+#define TTC_HYSTERESIS 1	//This is how much later a new section must be reached before the UAV switches to it for its time to collision (in seconds)
+#define RESEND_ANGLE 5		//The command for the same section is sent again when its direction turns this much with the attitude or the path (in degrees)
+#define SELECT_SECTIONS 0	//Select the best of the overlapping sections
+#define SELECT_FREE_SPACE 1	//Search the obstacle mask for a free rectangle the UAV fits through
+#define SELECT_MULTI_SCALE 2	//Check windows sized for the UAV at the distance of each depth band
+#define SELECT_MODE SELECT_SECTIONS	//The method used to decide where the UAV moves
+#define FREE_SPACE_GOAL FREE_SPACE_CLOSEST_TO_CENTER	//Can be set to FREE_SPACE_LARGEST or FREE_SPACE_CLOSEST_TO_CENTER
+#define MASK_CELL 16		//This is the width and height of each cell of the obstacle mask used by the free space search (in pixels)
+#define NUM_BANDS 4		//This is the number of depth bands the pixels are counted into (see bandLimits in main)
+#define VEHICLE_WIDTH 5.4	//This is the width of the space the UAV needs to fly through (in feet). About 2 * HALF_WIDTH pixels at DIS_THRESH
+#define VEHICLE_HEIGHT 2.2	//This is the height of the space the UAV needs to fly through (in feet). About 2 * HALF_HEIGHT pixels at DIS_THRESH
+#define SCALE_STRIDE 2		//This is the number of mask cells between the centers of the multi-scale windows
+#define FREE_SPACE_SECTION TOTAL_RECT	//The section number used when the free space search or multi-scale search finds a rectangle
+#define NO_DECISION -2		//Used before the first section has been selected
+#define TOP_K 5			//This is the number of ranked sections that are kept for each frame
 #define VELO 2.5
+#define FEET_TO_METERS 0.3048	//The ZED measures in feet and the Pixhawk in meters
+#define OCCUPANCY_DECIMATE 20	//Only every 20th pixel in each direction is added to the occupancy grid
+#define CLEARANCE_SECONDS 2	//A direction must be clear in the occupancy grid for this many seconds of flight at VELO
+#define VEHICLE_RADIUS 0.5	//This is the radius of the UAV that is checked in the occupancy grid (in meters)
+#define GOAL_FORWARD 20		//This is how far ahead of where offboard mode started the goal is (in meters)
+#define GOAL_RIGHT 0		//This is how far to the right of where offboard mode started the goal is (in meters)
+#define GOAL_UP 0		//This is how far above where offboard mode started the goal is (in meters)
 #define PI 3.14159265358979323
-
-Serial_Port *serial_port_quit;
+#define LINK_SERIAL 0		//Connect to the Pixhawk over the serial port
+#define LINK_UDP 1		//Connect to a simulated autopilot (SITL) or a MAVLink router over UDP
+#define LINK_PTY 2		//Create a pseudo-terminal for a simulated autopilot to open like a serial port
+#define LINK_MODE LINK_SERIAL	//How the program connects to the autopilot
+#define UDP_TARGET "127.0.0.1"	//The address of the autopilot when using LINK_UDP
+#define PTY_LINK "/tmp/obstacle_avoidance_pty"	//The path linked to the pseudo-terminal when using LINK_PTY
+#define REALTIME_MODE false	//Set to true to lock memory and run the capture and MAVLink threads with SCHED_FIFO priorities
+#define LINK_REPORT_SECONDS 10	//How often the traffic on the link to the pixhawk is printed (in seconds)
+
+//Holds the information used to rank a section
+struct Section_Candidate
+{
+	int section;		//The section number
+	float occupancy;	//The percentage of pixels that are closer than the distance threshold
+	float clearance;	//How far under the PER_THRESH the section and the sections next to it are
+	float distance;		//How far the section is from the point the UAV will be heading at (in sections)
+	float ttc;		//The time to collision of the section, TTC_HORIZON if it is farther than that (in seconds)
+};
+
+Generic_Port *port_quit;
 Autopilot_Interface *autopilot_interface_quit;
 
 void printImageValues(sl::Mat&);	//Prints the values of each pixel to a text file (This is used for testing)
@@ -45,16 +105,28 @@ cv::Mat slMat2cvMat(sl::Mat& input);	//Converts a sl::Mat to a cv::Mat
 void partition(int*, int*);		//Creates the center points for the partitions
 void fillArray(int*, const int&, const int&);	//Recursive function to fill in the array for the center points
 float getPercentage(const int&, const int&);	//Returns the percentage of pixels higher than the threshold in the given section
-void countPixels(sl::Mat&, const int*, const int*, float*);	//Iterate through all of the pixels and increment the appropriate counters
+void countPixels(sl::Mat&, const int*, const int*, const float&, float*, float*, float*, float*, Depth_Grid&);	//Iterate through all of the pixels and increment the appropriate counters
 void checkCols(bool*, const int*, const int&);	//Check which columns of rectangles the current pixel will fall into
 void checkRows(bool*, const int*, const int&);	//Check which rows of rectangles the current pixel will fall into
-void updateCounters(const bool*, const bool*, int*);	//Increments the appropriate counters
+void updateCounters(const bool*, const bool*, const float&, int*, float*);	//Increments the appropriate counters
 void calcPercentages(float*, const int*);	//Calculates all of the percentages for each rectangle
-int selectSection(const float*);	//Selects the section with the lowest percentage that is lower than the percentage threshold
-void manuever(const int&, Autopilot_Interface, const int&, const int&);	//Moves the UAV based on the section selected
-void clearPositions(int*, int&);	//Resets the positions array
-int closest(const int*, const int&);	//Returns the section that is the closest to the center
-float distanceCalc(const int&);	//Calculates how far from the center of the image the selected section is
+void calcNearDepths(float*, const int*, const float*, const float&);	//Calculates the mean depth of the pixels under the threshold in each rectangle
+float thresholdCalc(const float*);	//Moves the distance threshold out with the speed of the UAV
+void ttcCalc(float*, const float*, const float*, const Frame_Alignment&, const int*, const int*);	//Calculates the time to collision of each section
+void approachCalc(bool*, const Section_Motion&, const float&);	//Flags the sections with content that is coming at the UAV
+int rankSections(const float*, const float*, const float*, const bool*, Section_Candidate*, const int&);	//Finds the k best sections that are lower than the percentage threshold
+bool compareCandidates(const Section_Candidate&, const Section_Candidate&);	//Used to order the candidate sections
+float clearanceCalc(const float*, const int&);	//Calculates how far the section and its neighbors are under the percentage threshold
+int fallbackSection(const Section_Candidate*, const int&, const int&, const float*);	//Returns the next best section when the selected one becomes blocked
+void smoothSections(const float*, float*, bool&);	//Blends the values of the new frame into the smoothed values
+int holdSection(const int&, const Section_Candidate*, const int&, const float*, const float*, const bool*);	//Keeps the previous section unless the new best section is clearly better
+void manuever(const int&, const bool&, Offboard_Session&, const int&, const int&, const Frame_Alignment&, const Path_Planner&, const float*, float*);	//Moves the UAV based on the section selected
+float angleCalc(const float*, const float*);	//Returns the angle between two velocities
+void setGoal(Path_Planner&, const mavlink_set_position_target_local_ned_t&);	//Places the goal ahead of where offboard mode started
+void distanceCalc(float*, const Frame_Alignment&, const int*, const int*);	//Calculates how far each section is from the point the UAV will be heading at
+void addPoints(sl::Mat&, Occupancy_Grid&);	//Adds a decimated set of the depths to the occupancy grid
+float pathClearance(const int&, const int&, const Frame_Alignment&, const Occupancy_Grid&);	//Returns how far the UAV can fly towards a point of the image before the occupancy grid has an obstacle
+int clearSection(const int&, const Section_Candidate*, const int&, const int*, const int*, const Frame_Alignment&, const Occupancy_Grid&);	//Skips the selected section if the occupancy grid remembers an obstacle in its direction
 void getCenter(int&, int&, const int&, const int*, const int*);	//Gets the center of the selected rectangle. This is used to print the box the UAV will fly to
 void quit_handler( int sig );
 
@@ -91,32 +163,108 @@ int main()
     cv::Size displaySize(1280, 720);
     cv::Mat depth_image_ocv_display(displaySize, CV_8UC4);
 
-	// Jetson only. Execute the calling thread on 2nd core
-    Camera::sticktoCPUCore(2);
+	//Real-time mode locks the memory and places each thread on its own core and priority
+	//The core and priority of each thread can be changed in rt_config.threads
+	Realtime_Config rt_config;
+	rt_config.enabled = REALTIME_MODE;
+	realtime_configure(rt_config);
+
+	if(rt_config.enabled)
+	{
+		if(rt_config.lock_memory)
+			realtime_lock_memory();
+		//The capture and analysis share this thread, it is placed using the capture settings
+		realtime_enter_thread(RT_THREAD_CAPTURE);
+	}
+	else
+	{
+		// Jetson only. Execute the calling thread on 2nd core
+		Camera::sticktoCPUCore(2);
+	}
 
 	char *uart_name = (char*)"/dev/ttyUSB0";	//This is the port that we are connected too
 
 	int baudrate = 57600;
 
 	Serial_Port serial_port(uart_name, baudrate);	//Create the connection
+	UDP_Port udp_port(UDP_TARGET, UDP_PORT_DEFAULT_RX);
+	PTY_Port pty_port(PTY_LINK);
 
-	Autopilot_Interface autopilot_interface(&serial_port);	//Create the autopilot interface that will prepare the messages
+	Generic_Port *port = &serial_port;	//The connection selected by LINK_MODE
+	if(LINK_MODE == LINK_UDP)
+		port = &udp_port;
+	else if(LINK_MODE == LINK_PTY)
+		port = &pty_port;
 
-	serial_port_quit         = &serial_port;
+	Autopilot_Interface autopilot_interface(port);	//Create the autopilot interface that will prepare the messages
+
+	port_quit                = port;
 	autopilot_interface_quit = &autopilot_interface;
 	signal(SIGINT,quit_handler);	//Handles when the user hits "CTL+C"
 
-	serial_port.start();	//Start the connection to the pixhawk
-	autopilot_interface.start();	//Start the read and write threads
+	port->start();	//Start the connection to the pixhawk
+	autopilot_interface.track_message(MAVLINK_MSG_ID_POSITION_TARGET_LOCAL_NED);	//Printed each frame below
+	autopilot_interface.start();	//Start the MAVLink event loop
+
+	//Enter offboard mode once for the whole flight, each frame only updates the setpoint
+	Offboard_Session offboard(&autopilot_interface);
+	offboard.begin();
 
 	float sectionValues[TOTAL_RECT];	//Holds the percentage of pixels that are above the threshold in each section of the disparity image
+	float smoothedValues[TOTAL_RECT];	//Holds the percentages of each section smoothed over the previous frames
+	bool firstFrame = true;			//The smoothed percentages start from the first frame
+	int lastSection = NO_DECISION;		//The section that the UAV was last told to move towards
+	float sentVelocity[3] = {0, 0, 0};	//The velocity that was last sent to the UAV, forward, right and down
 	int widthSections[NUM_RECT];		//Holds the width value of the center points of all of the rectangles
 	int heightSections[NUM_RECT];		//Holds the height value of the center points of all of the rectangles
 	partition(widthSections, heightSections);	//Creates the center points for the partitions
+	Section_Candidate candidates[TOP_K];	//Holds the best sections of the last frame in order so there is a fallback if the selected one becomes blocked
+	float sectionDistances[TOTAL_RECT];	//Holds how far each section is from the point the UAV will be heading at, found again for each frame
+	float sectionDepths[TOTAL_RECT];	//Holds the mean depth of the pixels under the threshold in each section (in feet)
+	float smoothedDepths[TOTAL_RECT];	//Holds the near depths of each section smoothed over the previous frames
+	bool firstDepths = true;		//The smoothed near depths start from the first frame
+	float sectionTTC[TOTAL_RECT];		//Holds how long until the UAV reaches the pixels under the threshold in each section (in seconds)
+	float motionValues[TOTAL_RECT];		//Holds the percentage of pixels under the fixed MOTION_THRESH in each section, for following its motion
+	float motionDepths[TOTAL_RECT];		//Holds the mean depth of the pixels under the fixed MOTION_THRESH in each section (in feet)
+	bool sectionApproaching[TOTAL_RECT];	//Holds if the content of each section is coming at the UAV, found again for each frame
+	Section_Motion sectionMotion(TOTAL_RECT);	//Holds the near depth of each section over the last frames
 
 	//Initializes the rectangle that will be printed to the center of the image
 	int centerW = WIDTH / 2;
 	int centerH = HEIGHT / 2;
+	int boxHalfW = HALF_WIDTH;	//Half of the width of the rectangle that is printed
+	int boxHalfH = HALF_HEIGHT;	//Half of the height of the rectangle that is printed
+
+	//The pixels are also counted into cells for each depth band, which the free space and multi-scale searches work from
+	const float bandLimits[NUM_BANDS] = {DIS_THRESH, 9, 12, MOTION_THRESH};	//The farthest depth of each band (in feet)
+	Depth_Grid depthGrid(WIDTH, HEIGHT, MASK_CELL, bandLimits, NUM_BANDS);
+	Free_Space_Search freeSpace(&depthGrid);
+
+	//The window of each band is the size of the UAV at that distance, which comes from the focal length of the camera
+	CameraInformation cameraInfo = zed.getCameraInformation();
+	Multi_Scale_Search multiScale(&depthGrid,
+									cameraInfo.calibration_parameters.left_cam.fx,
+									cameraInfo.calibration_parameters.left_cam.fy,
+									VEHICLE_WIDTH, VEHICLE_HEIGHT, SCALE_STRIDE);
+
+	//The roll and pitch of each frame are taken out of the direction of the selected section, and the turn of the heading until the setpoint is flown
+	Frame_Alignment alignment(cameraInfo.calibration_parameters.left_cam.fx,
+								cameraInfo.calibration_parameters.left_cam.fy,
+								cameraInfo.calibration_parameters.left_cam.cx,
+								cameraInfo.calibration_parameters.left_cam.cy);
+
+	//The depths of the last frames are kept around the UAV, so an obstacle that leaves the view during a dodge is not forgotten
+	Occupancy_Grid occupancy(cameraInfo.calibration_parameters.left_cam.fx,
+								cameraInfo.calibration_parameters.left_cam.fy,
+								cameraInfo.calibration_parameters.left_cam.cx,
+								cameraInfo.calibration_parameters.left_cam.cy,
+								FEET_TO_METERS);
+
+	//The path to the goal is repaired from the voxels of the occupancy grid that changed, it is not searched again each frame
+	Path_Planner planner(&occupancy);
+	setGoal(planner, offboard.initial_position());
+
+	time_t lastLinkReport = time(NULL);	//When the traffic on the link was last printed
 
 	// Loop until 'q' is pressed
     char key = ' ';
@@ -135,18 +283,99 @@ int main()
 				{
 					zed.retrieveImage(depth_image_zed_print, VIEW_DEPTH);	//Retrieve the depth view (image)
 					zed.retrieveMeasure(depth_image_zed, MEASURE_DEPTH);	//Retrieve the depth for the image
+					uint64_t frameUsec = autopilot_interface.clock.zed_to_local_usec(zed.getCameraTimestamp());	//When the frame was captured, on the same clock as the MAVLink messages
 
 					// Resize and display with OpenCV
 					cv::resize(depth_image_ocv, depth_image_ocv_display, displaySize);	//Used to print the disparity map
 
-					countPixels(depth_image_zed, widthSections, heightSections, sectionValues);	//Iterates through each pixel and increments the appropriate counters
-					int section = selectSection(sectionValues);		//The section that is selected
-					//cout << "The selected section is: " << section << endl;
+					offboard.check_state();	//Follows the mode of the autopilot from its heartbeats
 
-					//Gets the center of the selected rectangle
-					getCenter(centerW, centerH, section, widthSections, heightSections);
-					//cout << "Center: " << centerW << ", " << centerH << endl;
-					manuever(section, autopilot_interface, centerW, centerH);	//Moves the UAV in a certain direction
+					alignment.update(autopilot_interface.history.attitude, frameUsec);	//The attitude when the frame was captured and the predicted turn of the heading
+					distanceCalc(sectionDistances, alignment, widthSections, heightSections);	//Only the sections are moved, the pixels are still counted in the image grid
+
+					//The occupancy grid needs the position and attitude when the frame was captured, it is not changed until both are known
+					mavlink_local_position_ned_t framePosition;
+					mavlink_attitude_t frameAttitude;
+					bool havePosition = autopilot_interface.history.local_position_ned.at(frameUsec, framePosition);
+					if(havePosition && autopilot_interface.history.attitude.at(frameUsec, frameAttitude))
+					{
+						occupancy.begin_frame(framePosition, frameAttitude);
+						addPoints(depth_image_zed, occupancy);
+						planner.update(occupancy.position);	//The work is capped, a large change is finished over the next frames
+					}
+
+					//Anything the UAV reaches within the TTC_HORIZON is counted, so the threshold moves out with the speed when the frame was captured
+					float velocity[3] = {0, 0, 0};	//North, east and down (in meters per second), the UAV is taken to be still until the position is known
+					if(havePosition)
+					{
+						velocity[0] = framePosition.vx;
+						velocity[1] = framePosition.vy;
+						velocity[2] = framePosition.vz;
+					}
+					float disThresh = thresholdCalc(velocity);
+
+					countPixels(depth_image_zed, widthSections, heightSections, disThresh, sectionValues, sectionDepths, motionValues, motionDepths, depthGrid);	//Iterates through each pixel and increments the appropriate counters
+					smoothSections(sectionDepths, smoothedDepths, firstDepths);	//The near depths are as noisy as the percentages, so the time to collision is found from smoothed ones
+					ttcCalc(sectionTTC, smoothedDepths, velocity, alignment, widthSections, heightSections);	//Only the near depth of each section is needed, not the pixels
+
+					//A moving obstacle can be in a section that is still open, so the near depths are compared over the frames with the motion of the UAV taken out
+					//The threshold that moves with the speed would move the mean depths too, so the motion is followed under the fixed MOTION_THRESH
+					sectionMotion.add_frame(frameUsec, motionDepths, motionValues);
+					approachCalc(sectionApproaching, sectionMotion, alignment.forward_speed(velocity[0], velocity[1], velocity[2]) / FEET_TO_METERS);
+
+					if(SELECT_MODE == SELECT_FREE_SPACE)
+					{
+						//Find the free rectangle that is at least the size of a section
+						Free_Rect rect = freeSpace.find(FREE_SPACE_GOAL, HALF_WIDTH * 2, HALF_HEIGHT * 2, PER_THRESH / 100.0);
+						int section = rect.found ? FREE_SPACE_SECTION : -1;
+						int newW = rect.found ? rect.center_x() : 0;
+						int newH = rect.found ? rect.center_y() : 0;
+						boxHalfW = rect.width / 2;
+						boxHalfH = rect.height / 2;
+
+						//The direction is found again every frame, a new command is sent when the free space moves or the direction turns with the attitude or the path
+						bool changed = section != lastSection || newW != centerW || newH != centerH;
+						centerW = newW;
+						centerH = newH;
+						manuever(section, changed, offboard, centerW, centerH, alignment, planner, occupancy.position, sentVelocity);	//Moves the UAV in a certain direction
+						lastSection = section;
+					}
+					else if(SELECT_MODE == SELECT_MULTI_SCALE)
+					{
+						//Find the window that is clear the farthest, each depth band is checked with a window the size of the UAV at that distance
+						Scale_Candidate window = multiScale.find(PER_THRESH / 100.0);
+						int section = window.found ? FREE_SPACE_SECTION : -1;
+						int newW = window.found ? window.center_x : 0;
+						int newH = window.found ? window.center_y : 0;
+						boxHalfW = window.half_width;
+						boxHalfH = window.half_height;
+
+						//The direction is found again every frame, a new command is sent when the window moves or the direction turns with the attitude or the path
+						bool changed = section != lastSection || newW != centerW || newH != centerH;
+						centerW = newW;
+						centerH = newH;
+						manuever(section, changed, offboard, centerW, centerH, alignment, planner, occupancy.position, sentVelocity);	//Moves the UAV in a certain direction
+						lastSection = section;
+					}
+					else
+					{
+						smoothSections(sectionValues, smoothedValues, firstFrame);	//Smooths out the noise in the percentages between frames
+						int candidateCount = rankSections(smoothedValues, sectionDistances, sectionTTC, sectionApproaching, candidates, TOP_K);	//Ranks the best sections for this frame
+						int section = holdSection(lastSection, candidates, candidateCount, smoothedValues, sectionTTC, sectionApproaching);		//The section that is selected
+						if(section >= 0 && sectionValues[section] >= PER_THRESH)
+							section = fallbackSection(candidates, candidateCount, section, sectionValues);	//The section is already blocked in the newest frame
+						section = clearSection(section, candidates, candidateCount, widthSections, heightSections, alignment, occupancy);	//The camera cannot see what is to the sides of the UAV
+						//cout << "The selected section is: " << section << endl;
+
+						//Gets the center of the selected rectangle
+						getCenter(centerW, centerH, section, widthSections, heightSections);
+						//cout << "Center: " << centerW << ", " << centerH << endl;
+
+						//The direction of the held section is found again every frame, as the roll, pitch and heading change move it in the image
+						//A new command is sent when the section changes or the direction turns, the event loop keeps sending the last one
+						manuever(section, section != lastSection, offboard, centerW, centerH, alignment, planner, occupancy.position, sentVelocity);	//Moves the UAV in a certain direction
+						lastSection = section;
+					}
 
 					///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 					//
@@ -155,22 +384,33 @@ int main()
 					//
 					///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 					
-					Mavlink_Messages messages = autopilot_interface.current_messages;
-					mavlink_position_target_local_ned_t pt = messages.position_target_local_ned;
+					mavlink_position_target_local_ned_t pt;
+					autopilot_interface.current_messages.position_target_local_ned.read(pt);
 					printf("%lu POSITION_TARGET_VELOCITIES  = [ %f , %f , %f ] \n", autopilot_interface.write_count, pt.vx, pt.vy, pt.vz);
 					std::stringstream ss;
 					ss << pt.type_mask;
 					float type_mask;
 					ss >> type_mask;
-					printf("Yaw: %f\nYaw Rate: %f\nType Mask: %f\nCoordinate Frame: %i\n\n", pt.yaw, pt.yaw_rate, type_mask, pt.coordinate_frame);
+					printf("Yaw: %f\nYaw Rate: %f\nType Mask: %f\nCoordinate Frame: %i\n", pt.yaw, pt.yaw_rate, type_mask, pt.coordinate_frame);
+					uint64_t frameAge = get_monotonic_usec() - frameUsec;	//Time from the capture of the frame until the setpoint was given
+					Latency_Stats writeLatency = autopilot_interface.get_setpoint_latency();	//Time from the setpoint being given until it is written to the pixhawk
+					alignment.measure_latency(frameAge + (writeLatency.count ? writeLatency.total_usec / writeLatency.count : 0));
+					printf("Frame Age: %.1f ms\n", frameAge / 1000.0);
+					printf("Distance Threshold: %.1f ft, Approaching Sections: %d\n", disThresh, (int)count(sectionApproaching, sectionApproaching + TOTAL_RECT, true));
+					printf("Roll: %.1f deg, Pitch: %.1f deg, Heading Change: %.1f deg over %.1f ms\n\n",
+							alignment.roll * 180 / PI, alignment.pitch * 180 / PI,
+							alignment.heading_change * 180 / PI, alignment.latency_usec() / 1000.0);
+					printf("Planner: %s, %d expansions, %d repairs\n\n",
+							planner.arrived(occupancy.position) ? "arrived" : (planner.has_path() ? "path" : "no path"),
+							planner.expansions, planner.repairs);
 					
 
 					//Prints the rectanlge representing the selected section if there is one
 					if(centerW != 0 && centerH != 0)
 					{
 						cv::rectangle(depth_image_ocv_display,
-										cv::Point(centerW - HALF_WIDTH, centerH - HALF_HEIGHT),
-										cv::Point(centerW + HALF_WIDTH, centerH + HALF_HEIGHT),
+										cv::Point(centerW - boxHalfW, centerH - boxHalfH),
+										cv::Point(centerW + boxHalfW, centerH + boxHalfH),
 										cv::Scalar(0, 255, 0),
 										2);
 					}
@@ -179,6 +419,15 @@ int main()
 					imshow("Disparity Map", depth_image_ocv_display);
 					key = cv::waitKey(10);
 
+					realtime_check_thread(RT_THREAD_CAPTURE);	//Reports any page faults or priority changes since the last frame
+
+					//Prints the load on the link and the messages dropped, so a link that is running out shows up before the setpoints are late
+					if(time(NULL) - lastLinkReport >= LINK_REPORT_SECONDS)
+					{
+						port->link.print_report();
+						lastLinkReport = time(NULL);
+					}
+
 					//counter++;
 				}
 				//duration = (clock() - start) / (double)CLOCKS_PER_SEC;
@@ -192,8 +441,10 @@ int main()
 		cin >> key;
 	}
 
+	offboard.end();	//Leave offboard mode
 	autopilot_interface.stop();	//Stops the autopilot interface so messages cannot be prepared anymore
-	serial_port.stop();	//Closes the connection to the pixhawk
+	port->stop();	//Closes the connection to the pixhawk
+	realtime_report();	//Prints the page faults and priority violations seen by each thread
 
 	zed.close();	//Close the ZED camera
 	return 0;
@@ -275,15 +526,27 @@ float getPercentage(const int& numBelow)
 }
 
 //Iterates through the image and increments the appropriate counters
-void countPixels(sl::Mat& depthMap, const int *width, const int *height, float *sectionValues)
+//The depths of the pixels below the threshold are added up in the same pass, for the time to collision of each section
+//The motion of each section is followed with the pixels under the fixed MOTION_THRESH, counted in the same pass whatever the threshold is
+void countPixels(sl::Mat& depthMap, const int *width, const int *height, const float& disThresh, float *sectionValues, float *sectionDepths,
+					float *motionValues, float *motionDepths, Depth_Grid& depthGrid)
 {
 	bool rows[NUM_RECT];	//Keeps track of the possible rows the pixel can be in
 	bool cols[NUM_RECT];	//Keeps track of the possible columns the pixel can be in
-	int sections[TOTAL_RECT];	//Keeps track of how many pixels are below the DIS_THRESH in each section
+	int sections[TOTAL_RECT];	//Keeps track of how many pixels are below the threshold in each section
+	float depthSums[TOTAL_RECT];	//Keeps track of the depths of the pixels below the threshold in each section
+	int motionSections[TOTAL_RECT];	//Keeps track of how many pixels are below the MOTION_THRESH in each section
+	float motionSums[TOTAL_RECT];	//Keeps track of the depths of the pixels below the MOTION_THRESH in each section
 
 	//Initializes the values to 0
 	for(int i = 0; i < TOTAL_RECT; i++)
+	{
 		sections[i] = 0;
+		depthSums[i] = 0;
+		motionSections[i] = 0;
+		motionSums[i] = 0;
+	}
+	depthGrid.clear();
 
 	//Initializes the vlues to false
 	for(int i = 0; i < NUM_RECT; i++)
@@ -316,13 +579,31 @@ void countPixels(sl::Mat& depthMap, const int *width, const int *height, float *
 			float depth;	//Holds the depth at the pixel
 			depthMap.getValue(x, y, &depth);	//Finds the depth at the current pixel
 
-			//If the current pixel is below the DIS_THRESH then update the appropriate counters
-			if(depth <= DIS_THRESH || depth == NAN || depth == TOO_CLOSE)
-				updateCounters(rows, cols, sections);
+			//A pixel the ZED could not measure (NAN) is counted as an obstacle, the same as a pixel too close to measure, so a blank wall is not taken as open
+			bool unknown = isnan(depth);
+
+			//If the current pixel is below the threshold then update the appropriate counters
+			if(unknown || depth <= disThresh || depth == TOO_CLOSE)
+			{
+				//A pixel too close to measure is taken to be right at the camera, and an unknown one at the threshold since nothing closer is known
+				updateCounters(rows, cols, unknown ? disThresh : max(depth, 0.0f), sections, depthSums);
+			}
+
+			//The same for the motion, out to a depth that does not move with the speed
+			if(unknown || depth <= MOTION_THRESH || depth == TOO_CLOSE)
+				updateCounters(rows, cols, unknown ? (float)MOTION_THRESH : max(depth, 0.0f), motionSections, motionSums);
+
+			//The depth grid keeps its fixed bands whatever the threshold is, so the windows of the multi-scale search stay the size of the UAV
+			if(unknown || depth <= depthGrid.max_depth() || depth == TOO_CLOSE)
+				depthGrid.add_pixel(x, y, unknown ? 0 : depth);	//Unknown pixels go in the closest band
 		}
 	}
 	
 	calcPercentages(sectionValues, sections);	//Calculate the percentages of each section
+	calcNearDepths(sectionDepths, sections, depthSums, disThresh);	//Calculate the near depth of each section
+	calcPercentages(motionValues, motionSections);	//The counts under the fixed MOTION_THRESH
+	calcNearDepths(motionDepths, motionSections, motionSums, MOTION_THRESH);
+	depthGrid.build_integrals();	//Lets any window of cells be counted with four lookups
 }
 
 //Update if the new column of pixels falls in new columns of rectangles
@@ -364,7 +645,7 @@ void checkRows(bool *rows, const int *height, const int& y)
 }
 
 //Update the counters of the rectangles that the current pixel is in
-void updateCounters(const bool *rows, const bool *cols, int *sections)
+void updateCounters(const bool *rows, const bool *cols, const float& depth, int *sections, float *depthSums)
 {
 	int r = 0;	//Used to find the first row of rectangles that the pixel is in
 	int c = 0;	//Used to find the first column of rectangles that the pixel is in
@@ -386,6 +667,7 @@ void updateCounters(const bool *rows, const bool *cols, int *sections)
 		while(c2 < NUM_RECT && cols[c2]== true)
 		{
 			sections[(r2 * NUM_RECT) + c2]++;	//Increase the counter of the current rectangle
+			depthSums[(r2 * NUM_RECT) + c2] += depth;	//Add the depth to the current rectangle
 			c2++;
 		}
 		r2++;
@@ -408,78 +690,244 @@ void calcPercentages(float *sectionValues, const int *sections)
 	//file.close();
 }
 
+//Calculates the mean depth of the pixels below the threshold in each rectangle
+//A rectangle without any is given the threshold, nothing in it is closer than that
+void calcNearDepths(float *sectionDepths, const int *sections, const float *depthSums, const float& disThresh)
+{
+	for(int i = 0; i < TOTAL_RECT; i++)
+	{
+		if(sections[i] > 0)
+			sectionDepths[i] = depthSums[i] / sections[i];
+		else
+			sectionDepths[i] = disThresh;
+	}
+}
 
+//Moves the distance threshold out to how far the UAV flies in the TTC_HORIZON, and never in closer than DIS_THRESH
+//Only the sections use it. The bands of the depth grid stay fixed, a closest band sized at a farther depth would let a gap narrower than the UAV through
+float thresholdCalc(const float *velocity)
+{
+	float speed = sqrt(velocity[0] * velocity[0] + velocity[1] * velocity[1] + velocity[2] * velocity[2]) / FEET_TO_METERS;	//In feet per second
+	return min(max(speed * TTC_HORIZON, (float)DIS_THRESH), (float)MAX_DIS_THRESH);
+}
+
+//Flags the sections whose near depth is falling faster than the UAV flying into them makes it fall, by more than the APPROACH_SPEED
+//The depth of a still obstacle falls as fast as the UAV flies along the axis of the camera, in every section
+void approachCalc(bool *sectionApproaching, const Section_Motion& sectionMotion, const float& forwardSpeed)
+{
+	for(int i = 0; i < TOTAL_RECT; i++)
+		sectionApproaching[i] = sectionMotion.closing_speed(i) - forwardSpeed > APPROACH_SPEED;
+}
 
-//Selects the section that has the smallest percentage
-int selectSection(const float *sectionValues)
+//Calculates how long until the UAV reaches the near depth of each section, from how fast it is flying towards the center of the section (in seconds)
+//A section the UAV is not flying towards is never reached
+void ttcCalc(float *sectionTTC, const float *sectionDepths, const float *velocity, const Frame_Alignment& alignment, const int *widthSections, const int *heightSections)
 {
-	int positions[TOTAL_RECT];	//Keep track of any rectangle with the same percentage value (will be the lowest percentage value)
-	int position = 0;
-	//Start with the center section so the UAV flies to the destination
-	float minPercent = sectionValues[0];//TOTAL_RECT / 2];
-	int minPos = 0;//TOTAL_RECT / 2;
-	positions[position++] = minPos;
-	//if(minPercent < PER_THRESH)
-		//return minPos;
-	//Get the section number that has the lowest percentage
-	for (int i = 0; i < TOTAL_RECT; i++)
+	for(int i = 0; i < TOTAL_RECT; i++)
 	{
-		if (sectionValues[i] < minPercent)
-		{
-			clearPositions(positions, position);
-			minPercent = sectionValues[i];
-			minPos = i;
-			positions[position++] = i;
-		}
-		else if(sectionValues[i] == minPercent)
+		int row = i / NUM_RECT;
+		int col = i % NUM_RECT;
+		float closing = alignment.closing_speed(widthSections[col], heightSections[row], velocity[0], velocity[1], velocity[2]) / FEET_TO_METERS;	//In feet per second
+
+		if(closing > 0)
+			sectionTTC[i] = alignment.range(widthSections[col], heightSections[row], sectionDepths[i]) / closing;	//The depth is along the axis of the camera and the closing speed along the ray
+		else
+			sectionTTC[i] = INFINITY;
+	}
+}
+
+
+
+//Fills the candidates array with the k best sections that are under the percentage threshold and returns how many were found
+//The sections are ranked by time to collision up to the TTC_HORIZON, then by percentage and then by how close they are to the point the UAV will be heading at
+//A section with content coming at the UAV is not open, however few pixels it has under the threshold
+int rankSections(const float *sectionValues, const float *sectionDistances, const float *sectionTTC, const bool *sectionApproaching, Section_Candidate *candidates, const int& k)
+{
+	Section_Candidate open[TOTAL_RECT];	//Every section that is under the percentage threshold
+	int count = 0;
+
+	for(int i = 0; i < TOTAL_RECT; i++)
+	{
+		if(sectionValues[i] < PER_THRESH && !sectionApproaching[i])
 		{
-			positions[position++] = i;
+			open[count].section = i;
+			open[count].occupancy = sectionValues[i];
+			open[count].distance = sectionDistances[i];
+			open[count].ttc = min(sectionTTC[i], (float)TTC_HORIZON);	//Every section past the horizon is as good as the others
+			count++;
 		}
 	}
-	//ofstream file;
-	//file.open("minPercentages.txt");
-	//for(int i = 0; i < position; i++)
-		//file << percentages[i] << endl;
-	//file.close();
-	//Check the minPercent with the percentage threshold
-	if (minPercent < PER_THRESH)
-		return closest(positions, position);
-	return -1;	//The section with the smallest percentage has a percentage higher than the percentage threshold
+
+	//Only the first k sections are put in order, the rest are left unsorted
+	int ranked = min(k, count);
+	partial_sort(open, open + ranked, open + count, compareCandidates);
+
+	for(int i = 0; i < ranked; i++)
+	{
+		candidates[i] = open[i];
+		candidates[i].clearance = clearanceCalc(sectionValues, open[i].section);
+	}
+	return ranked;
 }
 
-//Resets the positions array
-void clearPositions(int *positions, int& position)
+//Returns true if candidate a should be ranked before candidate b
+bool compareCandidates(const Section_Candidate& a, const Section_Candidate& b)
 {
-	for(int i = 0; i < position; i++)
-		positions[i] = 0;
-	position = 0;
+	if(a.ttc != b.ttc)
+		return a.ttc > b.ttc;
+	if(a.occupancy != b.occupancy)
+		return a.occupancy < b.occupancy;
+	if(a.distance != b.distance)
+		return a.distance < b.distance;
+	return a.section < b.section;	//Keeps the lower numbered section on a tie, the same as the original selection
+}
+
+//Calculates how far under the percentage threshold the section and the sections next to it are
+//A negative value means the section is open but one of the sections right next to it is blocked
+float clearanceCalc(const float *sectionValues, const int& section)
+{
+	int row = section / NUM_RECT;
+	int col = section % NUM_RECT;
+	float worst = sectionValues[section];
+
+	if(row > 0)
+		worst = max(worst, sectionValues[section - NUM_RECT]);
+	if(row < NUM_RECT - 1)
+		worst = max(worst, sectionValues[section + NUM_RECT]);
+	if(col > 0)
+		worst = max(worst, sectionValues[section - 1]);
+	if(col < NUM_RECT - 1)
+		worst = max(worst, sectionValues[section + 1]);
+
+	return PER_THRESH - worst;
 }
 
-//Selects the closest section to the center that is the most clear
-int closest(const int *positions, const int& position)
+//Returns the ranked section with the most clearance that is also open in the newest frame, other than the one that became blocked, or -1 if there are no more open sections
+//The obstacle that blocked the section is likely to be next to it, so a section whose neighbors are also open is taken over a better ranked one that is only just open
+//The ranking is from the smoothed percentages, so this lets the UAV switch sections right away without waiting for the smoothing to catch up
+int fallbackSection(const Section_Candidate *candidates, const int& count, const int& blocked, const float *sectionValues)
 {
-	int closestPos = positions[0];
-	float closestDis = distanceCalc(positions[0]);
-	for(int i = 1; i < position; i++)
+	int best = -1;	//The index of the best candidate so far, the better ranked one is kept on a tie
+	for(int i = 0; i < count; i++)
 	{
-		float distance = distanceCalc(positions[i]);
-		if(distance < closestDis)
+		if(candidates[i].section == blocked || sectionValues[candidates[i].section] >= PER_THRESH)
+			continue;
+		if(best < 0 || candidates[i].clearance > candidates[best].clearance)
+			best = i;
+	}
+	return best < 0 ? -1 : candidates[best].section;
+}
+
+//Blends the values of the newest frame into the smoothed values of each section, used for the percentages and the near depths
+void smoothSections(const float *sectionValues, float *smoothedValues, bool& firstFrame)
+{
+	//The first frame has nothing to be blended with
+	if(firstFrame)
+	{
+		for(int i = 0; i < TOTAL_RECT; i++)
+			smoothedValues[i] = sectionValues[i];
+		firstFrame = false;
+		return;
+	}
+
+	for(int i = 0; i < TOTAL_RECT; i++)
+		smoothedValues[i] += SMOOTHING * (sectionValues[i] - smoothedValues[i]);
+}
+
+//Keeps flying towards the previous section as long as it is still open and the new best section is not better by more than the HYSTERESIS
+//This stops the selected section from flickering between neighbors because of noise in the depth image
+int holdSection(const int& previous, const Section_Candidate *candidates, const int& count, const float *smoothedValues, const float *sectionTTC, const bool *sectionApproaching)
+{
+	//There are no open sections
+	if(count == 0)
+		return -1;
+
+	//There was no open section before (or this is the first frame) so take the best one
+	if(previous < 0)
+		return candidates[0].section;
+
+	//The previous section is no longer open
+	if(smoothedValues[previous] >= PER_THRESH || sectionApproaching[previous])
+		return candidates[0].section;
+
+	//The previous section will be reached within the TTC_HORIZON, and clearly sooner than the new section
+	if(sectionTTC[previous] < candidates[0].ttc - TTC_HYSTERESIS)
+		return candidates[0].section;
+
+	//Only switch if the new section is clearly better
+	if(candidates[0].occupancy < smoothedValues[previous] - HYSTERESIS)
+		return candidates[0].section;
+	return previous;
+}
+
+//Calculates how far each section is from the point the UAV will be heading at (in sections)
+//When the UAV is level and not turning this is the center of the image, the same as the center section
+void distanceCalc(float *sectionDistances, const Frame_Alignment& alignment, const int *widthSections, const int *heightSections)
+{
+	for(int i = 0; i < TOTAL_RECT; i++)
+	{
+		int row = i / NUM_RECT;
+		int col = i % NUM_RECT;
+		float deltaRow = (heightSections[row] - alignment.reference_y()) / STEP_HEIGHT;
+		float deltaCol = (widthSections[col] - alignment.reference_x()) / STEP_WIDTH;
+		sectionDistances[i] = sqrt((deltaRow * deltaRow) + (deltaCol * deltaCol));
+	}
+}
+
+//Adds every OCCUPANCY_DECIMATE pixel to the occupancy grid, which is enough to fill its voxels at the distances that matter
+void addPoints(sl::Mat& depthMap, Occupancy_Grid& occupancy)
+{
+	for(int y = OCCUPANCY_DECIMATE / 2; y < (int)depthMap.getHeight(); y += OCCUPANCY_DECIMATE)
+	{
+		for(int x = OCCUPANCY_DECIMATE / 2; x < (int)depthMap.getWidth(); x += OCCUPANCY_DECIMATE)
 		{
-			closestDis = distance;
-			closestPos = positions[i];
+			float depth;	//Holds the depth at the pixel
+			depthMap.getValue(x, y, &depth);
+			occupancy.add_depth(x, y, depth);
 		}
 	}
-	return closestPos;
 }
 
-//Calculates how far from the center of the image the selected section is
-float distanceCalc(const int& section)
+//Returns how far the UAV can fly towards a point of the image before it reaches an obstacle in the occupancy grid (in meters)
+//The velocity is flown in the level frame of the heading, so it is turned by the heading to get the north and east of the grid
+float pathClearance(const int& centerW, const int& centerH, const Frame_Alignment& alignment, const Occupancy_Grid& occupancy)
 {
-	int row = section / NUM_RECT;
-	int col = section % NUM_RECT;
-	int deltaRow = abs(row - (NUM_RECT / 2));
-	int deltaCol = abs(col - (NUM_RECT / 2));
-	return sqrt((deltaRow * deltaRow) + (deltaCol * deltaCol));
+	float maxDistance = VELO * CLEARANCE_SECONDS;
+
+	//The UAV follows the path to the goal for the section it is heading at, which already goes around the occupancy grid, see manuever
+	if(fabs(centerW - alignment.reference_x()) * 2 < STEP_WIDTH && fabs(centerH - alignment.reference_y()) * 2 < STEP_HEIGHT)
+		return maxDistance;
+
+	float dirY, dirZ;
+	if(!alignment.direction(centerW, centerH, dirY, dirZ))
+		return maxDistance;
+
+	float heading = alignment.yaw + alignment.heading_change;
+	return occupancy.clearance(-sin(heading) * dirY, cos(heading) * dirY, dirZ, maxDistance, VEHICLE_RADIUS);
+}
+
+//Keeps the selected section unless the occupancy grid has an obstacle in its direction, then takes the next ranked section that is clear
+//If none of them are clear the selected section is kept, the camera is sure it is open right now
+int clearSection(const int& section, const Section_Candidate *candidates, const int& count, const int *widthSections, const int *heightSections,
+					const Frame_Alignment& alignment, const Occupancy_Grid& occupancy)
+{
+	if(section < 0)
+		return section;
+
+	int centerW, centerH;
+	getCenter(centerW, centerH, section, widthSections, heightSections);
+	if(pathClearance(centerW, centerH, alignment, occupancy) >= VELO * CLEARANCE_SECONDS)
+		return section;
+
+	for(int i = 0; i < count; i++)
+	{
+		if(candidates[i].section == section)
+			continue;
+		getCenter(centerW, centerH, candidates[i].section, widthSections, heightSections);
+		if(pathClearance(centerW, centerH, alignment, occupancy) >= VELO * CLEARANCE_SECONDS)
+			return candidates[i].section;
+	}
+	return section;
 }
 
 //Get the center of the selected section. This is for testing and seeing what section was selected
@@ -502,14 +950,29 @@ void getCenter(int& centerW, int& centerH, const int& section, const int *widthS
 	}
 }
 
+//Places the goal GOAL_FORWARD, GOAL_RIGHT and GOAL_UP from where offboard mode started, turned by the heading it started with
+void setGoal(Path_Planner& planner, const mavlink_set_position_target_local_ned_t& ip)
+{
+	float start[3] = {ip.x, ip.y, ip.z};
+	float goal[3] = {ip.x + cos(ip.yaw) * GOAL_FORWARD - sin(ip.yaw) * GOAL_RIGHT,
+						ip.y + sin(ip.yaw) * GOAL_FORWARD + cos(ip.yaw) * GOAL_RIGHT,
+						ip.z - GOAL_UP};
+	planner.set_goal(start, goal);
+}
+
 //Move the UAV in respect to the section that was selected.
-void manuever(const int& section, Autopilot_Interface api, const int& centerW, const int& centerH)
+//The direction is taken in the level frame the velocity is flown in, so a section that is left in a rolled image may be left and up
+//Unless the section changed, the command is only sent when its velocity turned at least RESEND_ANGLE from sentVelocity
+void manuever(const int& section, const bool& changed, Offboard_Session& offboard, const int& centerW, const int& centerH, const Frame_Alignment& alignment,
+				const Path_Planner& planner, const float *position, float *sentVelocity)
 {
-	api.enable_offboard_control();
-	usleep(100); // give some time to let it sink in
 	// initialize command data strtuctures
 	mavlink_set_position_target_local_ned_t sp;
-	mavlink_set_position_target_local_ned_t ip = api.initial_position;
+	memset(&sp, 0, sizeof(sp));
+	const mavlink_set_position_target_local_ned_t& ip = offboard.initial_position();
+
+	float dirY = 0;	//The direction towards the selected section, to the right
+	float dirZ = 0;	//The direction towards the selected section, down
 
 	//There is no section that is open
 	if(centerW == 0 || centerH == 0)
@@ -518,86 +981,51 @@ void manuever(const int& section, Autopilot_Interface api, const int& centerW, c
 		set_velocity(0, 0, 0, sp);
 		set_yaw_rate(PI / 4, sp);
 	}
-	else
+	//The selected section is the one the UAV will be heading at, so it flies along the path to the goal
+	else if(fabs(centerW - alignment.reference_x()) * 2 < STEP_WIDTH && fabs(centerH - alignment.reference_y()) * 2 < STEP_HEIGHT)
 	{
-		int delta_w = abs(CENTER_WIDTH - centerW);
-		int delta_h = abs(CENTER_HEIGHT - centerH);
-		double theta = atan(delta_h / delta_w);
-		double VELO_Y = VELO * cos(theta);
-		double VELO_Z = VELO * sin(theta);
-
-		//The selected section is on the left of the center
-		if(centerW < CENTER_WIDTH)
-		{
-			//The selected section is directly left
-			if(centerH == CENTER_HEIGHT)
-			{
-				set_velocity(0, VELO_Y * -1, 0, sp);
-				set_yaw(ip.yaw, sp);
-			}
-			//The selected section is above the center and to the left
-			else if(centerH < CENTER_HEIGHT)
-			{
-				//This is up and to the left. Will adjust the values to be at the angle of the section later
-				set_velocity(0, VELO_Y * -1, VELO_Z * -1, sp);
-				set_yaw(ip.yaw, sp);
-			}
-			//The selected section is below the center and to the left
-			else
-			{
-				set_velocity(0, VELO_Y * -1, VELO_Z, sp);
-				set_yaw(ip.yaw, sp);
-			}
-		}
-		//The selected section is above, below or is the center
-		else if(centerW == CENTER_WIDTH)
+		float path[3];	//The direction of the path in north, east and down
+		if(planner.direction(position, path))
 		{
-			//The selected section is the center section
-			if(centerH == CENTER_HEIGHT)
-			{
-				//For now the UAV will just hover in place but later we will have it fly to the waypoint
-				set_velocity(0, 0, 0, sp);
-				set_yaw(ip.yaw, sp);
-			}
-			//The selected section is directly above the center
-			else if(centerH < CENTER_HEIGHT)
-			{
-				set_velocity(0, 0, VELO_Z * -1, sp);
-				set_yaw(ip.yaw, sp);
-			}
-			//The selected section is directly below the center
-			else
-			{
-				set_velocity(0, 0, VELO_Z, sp);
-				set_yaw(ip.yaw, sp);
-			}
+			//The velocity is flown in the level frame of the heading, so the path is turned back by the heading
+			float heading = alignment.yaw + alignment.heading_change;
+			set_velocity(VELO * (cos(heading) * path[0] + sin(heading) * path[1]),
+							VELO * (-sin(heading) * path[0] + cos(heading) * path[1]),
+							VELO * path[2], sp);
 		}
-		//The selected section is to the right of the center
 		else
 		{
-			//The selected section is directly to the right of the center
-			if(centerH == CENTER_HEIGHT)
-			{
-				set_velocity(0, VELO_Y, 0, sp);
-				set_yaw(ip.yaw, sp);
-			}
-			//The selected section is above the center and to the right
-			else if(centerH < CENTER_HEIGHT)
-			{
-				set_velocity(0, VELO_Y, VELO_Z * -1, sp);
-				set_yaw(ip.yaw, sp);
-			}
-			//The selected section is below the center and to the right
-			else
-			{
-				set_velocity(0, VELO_Y, VELO_Z, sp);
-				set_yaw(ip.yaw, sp);
-			}
+			//Hover at the goal, or until there is a path to it
+			set_velocity(0, 0, 0, sp);
 		}
+		set_yaw(ip.yaw, sp);
+	}
+	else
+	{
+		alignment.direction(centerW, centerH, dirY, dirZ);
+		set_velocity(0, VELO * dirY, VELO * dirZ, sp);
+		set_yaw(ip.yaw, sp);
 	}
 
-	api.update_setpoint(sp);	//Move in the appropriate direction
-	api.disable_offboard_control();	//Stop getting the commands
+	float velocity[3] = {sp.vx, sp.vy, sp.vz};
+	if(!changed && angleCalc(sentVelocity, velocity) < RESEND_ANGLE * PI / 180)
+		return;
+
+	offboard.update(sp);	//Move in the appropriate direction, the session stays in offboard mode
+	for(int i = 0; i < 3; i++)
+		sentVelocity[i] = velocity[i];
+}
+
+//Returns the angle between two velocities (in radians). A velocity of zero is only at no angle to another one of zero
+float angleCalc(const float *a, const float *b)
+{
+	float dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+	float lengths = sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]) * sqrt(b[0] * b[0] + b[1] * b[1] + b[2] * b[2]);
+
+	if(lengths <= 0)
+		return (a[0] == b[0] && a[1] == b[1] && a[2] == b[2]) ? 0 : PI;
+
+	return acos(max(-1.0f, min(1.0f, dot / lengths)));
 }
 
 void quit_handler( int sig )
@@ -612,12 +1040,14 @@ void quit_handler( int sig )
 	}
 	catch (int error){}
 
-	// serial port
+	// port
 	try {
-		serial_port_quit->handle_quit(sig);
+		port_quit->handle_quit(sig);
 	}
 	catch (int error){}
 
+	realtime_report();
+
 	// end program here
 	exit(0);
 
@@ -0,0 +1,397 @@
+/**
+ * @file occupancy_grid.cpp
+ *
+ * @brief Occupancy grid functions
+ *
+ * A fixed size grid of voxels around the vehicle that remembers the depth
+ * of the last frames, so an obstacle that leaves the view of the camera
+ * during a dodge is still known
+ *
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "occupancy_grid.h"
+
+#include <math.h>
+#include <string.h>
+#include <limits.h>
+#include <algorithm>
+
+static_assert(OCCUPANCY_CELLS * sizeof(int8_t) <= OCCUPANCY_MAX_BYTES,
+              "occupancy grid is over its memory cap");
+
+static const int occupancy_size[3] = { OCCUPANCY_SIZE_XY, OCCUPANCY_SIZE_XY, OCCUPANCY_SIZE_Z };
+
+
+// ----------------------------------------------------------------------------------
+//   Occupancy Grid Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Occupancy_Grid::
+Occupancy_Grid(float fx, float fy, float cx, float cy, float depth_to_meters_)
+{
+	focal_x         = fx;
+	focal_y         = fy;
+	center_x        = cx;
+	center_y        = cy;
+	depth_to_meters = depth_to_meters_;
+
+	cells   = new int8_t[OCCUPANCY_CELLS];
+	changes = new int[3 * OCCUPANCY_MAX_CHANGES];
+	clear();
+
+	memset(camera_to_ned, 0, sizeof(camera_to_ned));
+}
+
+Occupancy_Grid::
+~Occupancy_Grid()
+{
+	delete[] cells;
+	delete[] changes;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Clear
+// ------------------------------------------------------------------------------
+void
+Occupancy_Grid::
+clear()
+{
+	memset(cells, 0, OCCUPANCY_CELLS);
+	origin[0] = origin[1] = origin[2] = 0;
+	position[0] = position[1] = position[2] = 0;
+	placed = false;
+	clear_changes();
+}
+
+// Called by whoever has read the log
+void
+Occupancy_Grid::
+clear_changes()
+{
+	num_changes        = 0;
+	changes_overflowed = false;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Begin Frame
+// ------------------------------------------------------------------------------
+/*
+ * The camera looks along the body x axis with the image x to the body y,
+ * so a pixel is the body ray (1, (x - cx) / fx, (y - cy) / fy), which
+ * Rz(yaw) Ry(pitch) Rx(roll) turns into the local frame.
+ */
+void
+Occupancy_Grid::
+begin_frame(const mavlink_local_position_ned_t &vehicle, const mavlink_attitude_t &attitude)
+{
+	position[0] = vehicle.x;
+	position[1] = vehicle.y;
+	position[2] = vehicle.z;
+	recenter();
+
+	float cr = cosf(attitude.roll),  sr = sinf(attitude.roll);
+	float cp = cosf(attitude.pitch), sp = sinf(attitude.pitch);
+	float cy = cosf(attitude.yaw),   sy = sinf(attitude.yaw);
+
+	camera_to_ned[0][0] = cy * cp;
+	camera_to_ned[0][1] = cy * sp * sr - sy * cr;
+	camera_to_ned[0][2] = cy * sp * cr + sy * sr;
+	camera_to_ned[1][0] = sy * cp;
+	camera_to_ned[1][1] = sy * sp * sr + cy * cr;
+	camera_to_ned[1][2] = sy * sp * cr - cy * sr;
+	camera_to_ned[2][0] = -sp;
+	camera_to_ned[2][1] = cp * sr;
+	camera_to_ned[2][2] = cp * cr;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Add Depth
+// ------------------------------------------------------------------------------
+// The depth of pixel (x, y), in the units of the camera. Too far clears the
+// voxels up to OCCUPANCY_MAX_RANGE, too close and unknown depths are skipped
+void
+Occupancy_Grid::
+add_depth(int x, int y, float depth)
+{
+	if ( not placed || isnan(depth) || depth <= 0 )
+		return;
+
+	float ray[3] = { 1, (x - center_x) / focal_x, (y - center_y) / focal_y };
+
+	// depth is along the optical axis, not along the ray
+	float range = isinf(depth) ? (float) OCCUPANCY_MAX_RANGE : depth * depth_to_meters;
+	float length = range * sqrtf(ray[0] * ray[0] + ray[1] * ray[1] + ray[2] * ray[2]);
+	bool  hit = length <= OCCUPANCY_MAX_RANGE;
+	float scale = hit ? range : range * (float) OCCUPANCY_MAX_RANGE / length;
+
+	float end[3];
+	for ( int a = 0; a < 3; a++ )
+		end[a] = position[a] + scale * (camera_to_ned[a][0] * ray[0] +
+		                                camera_to_ned[a][1] * ray[1] +
+		                                camera_to_ned[a][2] * ray[2]);
+
+	cast(end, hit);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Queries
+// ------------------------------------------------------------------------------
+int8_t
+Occupancy_Grid::
+log_odds(float north, float east, float down) const
+{
+	int8_t *voxel = cell((int) floorf(north / OCCUPANCY_RESOLUTION),
+	                     (int) floorf(east  / OCCUPANCY_RESOLUTION),
+	                     (int) floorf(down  / OCCUPANCY_RESOLUTION));
+	return voxel ? *voxel : 0;
+}
+
+bool
+Occupancy_Grid::
+occupied(float north, float east, float down) const
+{
+	return log_odds(north, east, down) >= OCCUPANCY_OCCUPIED;
+}
+
+// Local voxel (i, j, k), false outside the window
+bool
+Occupancy_Grid::
+occupied_voxel(int i, int j, int k) const
+{
+	int8_t *voxel = cell(i, j, k);
+	return voxel && *voxel >= OCCUPANCY_OCCUPIED;
+}
+
+void
+Occupancy_Grid::
+window(int lowest[3], int highest[3]) const
+{
+	for ( int a = 0; a < 3; a++ )
+	{
+		lowest[a]  = origin[a];
+		highest[a] = origin[a] + occupancy_size[a] - 1;
+	}
+}
+
+/*
+ * Distance from the vehicle along the direction (north, east, down) to the
+ * first occupied voxel within radius of the line, max_distance if there
+ * is none. The line is sampled every half voxel and the voxels within a
+ * sphere of reach around each sample are checked, the corners of the box
+ * around it are farther than the radius.
+ */
+float
+Occupancy_Grid::
+clearance(float north, float east, float down, float max_distance, float radius) const
+{
+	float length = sqrtf(north * north + east * east + down * down);
+	if ( not placed || length < 1e-6 )
+		return max_distance;
+
+	float direction[3] = { north / length, east / length, down / length };
+	int   reach  = (int) ceilf(radius / OCCUPANCY_RESOLUTION);
+	int   reach2 = reach * reach;
+	float step   = OCCUPANCY_RESOLUTION / 2;
+
+	int last[3] = { INT_MIN, INT_MIN, INT_MIN };
+	for ( float s = 0; s <= max_distance; s += step )
+	{
+		int center[3];
+		for ( int a = 0; a < 3; a++ )
+			center[a] = (int) floorf((position[a] + direction[a] * s) / OCCUPANCY_RESOLUTION);
+
+		// half voxel steps land in the same voxel every other time
+		if ( center[0] == last[0] && center[1] == last[1] && center[2] == last[2] )
+			continue;
+		memcpy(last, center, sizeof(last));
+
+		for ( int i = -reach; i <= reach; i++ )
+			for ( int j = -reach; j <= reach; j++ )
+				for ( int k = -reach; k <= reach; k++ )
+				{
+					if ( i * i + j * j + k * k > reach2 )
+						continue;
+					int8_t *voxel = cell(center[0] + i, center[1] + j, center[2] + k);
+					if ( voxel && *voxel >= OCCUPANCY_OCCUPIED )
+						return s;
+				}
+	}
+
+	return max_distance;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Recenter
+// ------------------------------------------------------------------------------
+// Moves the window to be centered on position, clearing the voxels that
+// come into it (their slots still hold the voxels that left). Neither is
+// logged as a change, the ones that left are no longer known
+void
+Occupancy_Grid::
+recenter()
+{
+	int wanted[3];
+	for ( int a = 0; a < 3; a++ )
+		wanted[a] = (int) floorf(position[a] / OCCUPANCY_RESOLUTION) - occupancy_size[a] / 2;
+
+	if ( not placed )
+	{
+		memset(cells, 0, OCCUPANCY_CELLS);
+		memcpy(origin, wanted, sizeof(origin));
+		placed = true;
+		return;
+	}
+
+	for ( int a = 0; a < 3; a++ )
+	{
+		int shift = wanted[a] - origin[a];
+		if ( shift >= occupancy_size[a] || -shift >= occupancy_size[a] )
+		{
+			memset(cells, 0, OCCUPANCY_CELLS);
+			memcpy(origin, wanted, sizeof(origin));
+			return;
+		}
+
+		if ( shift > 0 )
+			clear_slab(a, origin[a] + occupancy_size[a], shift);
+		else if ( shift < 0 )
+			clear_slab(a, wanted[a], -shift);
+		origin[a] = wanted[a];
+	}
+}
+
+void
+Occupancy_Grid::
+clear_slab(int axis, int first, int count)
+{
+	for ( int n = first; n < first + count; n++ )
+	{
+		int slot = n & (occupancy_size[axis] - 1);
+		for ( int u = 0; u < occupancy_size[axis == 0 ? 1 : 0]; u++ )
+			for ( int v = 0; v < occupancy_size[axis == 2 ? 1 : 2]; v++ )
+			{
+				int index[3];
+				index[axis] = slot;
+				index[axis == 0 ? 1 : 0] = u;
+				index[axis == 2 ? 1 : 2] = v;
+				cells[((index[0] << OCCUPANCY_SIZE_XY_BITS) + index[1]) * OCCUPANCY_SIZE_Z + index[2]] = 0;
+			}
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Cell
+// ------------------------------------------------------------------------------
+// The voxel of local voxel (i, j, k), NULL outside the window
+int8_t*
+Occupancy_Grid::
+cell(int i, int j, int k) const
+{
+	if ( (unsigned) (i - origin[0]) >= OCCUPANCY_SIZE_XY ||
+	     (unsigned) (j - origin[1]) >= OCCUPANCY_SIZE_XY ||
+	     (unsigned) (k - origin[2]) >= OCCUPANCY_SIZE_Z )
+		return NULL;
+
+	int index = (((i & (OCCUPANCY_SIZE_XY - 1)) << OCCUPANCY_SIZE_XY_BITS) + (j & (OCCUPANCY_SIZE_XY - 1)))
+	            * OCCUPANCY_SIZE_Z + (k & (OCCUPANCY_SIZE_Z - 1));
+	return cells + index;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Cast
+// ------------------------------------------------------------------------------
+/*
+ * Walks the voxels from the vehicle to end (Amanatides and Woo), adding a
+ * miss to each one before the last, and a hit to the last if hit is set.
+ * Stops where the ray leaves the window.
+ */
+void
+Occupancy_Grid::
+cast(const float end[3], bool hit)
+{
+	int   voxel[3], last[3], step[3];
+	float t_max[3], t_delta[3];
+
+	for ( int a = 0; a < 3; a++ )
+	{
+		float from = position[a] / OCCUPANCY_RESOLUTION;
+		float to   = end[a]      / OCCUPANCY_RESOLUTION;
+		float d    = to - from;
+
+		voxel[a] = (int) floorf(from);
+		last[a]  = (int) floorf(to);
+		step[a]  = d > 0 ? 1 : -1;
+
+		if ( fabsf(d) < 1e-9 )
+		{
+			t_max[a]   = INFINITY;
+			t_delta[a] = INFINITY;
+		}
+		else
+		{
+			float boundary = d > 0 ? voxel[a] + 1 : voxel[a];
+			t_max[a]   = (boundary - from) / d;
+			t_delta[a] = 1 / fabsf(d);
+		}
+	}
+
+	int steps = abs(last[0] - voxel[0]) + abs(last[1] - voxel[1]) + abs(last[2] - voxel[2]);
+	for ( int n = 0; n < steps; n++ )
+	{
+		int8_t *free_voxel = cell(voxel[0], voxel[1], voxel[2]);
+		if ( not free_voxel )
+			return;
+		update(free_voxel, voxel, -OCCUPANCY_MISS);
+
+		int a = t_max[0] < t_max[1] ? (t_max[0] < t_max[2] ? 0 : 2) : (t_max[1] < t_max[2] ? 1 : 2);
+		voxel[a] += step[a];
+		t_max[a] += t_delta[a];
+	}
+
+	if ( not hit )
+		return;
+
+	int8_t *hit_voxel = cell(last[0], last[1], last[2]);
+	if ( hit_voxel )
+		update(hit_voxel, last, OCCUPANCY_HIT);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Update
+// ------------------------------------------------------------------------------
+// Adds to the log-odds of a voxel, and logs it if it became occupied or free
+void
+Occupancy_Grid::
+update(int8_t *voxel, const int index[3], int delta)
+{
+	int before = *voxel;
+	int after  = std::min(std::max(before + delta, OCCUPANCY_MIN), OCCUPANCY_MAX);
+	*voxel = (int8_t) after;
+
+	if ( (before >= OCCUPANCY_OCCUPIED) == (after >= OCCUPANCY_OCCUPIED) )
+		return;
+
+	if ( num_changes == OCCUPANCY_MAX_CHANGES )
+	{
+		changes_overflowed = true;
+		return;
+	}
+	memcpy(changes + 3 * num_changes, index, 3 * sizeof(int));
+	num_changes++;
+}
@@ -0,0 +1,142 @@
+/**
+ * @file occupancy_grid.h
+ *
+ * @brief Occupancy grid definition
+ *
+ * A fixed size grid of voxels around the vehicle that remembers the depth
+ * of the last frames, so an obstacle that leaves the view of the camera
+ * during a dodge is still known
+ *
+ */
+
+#ifndef OCCUPANCY_GRID_H_
+#define OCCUPANCY_GRID_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <stdio.h>
+#include <stdint.h>
+
+#include <common/mavlink.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// Size of a voxel, in meters like LOCAL_POSITION_NED
+#define OCCUPANCY_RESOLUTION 0.25
+
+// Voxels along north and east, and along down, powers of two so the ring
+// index is a mask. 64 x 64 x 32 is 16 x 16 x 8 meters
+#define OCCUPANCY_SIZE_XY_BITS 6
+#define OCCUPANCY_SIZE_Z_BITS  5
+#define OCCUPANCY_SIZE_XY (1 << OCCUPANCY_SIZE_XY_BITS)
+#define OCCUPANCY_SIZE_Z  (1 << OCCUPANCY_SIZE_Z_BITS)
+#define OCCUPANCY_CELLS   (OCCUPANCY_SIZE_XY * OCCUPANCY_SIZE_XY * OCCUPANCY_SIZE_Z)
+
+// The grid is one byte per voxel and never grows past this
+#define OCCUPANCY_MAX_BYTES (256 * 1024)
+
+// Farther depths only clear the voxels up to this, in meters
+#define OCCUPANCY_MAX_RANGE 8.0
+
+// Log-odds of each voxel, in steps of about 0.1. A hit outweighs a few
+// misses, and the clamps keep a voxel able to change its mind in a few frames
+#define OCCUPANCY_HIT       8
+#define OCCUPANCY_MISS      2
+#define OCCUPANCY_MIN     -24
+#define OCCUPANCY_MAX      48
+#define OCCUPANCY_OCCUPIED 12
+
+// Voxels that became occupied or free kept for the planner between frames
+#define OCCUPANCY_MAX_CHANGES 4096
+
+
+// ----------------------------------------------------------------------------------
+//   Occupancy Grid Class
+// ----------------------------------------------------------------------------------
+/*
+ * Occupancy Grid Class
+ *
+ * The axes are north, east and down like LOCAL_POSITION_NED, so the grid
+ * does not have to be rotated when the vehicle turns, only moved. The
+ * window is kept centered on the vehicle. Voxel (i, j, k) of the local
+ * frame is stored at (i, j, k) masked to the size of the grid, so moving
+ * the window only clears the slabs of voxels that came into it, nothing
+ * is copied.
+ *
+ * Each frame begin_frame() is given the position and attitude of the
+ * vehicle at its capture, then add_depth() is called for a decimated set
+ * of pixels. Each depth adds a hit to the voxel it falls in and a miss to
+ * the voxels on the way to it. Voxels never seen are unknown (0), which
+ * counts as free.
+ *
+ * clearance() walks a direction from the vehicle and checks the voxels
+ * within a radius of it. Every voxel the line enters costs a sphere of
+ * lookups, 33 at a 0.5 m radius, so the 5 m the avoidance checks comes to
+ * about 700 (along an axis) to 1400 (diagonal) lookups per call.
+ *
+ * Every voxel that crosses OCCUPANCY_OCCUPIED is logged, so a planner can
+ * repair only what changed. Whoever reads the log calls clear_changes(),
+ * if it filled up changes_overflowed is set and the window has to be read
+ * again as a whole.
+ */
+class Occupancy_Grid
+{
+
+public:
+
+	Occupancy_Grid(float fx, float fy, float cx, float cy, float depth_to_meters_);
+	~Occupancy_Grid();
+
+	void clear();
+
+	void begin_frame(const mavlink_local_position_ned_t &position, const mavlink_attitude_t &attitude);
+	void add_depth(int x, int y, float depth);
+
+	int8_t log_odds(float north, float east, float down) const;
+	bool   occupied(float north, float east, float down) const;
+	bool   occupied_voxel(int i, int j, int k) const;
+	float  clearance(float north, float east, float down, float max_distance, float radius) const;
+
+	// local voxels of the window, inclusive
+	void window(int lowest[3], int highest[3]) const;
+
+	// voxels that became occupied or free, local voxel n is change(n)[0..2]
+	int  num_changes;
+	bool changes_overflowed;
+	const int* change(int n) const { return changes + 3 * n; }
+	void clear_changes();
+
+	// of the vehicle at the last begin_frame(), in meters
+	float position[3];
+
+private:
+
+	int8_t *cells;
+	int    *changes;     // i j k of each voxel logged
+	int     origin[3];   // local voxel at the lowest corner of the window
+	bool    placed;
+
+	float focal_x;       // camera intrinsics, in pixels
+	float focal_y;
+	float center_x;
+	float center_y;
+	float depth_to_meters;
+
+	float camera_to_ned[3][3];
+
+	void recenter();
+	void clear_slab(int axis, int first, int count);
+	int8_t* cell(int i, int j, int k) const;
+	void cast(const float end[3], bool hit);
+	void update(int8_t *voxel, const int index[3], int delta);
+
+};
+
+
+#endif // OCCUPANCY_GRID_H_
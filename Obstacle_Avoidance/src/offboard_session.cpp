@@ -0,0 +1,189 @@
+/**
+ * @file offboard_session.cpp
+ *
+ * @brief Offboard session functions
+ *
+ * Keeps the autopilot in offboard mode for the whole flight and only pushes
+ * new setpoints each frame
+ *
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "offboard_session.h"
+
+
+// ----------------------------------------------------------------------------------
+//   Offboard Session Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Offboard_Session::
+Offboard_Session(Autopilot_Interface *api_)
+{
+	api = api_;
+
+	session_state       = OFFBOARD_IDLE;
+	requests            = 0;
+	last_request_usec   = 0;
+	last_heartbeat_usec = 0;
+}
+
+Offboard_Session::
+~Offboard_Session()
+{}
+
+
+// ------------------------------------------------------------------------------
+//   Begin Session
+// ------------------------------------------------------------------------------
+void
+Offboard_Session::
+begin()
+{
+	if ( session_state != OFFBOARD_IDLE )
+		return;
+
+	printf("BEGIN OFFBOARD SESSION\n");
+
+	requests = 0;
+	_request();
+	session_state = OFFBOARD_REQUESTED;
+}
+
+
+// ------------------------------------------------------------------------------
+//   End Session
+// ------------------------------------------------------------------------------
+void
+Offboard_Session::
+end()
+{
+	if ( session_state == OFFBOARD_IDLE )
+		return;
+
+	printf("END OFFBOARD SESSION\n");
+
+	api->disable_offboard_control();
+	session_state = OFFBOARD_IDLE;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Follow Mode From Heartbeats
+// ------------------------------------------------------------------------------
+void
+Offboard_Session::
+check_state()
+{
+	if ( session_state == OFFBOARD_IDLE )
+		return;
+
+	// only look at heartbeats that have not been seen yet
+	mavlink_heartbeat_t heartbeat;
+	uint64_t heartbeat_usec = api->current_messages.heartbeat.read(heartbeat);
+	if ( heartbeat_usec == last_heartbeat_usec )
+	{
+		// nothing new, but keep asking while the first request is unanswered
+		if ( session_state == OFFBOARD_REQUESTED &&
+		     get_monotonic_usec() - last_request_usec > OFFBOARD_RETRY_USEC )
+			_request();
+		return;
+	}
+	last_heartbeat_usec = heartbeat_usec;
+
+	bool offboard = _heartbeat_in_offboard(heartbeat);
+
+	switch (session_state)
+	{
+		case OFFBOARD_REQUESTED:
+		{
+			if ( offboard )
+			{
+				printf("OFFBOARD MODE CONFIRMED\n");
+				session_state = OFFBOARD_ACTIVE;
+			}
+			else if ( get_monotonic_usec() - last_request_usec > OFFBOARD_RETRY_USEC )
+				_request();
+			break;
+		}
+
+		case OFFBOARD_ACTIVE:
+		{
+			if ( not offboard )
+			{
+				fprintf(stderr,"WARNING: autopilot left offboard mode (custom mode %u)\n", heartbeat.custom_mode);
+				session_state = OFFBOARD_LOST;
+			}
+			break;
+		}
+
+		case OFFBOARD_LOST:
+		{
+			if ( offboard )
+			{
+				printf("OFFBOARD MODE RESUMED\n");
+				session_state = OFFBOARD_ACTIVE;
+			}
+			break;
+		}
+
+		default:
+			break;
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Update Setpoint
+// ------------------------------------------------------------------------------
+void
+Offboard_Session::
+update(const mavlink_set_position_target_local_ned_t &setpoint)
+{
+	api->update_setpoint(setpoint);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Send Offboard Request
+// ------------------------------------------------------------------------------
+void
+Offboard_Session::
+_request()
+{
+	if ( requests >= OFFBOARD_MAX_REQUESTS )
+		return;
+
+	// the interface only sends the command when it thinks it is not in control
+	api->control_status = false;
+	api->enable_offboard_control();
+
+	requests++;
+	last_request_usec = get_monotonic_usec();
+
+	if ( requests == OFFBOARD_MAX_REQUESTS )
+		fprintf(stderr,"WARNING: sent the last offboard request (%d), waiting on the autopilot\n", requests);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Decode Mode
+// ------------------------------------------------------------------------------
+bool
+Offboard_Session::
+_heartbeat_in_offboard(const mavlink_heartbeat_t &heartbeat) const
+{
+	if ( not (heartbeat.base_mode & MAV_MODE_FLAG_CUSTOM_MODE_ENABLED) )
+		return false;
+
+	if ( heartbeat.autopilot == MAV_AUTOPILOT_PX4 )
+		return ((heartbeat.custom_mode >> 16) & 0xFF) == PX4_CUSTOM_MAIN_MODE_OFFBOARD;
+
+	return heartbeat.custom_mode == ARDUCOPTER_MODE_GUIDED;
+}
@@ -0,0 +1,96 @@
+/**
+ * @file offboard_session.h
+ *
+ * @brief Offboard session definition
+ *
+ * Keeps the autopilot in offboard mode for the whole flight and only pushes
+ * new setpoints each frame
+ *
+ */
+
+#ifndef OFFBOARD_SESSION_H_
+#define OFFBOARD_SESSION_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "autopilot_interface.h"
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// PX4 puts its main mode in the third byte of the heartbeat custom_mode
+#define PX4_CUSTOM_MAIN_MODE_OFFBOARD 6
+
+// ArduCopter custom_mode for GUIDED
+#define ARDUCOPTER_MODE_GUIDED 4
+
+// How long to wait for a heartbeat to show offboard mode before asking again
+#define OFFBOARD_RETRY_USEC 1000000
+
+// Give up asking after this many requests
+#define OFFBOARD_MAX_REQUESTS 5
+
+enum Offboard_State
+{
+	OFFBOARD_IDLE = 0,   // never requested, or ended
+	OFFBOARD_REQUESTED,  // command sent, waiting for a heartbeat to confirm
+	OFFBOARD_ACTIVE,     // heartbeat confirms offboard mode
+	OFFBOARD_LOST        // was active, but the autopilot switched out of it
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Offboard Session Class
+// ----------------------------------------------------------------------------------
+/*
+ * Offboard Session Class
+ *
+ * begin() sends the offboard command once. After that the mode of the
+ * autopilot is followed from its heartbeats in check_state(), which only
+ * looks at the messages the event loop already received. The command is
+ * only sent again while waiting for the first confirmation. If the
+ * autopilot leaves offboard mode after it was confirmed (the pilot took
+ * over), the session reports it and does not try to take control back.
+ *
+ * update() only hands the setpoint to the event loop, so the per-frame
+ * path does no serial transactions of its own.
+ */
+class Offboard_Session
+{
+
+public:
+
+	Offboard_Session(Autopilot_Interface *api_);
+	~Offboard_Session();
+
+	void begin();
+	void end();
+
+	void check_state();
+	void update(const mavlink_set_position_target_local_ned_t &setpoint);
+
+	Offboard_State state() const { return session_state; }
+	bool active() const { return session_state == OFFBOARD_ACTIVE; }
+
+	const mavlink_set_position_target_local_ned_t& initial_position() const { return api->initial_position; }
+
+private:
+
+	Autopilot_Interface *api;
+
+	Offboard_State session_state;
+	int            requests;
+	uint64_t       last_request_usec;
+	uint64_t       last_heartbeat_usec;
+
+	void _request();
+	bool _heartbeat_in_offboard(const mavlink_heartbeat_t &heartbeat) const;
+
+};
+
+
+#endif // OFFBOARD_SESSION_H_
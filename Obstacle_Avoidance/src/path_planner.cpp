@@ -0,0 +1,621 @@
+/**
+ * @file path_planner.cpp
+ *
+ * @brief Path planner functions
+ *
+ * D* Lite over the voxels of the Occupancy_Grid, from the vehicle to a
+ * goal in the local frame. The plan is repaired where the grid changed
+ * instead of being searched again every frame
+ *
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "path_planner.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+static const int   planner_size[3] = { PLANNER_SIZE_XY, PLANNER_SIZE_XY, PLANNER_SIZE_Z };
+static const float node_meters     = PLANNER_BLOCK * OCCUPANCY_RESOLUTION;
+
+// Rounds towards minus infinity, the voxels can be negative
+static int
+floor_div(int a, int b)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static float
+add_cost(float a, float b)
+{
+	return ( a >= PLANNER_INFINITY || b >= PLANNER_INFINITY ) ? PLANNER_INFINITY : a + b;
+}
+
+
+// ----------------------------------------------------------------------------------
+//   Path Planner Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Path_Planner::
+Path_Planner(Occupancy_Grid *grid_)
+{
+	grid = grid_;
+
+	g          = new float[PLANNER_NODES];
+	rhs        = new float[PLANNER_NODES];
+	blocked    = new uint8_t[PLANNER_NODES];
+	heap       = new int[PLANNER_NODES];
+	heap_index = new int[PLANNER_NODES];
+	keys       = new Planner_Key[PLANNER_NODES];
+	dirty      = new int[PLANNER_NODES];
+	is_dirty   = new uint8_t[PLANNER_NODES];
+
+	goal_set   = false;
+	goal = start = last_start = 0;
+	km         = 0;
+	heap_size  = 0;
+	dirty_head = dirty_count = 0;
+	expansions = repairs = 0;
+	consistent = false;
+	memset(origin, 0, sizeof(origin));
+	memset(goal_position, 0, sizeof(goal_position));
+}
+
+Path_Planner::
+~Path_Planner()
+{
+	delete[] g;
+	delete[] rhs;
+	delete[] blocked;
+	delete[] heap;
+	delete[] heap_index;
+	delete[] keys;
+	delete[] dirty;
+	delete[] is_dirty;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Set Goal
+// ------------------------------------------------------------------------------
+// Starts over with a lattice between start and goal. A goal off the
+// lattice is planned to the nearest node of it
+void
+Path_Planner::
+set_goal(const float start_position[3], const float goal_position_[3])
+{
+	for ( int a = 0; a < 3; a++ )
+	{
+		goal_position[a] = goal_position_[a];
+		float middle = (start_position[a] + goal_position[a]) / 2;
+		origin[a] = (int) floorf(middle / OCCUPANCY_RESOLUTION) - PLANNER_BLOCK * planner_size[a] / 2;
+	}
+
+	for ( int n = 0; n < PLANNER_NODES; n++ )
+	{
+		g[n]          = PLANNER_INFINITY;
+		rhs[n]        = PLANNER_INFINITY;
+		blocked[n]    = 0;
+		heap_index[n] = -1;
+		is_dirty[n]   = 0;
+	}
+	heap_size   = 0;
+	dirty_head  = 0;
+	dirty_count = 0;
+
+	goal  = node_of(goal_position);
+	start = last_start = node_of(start_position);
+	km    = 0;
+
+	float center[3];
+	node_center(goal, center);
+	float off = sqrtf((center[0] - goal_position[0]) * (center[0] - goal_position[0]) +
+	                  (center[1] - goal_position[1]) * (center[1] - goal_position[1]) +
+	                  (center[2] - goal_position[2]) * (center[2] - goal_position[2]));
+	if ( off > node_meters )
+		fprintf(stderr,"WARNING: goal is %.1f m off the planner lattice, planning to its edge\n", off);
+
+	rhs[goal] = 0;
+	heap_push(goal, calculate_key(goal));
+
+	// everything the grid knows so far
+	int lowest[3], highest[3];
+	grid->window(lowest, highest);
+	mark_dirty(lowest, highest);
+	grid->clear_changes();
+
+	goal_set   = true;
+	consistent = false;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Update
+// ------------------------------------------------------------------------------
+void
+Path_Planner::
+update(const float position[3])
+{
+	if ( not goal_set )
+		return;
+
+	read_changes();
+
+	// the keys in the queue were for the last start, km keeps them lower bounds
+	int now = node_of(position);
+	if ( now != start )
+	{
+		km += heuristic(last_start, now);
+		last_start = now;
+		start      = now;
+	}
+
+	repairs = 0;
+	while ( dirty_count and repairs < PLANNER_MAX_REPAIRS )
+	{
+		int node = dirty[dirty_head];
+		dirty_head = (dirty_head + 1) % PLANNER_NODES;
+		dirty_count--;
+		is_dirty[node] = 0;
+
+		repair(node);
+		repairs++;
+	}
+
+	compute_shortest_path();
+}
+
+
+// ------------------------------------------------------------------------------
+//   Path
+// ------------------------------------------------------------------------------
+bool
+Path_Planner::
+has_path() const
+{
+	// the search can stop with the start still queued, its rhs is already right
+	return goal_set && consistent && not dirty_count && rhs[start] < PLANNER_INFINITY;
+}
+
+bool
+Path_Planner::
+arrived(const float position[3]) const
+{
+	if ( not goal_set )
+		return false;
+
+	float d[3] = { goal_position[0] - position[0], goal_position[1] - position[1], goal_position[2] - position[2] };
+	return sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]) < PLANNER_GOAL_RADIUS;
+}
+
+// Unit direction in the local frame towards a node PLANNER_LOOKAHEAD along
+// the path, false while there is no path
+bool
+Path_Planner::
+direction(const float position[3], float dir[3]) const
+{
+	if ( not has_path() || arrived(position) )
+		return false;
+
+	int   nodes[26];
+	float lengths[26];
+
+	int  node = start;
+	bool at_goal = false;
+	for ( int step = 0; step < PLANNER_LOOKAHEAD && not at_goal; step++ )
+	{
+		int count = neighbors(node, nodes, lengths);
+		int best = -1;
+		float best_cost = PLANNER_INFINITY;
+		for ( int i = 0; i < count; i++ )
+		{
+			float through = add_cost(cost(nodes[i], lengths[i]), g[nodes[i]]);
+			if ( through < best_cost )
+			{
+				best_cost = through;
+				best = nodes[i];
+			}
+		}
+		if ( best < 0 )
+			return false;
+		node = best;
+		at_goal = (node == goal);
+	}
+
+	float target[3];
+	if ( at_goal )
+		memcpy(target, goal_position, sizeof(target));
+	else
+		node_center(node, target);
+
+	float length = 0;
+	for ( int a = 0; a < 3; a++ )
+	{
+		dir[a] = target[a] - position[a];
+		length += dir[a] * dir[a];
+	}
+	length = sqrtf(length);
+	if ( length < 1e-3 )
+		return false;
+
+	for ( int a = 0; a < 3; a++ )
+		dir[a] /= length;
+	return true;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - D* Lite
+// ------------------------------------------------------------------------------
+Planner_Key
+Path_Planner::
+calculate_key(int node) const
+{
+	float best = std::min(g[node], rhs[node]);
+	Planner_Key key;
+	if ( best >= PLANNER_INFINITY )
+	{
+		key.k1 = PLANNER_INFINITY;
+		key.k2 = PLANNER_INFINITY;
+		return key;
+	}
+	key.k1 = best + heuristic(start, node) + km;
+	key.k2 = best;
+	return key;
+}
+
+void
+Path_Planner::
+update_vertex(int node)
+{
+	if ( g[node] != rhs[node] )
+	{
+		if ( heap_index[node] >= 0 )
+			heap_update(node, calculate_key(node));
+		else
+			heap_push(node, calculate_key(node));
+	}
+	else if ( heap_index[node] >= 0 )
+		heap_remove(node);
+}
+
+// Stops when the start is consistent, or after PLANNER_MAX_EXPANSIONS
+void
+Path_Planner::
+compute_shortest_path()
+{
+	int   nodes[26];
+	float lengths[26];
+
+	expansions = 0;
+	consistent = false;
+
+	while ( true )
+	{
+		Planner_Key start_key = calculate_key(start);
+		if ( not heap_size || not (keys[heap[0]] < start_key || rhs[start] > g[start]) )
+		{
+			consistent = true;
+			return;
+		}
+		if ( expansions >= PLANNER_MAX_EXPANSIONS )
+			return;
+		expansions++;
+
+		int u = heap[0];
+		Planner_Key old_key = keys[u];
+		Planner_Key new_key = calculate_key(u);
+		int count = neighbors(u, nodes, lengths);
+
+		if ( old_key < new_key )
+			heap_update(u, new_key);
+		else if ( g[u] > rhs[u] )
+		{
+			g[u] = rhs[u];
+			heap_remove(u);
+			for ( int i = 0; i < count; i++ )
+			{
+				int s = nodes[i];
+				if ( s == goal )
+					continue;
+				rhs[s] = std::min(rhs[s], add_cost(cost(u, lengths[i]), g[u]));
+				update_vertex(s);
+			}
+		}
+		else
+		{
+			float old_g = g[u];
+			g[u] = PLANNER_INFINITY;
+			for ( int i = 0; i < count; i++ )
+			{
+				int s = nodes[i];
+				if ( s == goal || rhs[s] != add_cost(cost(u, lengths[i]), old_g) )
+					continue;
+				rhs[s] = lowest_rhs(s);
+				update_vertex(s);
+			}
+			if ( u != goal )
+				rhs[u] = lowest_rhs(u);
+			update_vertex(u);
+		}
+	}
+}
+
+float
+Path_Planner::
+lowest_rhs(int node) const
+{
+	int   nodes[26];
+	float lengths[26];
+	int count = neighbors(node, nodes, lengths);
+
+	float best = PLANNER_INFINITY;
+	for ( int i = 0; i < count; i++ )
+		best = std::min(best, add_cost(cost(nodes[i], lengths[i]), g[nodes[i]]));
+	return best;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Changes
+// ------------------------------------------------------------------------------
+// Marks the nodes whose blocks hold the voxels the grid logged
+void
+Path_Planner::
+read_changes()
+{
+	if ( grid->changes_overflowed )
+	{
+		int lowest[3], highest[3];
+		grid->window(lowest, highest);
+		mark_dirty(lowest, highest);
+	}
+	else
+	{
+		for ( int n = 0; n < grid->num_changes; n++ )
+			mark_dirty(grid->change(n), grid->change(n));
+	}
+	grid->clear_changes();
+}
+
+// Every node with a voxel of the box (inclusive) in its grown block
+void
+Path_Planner::
+mark_dirty(const int lowest[3], const int highest[3])
+{
+	int from[3], to[3];
+	for ( int a = 0; a < 3; a++ )
+	{
+		from[a] = std::max(floor_div(lowest[a]  - origin[a] - PLANNER_INFLATE, PLANNER_BLOCK), 0);
+		to[a]   = std::min(floor_div(highest[a] - origin[a] + PLANNER_INFLATE, PLANNER_BLOCK), planner_size[a] - 1);
+	}
+
+	for ( int x = from[0]; x <= to[0]; x++ )
+		for ( int y = from[1]; y <= to[1]; y++ )
+			for ( int z = from[2]; z <= to[2]; z++ )
+			{
+				int node = (x * PLANNER_SIZE_XY + y) * PLANNER_SIZE_Z + z;
+				if ( is_dirty[node] )
+					continue;
+				is_dirty[node] = 1;
+				dirty[(dirty_head + dirty_count) % PLANNER_NODES] = node;
+				dirty_count++;
+			}
+}
+
+// Only a node that changed state changes the costs around it
+void
+Path_Planner::
+repair(int node)
+{
+	bool now = check_blocked(node);
+	if ( now == (bool) blocked[node] )
+		return;
+	blocked[node] = now;
+
+	int   nodes[26];
+	float lengths[26];
+	int count = neighbors(node, nodes, lengths);
+	for ( int i = 0; i < count; i++ )
+	{
+		if ( nodes[i] == goal )
+			continue;
+		rhs[nodes[i]] = lowest_rhs(nodes[i]);
+		update_vertex(nodes[i]);
+	}
+	if ( node != goal )
+		rhs[node] = lowest_rhs(node);
+	update_vertex(node);
+}
+
+// Voxels outside the window of the grid count as free
+bool
+Path_Planner::
+check_blocked(int node) const
+{
+	int x = node / (PLANNER_SIZE_XY * PLANNER_SIZE_Z);
+	int y = (node / PLANNER_SIZE_Z) % PLANNER_SIZE_XY;
+	int z = node % PLANNER_SIZE_Z;
+
+	int i0 = origin[0] + x * PLANNER_BLOCK - PLANNER_INFLATE;
+	int j0 = origin[1] + y * PLANNER_BLOCK - PLANNER_INFLATE;
+	int k0 = origin[2] + z * PLANNER_BLOCK - PLANNER_INFLATE;
+	int span = PLANNER_BLOCK + 2 * PLANNER_INFLATE;
+
+	for ( int i = i0; i < i0 + span; i++ )
+		for ( int j = j0; j < j0 + span; j++ )
+			for ( int k = k0; k < k0 + span; k++ )
+				if ( grid->occupied_voxel(i, j, k) )
+					return true;
+	return false;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Lattice
+// ------------------------------------------------------------------------------
+// The node a point falls in, the nearest one if it is off the lattice
+int
+Path_Planner::
+node_of(const float position[3]) const
+{
+	int n[3];
+	for ( int a = 0; a < 3; a++ )
+	{
+		int voxel = (int) floorf(position[a] / OCCUPANCY_RESOLUTION);
+		n[a] = std::min(std::max(floor_div(voxel - origin[a], PLANNER_BLOCK), 0), planner_size[a] - 1);
+	}
+	return (n[0] * PLANNER_SIZE_XY + n[1]) * PLANNER_SIZE_Z + n[2];
+}
+
+void
+Path_Planner::
+node_center(int node, float position[3]) const
+{
+	int n[3] = { node / (PLANNER_SIZE_XY * PLANNER_SIZE_Z),
+	             (node / PLANNER_SIZE_Z) % PLANNER_SIZE_XY,
+	             node % PLANNER_SIZE_Z };
+	for ( int a = 0; a < 3; a++ )
+		position[a] = (origin[a] + n[a] * PLANNER_BLOCK + PLANNER_BLOCK / 2.0f) * OCCUPANCY_RESOLUTION;
+}
+
+float
+Path_Planner::
+heuristic(int a, int b) const
+{
+	int dx = a / (PLANNER_SIZE_XY * PLANNER_SIZE_Z) - b / (PLANNER_SIZE_XY * PLANNER_SIZE_Z);
+	int dy = (a / PLANNER_SIZE_Z) % PLANNER_SIZE_XY - (b / PLANNER_SIZE_Z) % PLANNER_SIZE_XY;
+	int dz = a % PLANNER_SIZE_Z - b % PLANNER_SIZE_Z;
+	return sqrtf((float) (dx * dx + dy * dy + dz * dz)) * node_meters;
+}
+
+// Of an edge into node to. Only going into a blocked node costs, so a vehicle that drifted into one
+// can still leave it
+float
+Path_Planner::
+cost(int to, float length) const
+{
+	return blocked[to] ? PLANNER_INFINITY : length;
+}
+
+// The 26 nodes around node that are on the lattice, and how far each is
+int
+Path_Planner::
+neighbors(int node, int *nodes, float *lengths) const
+{
+	static const float diagonal[4] = { 0, node_meters, node_meters * (float) M_SQRT2, node_meters * 1.7320508f };
+
+	int x = node / (PLANNER_SIZE_XY * PLANNER_SIZE_Z);
+	int y = (node / PLANNER_SIZE_Z) % PLANNER_SIZE_XY;
+	int z = node % PLANNER_SIZE_Z;
+
+	int count = 0;
+	for ( int dx = -1; dx <= 1; dx++ )
+	{
+		if ( x + dx < 0 || x + dx >= PLANNER_SIZE_XY )
+			continue;
+		for ( int dy = -1; dy <= 1; dy++ )
+		{
+			if ( y + dy < 0 || y + dy >= PLANNER_SIZE_XY )
+				continue;
+			for ( int dz = -1; dz <= 1; dz++ )
+			{
+				if ( z + dz < 0 || z + dz >= PLANNER_SIZE_Z || (dx == 0 && dy == 0 && dz == 0) )
+					continue;
+				nodes[count]   = ((x + dx) * PLANNER_SIZE_XY + y + dy) * PLANNER_SIZE_Z + z + dz;
+				lengths[count] = diagonal[abs(dx) + abs(dy) + abs(dz)];
+				count++;
+			}
+		}
+	}
+	return count;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Helper Function - Heap
+// ------------------------------------------------------------------------------
+void
+Path_Planner::
+heap_push(int node, const Planner_Key &key)
+{
+	keys[node] = key;
+	heap[heap_size] = node;
+	heap_index[node] = heap_size;
+	heap_size++;
+	heap_up(heap_size - 1);
+}
+
+void
+Path_Planner::
+heap_update(int node, const Planner_Key &key)
+{
+	keys[node] = key;
+	heap_up(heap_index[node]);
+	heap_down(heap_index[node]);
+}
+
+void
+Path_Planner::
+heap_remove(int node)
+{
+	int position = heap_index[node];
+	heap_size--;
+	if ( position != heap_size )
+	{
+		heap_swap(position, heap_size);
+		heap_up(position);
+		heap_down(position);
+	}
+	heap_index[node] = -1;
+}
+
+void
+Path_Planner::
+heap_up(int position)
+{
+	while ( position > 0 )
+	{
+		int parent = (position - 1) / 2;
+		if ( not (keys[heap[position]] < keys[heap[parent]]) )
+			return;
+		heap_swap(position, parent);
+		position = parent;
+	}
+}
+
+void
+Path_Planner::
+heap_down(int position)
+{
+	while ( true )
+	{
+		int smallest = position;
+		int left = 2 * position + 1, right = left + 1;
+		if ( left < heap_size && keys[heap[left]] < keys[heap[smallest]] )
+			smallest = left;
+		if ( right < heap_size && keys[heap[right]] < keys[heap[smallest]] )
+			smallest = right;
+		if ( smallest == position )
+			return;
+		heap_swap(position, smallest);
+		position = smallest;
+	}
+}
+
+void
+Path_Planner::
+heap_swap(int a, int b)
+{
+	std::swap(heap[a], heap[b]);
+	heap_index[heap[a]] = a;
+	heap_index[heap[b]] = b;
+}
@@ -0,0 +1,175 @@
+/**
+ * @file path_planner.h
+ *
+ * @brief Path planner definition
+ *
+ * D* Lite over the voxels of the Occupancy_Grid, from the vehicle to a
+ * goal in the local frame. The plan is repaired where the grid changed
+ * instead of being searched again every frame
+ *
+ */
+
+#ifndef PATH_PLANNER_H_
+#define PATH_PLANNER_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "occupancy_grid.h"
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// A node is a block of voxels, 2 x 2 x 2 is 0.5 m
+#define PLANNER_BLOCK 2
+
+// Nodes along north and east, and along down, 32 x 32 x 8 m at 0.5 m
+#define PLANNER_SIZE_XY 64
+#define PLANNER_SIZE_Z  16
+#define PLANNER_NODES   (PLANNER_SIZE_XY * PLANNER_SIZE_XY * PLANNER_SIZE_Z)
+
+// Voxels around a node that also have to be free, for the size of the vehicle
+#define PLANNER_INFLATE 1
+
+// Work done in each update(), the rest carries over to the next frame
+#define PLANNER_MAX_EXPANSIONS 4000
+#define PLANNER_MAX_REPAIRS    2000
+
+// Nodes ahead on the path the direction is taken towards. The straight
+// line to a farther one can cut the corner of a blocked node
+#define PLANNER_LOOKAHEAD 1
+
+// Closer than this to the goal is there, in meters
+#define PLANNER_GOAL_RADIUS 0.5
+
+#define PLANNER_INFINITY 1e9f
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+// Priority of a node in the queue, compared first by k1
+
+struct Planner_Key {
+
+	float k1;  // min(g, rhs) + distance to the vehicle + km
+	float k2;  // min(g, rhs)
+
+	bool operator<(const Planner_Key &other) const
+	{
+		return k1 < other.k1 || (k1 == other.k1 && k2 < other.k2);
+	}
+
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Path Planner Class
+// ----------------------------------------------------------------------------------
+/*
+ * Path Planner Class
+ *
+ * set_goal() places a lattice of nodes in the local frame, centered
+ * between the vehicle and the goal, and starts a D* Lite search back from
+ * the goal. The lattice does not move with the vehicle, so the search
+ * stays valid the whole flight. A node is blocked when any voxel of its
+ * block (grown by PLANNER_INFLATE) is occupied. Nodes outside the window
+ * of the grid keep what was last seen of them, and nodes never seen are
+ * free.
+ *
+ * Each update() takes the voxels the grid logged as changed, repairs the
+ * nodes they fall in and the costs around them, moves the start to the
+ * vehicle (km grows by how far it moved), and expands the queue until the
+ * start is consistent again. Repairs and expansions are capped per call,
+ * whatever is left over is picked up by the next one, so a frame never
+ * waits on a search of the whole lattice. Until the search has caught up,
+ * has_path() is false and the caller falls back to what it did before.
+ *
+ * The nodes are 26-connected, the cost of an edge is its length in meters,
+ * or infinite into a blocked node, and the heuristic the straight distance.
+ */
+class Path_Planner
+{
+
+public:
+
+	Path_Planner(Occupancy_Grid *grid_);
+	~Path_Planner();
+
+	void set_goal(const float start[3], const float goal[3]);
+	void update(const float position[3]);
+
+	bool has_goal() const { return goal_set; }
+	bool has_path() const;
+	bool arrived(const float position[3]) const;
+	bool direction(const float position[3], float direction[3]) const;
+
+	// of the last update()
+	int  expansions;
+	int  repairs;
+	bool consistent;   // the start was reached within the budget
+
+	float goal_position[3];
+
+private:
+
+	Occupancy_Grid *grid;
+
+	bool goal_set;
+	int  origin[3];    // local voxel at the lowest corner of node 0
+	int  goal;
+	int  start;
+	int  last_start;
+	float km;
+
+	float   *g;
+	float   *rhs;
+	uint8_t *blocked;
+
+	// indexed binary heap of the inconsistent nodes
+	int         *heap;
+	int         *heap_index;  // -1 when not in the heap
+	Planner_Key *keys;
+	int          heap_size;
+
+	// nodes that have to be checked against the grid again
+	int     *dirty;
+	uint8_t *is_dirty;
+	int      dirty_head;
+	int      dirty_count;
+
+	int   node_of(const float position[3]) const;
+	void  node_center(int node, float position[3]) const;
+	float heuristic(int a, int b) const;
+	float cost(int to, float length) const;
+	int   neighbors(int node, int *nodes, float *lengths) const;
+	float lowest_rhs(int node) const;
+
+	Planner_Key calculate_key(int node) const;
+	void update_vertex(int node);
+	void compute_shortest_path();
+
+	void read_changes();
+	void mark_dirty(const int lowest[3], const int highest[3]);
+	void repair(int node);
+	bool check_blocked(int node) const;
+
+	void heap_push(int node, const Planner_Key &key);
+	void heap_update(int node, const Planner_Key &key);
+	void heap_remove(int node);
+	void heap_up(int position);
+	void heap_down(int position);
+	void heap_swap(int a, int b);
+
+};
+
+
+#endif // PATH_PLANNER_H_
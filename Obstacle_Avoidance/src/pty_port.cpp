@@ -0,0 +1,136 @@
+/**
+ * @file pty_port.cpp
+ *
+ * @brief Pseudo-terminal interface functions
+ *
+ * Talks MAVLink over a pseudo-terminal, so a simulated autopilot can open
+ * it like the serial port of a Pixhawk
+ *
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "pty_port.h"
+
+#include <string.h>
+
+
+// ----------------------------------------------------------------------------------
+//   PTY Port Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+PTY_Port::
+PTY_Port(const char *link_name_)
+{
+	initialize_defaults();
+	link_name = link_name_;
+}
+
+PTY_Port::
+PTY_Port()
+{
+	initialize_defaults();
+}
+
+PTY_Port::
+~PTY_Port()
+{}
+
+void
+PTY_Port::
+initialize_defaults()
+{
+	// Initialize attributes
+	link_name     = NULL;
+	slave_name[0] = '\0';
+	slave_fd      = -1;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Open Pseudo-Terminal
+// ------------------------------------------------------------------------------
+/**
+ * throws EXIT_FAILURE if could not open the port
+ */
+void
+PTY_Port::
+open_port()
+{
+	printf("OPEN PTY\n");
+
+	fd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if ( fd < 0 || grantpt(fd) || unlockpt(fd) ||
+	     ptsname_r(fd, slave_name, sizeof(slave_name)) )
+	{
+		printf("failure, could not create a pseudo-terminal.\n");
+		throw EXIT_FAILURE;
+	}
+
+	// keep the slave open so the master does not see a hang up
+	slave_fd = open(slave_name, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if ( slave_fd < 0 )
+	{
+		printf("failure, could not open %s.\n", slave_name);
+		throw EXIT_FAILURE;
+	}
+
+	// raw bytes, no echo or line processing
+	struct termios config;
+	tcgetattr(slave_fd, &config);
+	cfmakeraw(&config);
+	if ( tcsetattr(slave_fd, TCSANOW, &config) < 0 )
+	{
+		printf("failure, could not configure %s.\n", slave_name);
+		throw EXIT_FAILURE;
+	}
+
+	if ( link_name )
+	{
+		unlink(link_name);
+		if ( symlink(slave_name, link_name) )
+			fprintf(stderr,"WARNING: could not link %s to %s\n", link_name, slave_name);
+		else
+			printf("Linked %s to %s\n", link_name, slave_name);
+	}
+
+	printf("Connect the autopilot to %s\n", slave_name);
+
+	status = PORT_OPEN;
+
+	printf("\n");
+
+	return;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Close Pseudo-Terminal
+// ------------------------------------------------------------------------------
+void
+PTY_Port::
+close_port()
+{
+	printf("CLOSE PTY\n");
+
+	if ( link_name )
+		unlink(link_name);
+
+	close(slave_fd);
+	int result = close(fd);
+
+	if ( result )
+	{
+		fprintf(stderr,"WARNING: Error on port close (%i)\n", result );
+	}
+
+	status = PORT_CLOSED;
+
+	printf("\n");
+}
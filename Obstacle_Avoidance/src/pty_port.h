@@ -0,0 +1,67 @@
+/**
+ * @file pty_port.h
+ *
+ * @brief Pseudo-terminal interface definition
+ *
+ * Talks MAVLink over a pseudo-terminal, so a simulated autopilot can open
+ * it like the serial port of a Pixhawk
+ *
+ */
+
+#ifndef PTY_PORT_H_
+#define PTY_PORT_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <stdio.h>
+#include <fcntl.h>
+#include <termios.h>
+
+#include "generic_port.h"
+
+
+// ----------------------------------------------------------------------------------
+//   PTY Port Class
+// ----------------------------------------------------------------------------------
+/*
+ * PTY Port Class
+ *
+ * Opens a new pseudo-terminal, keeps the master side and prints the name
+ * of the slave side for the other program to open. When link_name is set
+ * the slave is also linked there, so the other program can be given the
+ * same path every run. Both sides are raw, and bytes move between them at
+ * memory speed, far above any real baud rate.
+ *
+ * The slave side is kept open here as well, otherwise the master would
+ * report a hang up until the other program opens it.
+ */
+class PTY_Port: public Generic_Port
+{
+
+public:
+
+	PTY_Port();
+	PTY_Port(const char *link_name_);
+	void initialize_defaults();
+	~PTY_Port();
+
+	const char *link_name;
+	char slave_name[64];
+
+protected:
+
+	void open_port();
+	void close_port();
+
+private:
+
+	int slave_fd;
+
+};
+
+
+
+#endif // PTY_PORT_H_
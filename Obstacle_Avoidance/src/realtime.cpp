@@ -0,0 +1,350 @@
+/**
+ * @file realtime.cpp
+ *
+ * @brief Real-time execution mode functions
+ *
+ * Functions for locking memory, prefaulting stacks, placing threads on
+ * cores with SCHED_FIFO priorities and watching for page faults or
+ * priority changes while flying
+ *
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "realtime.h"
+
+#include <alloca.h>
+#include <atomic>
+#include <errno.h>
+#include <malloc.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <time.h>
+
+
+// ------------------------------------------------------------------------------
+//   Module State
+// ------------------------------------------------------------------------------
+
+// Each role is only written by the thread that entered it, the atomics are
+// there so realtime_report() can read them from any thread.
+struct Realtime_Thread_State
+{
+	std::atomic<bool>          entered;
+	std::atomic<long>          base_minor_faults;
+	std::atomic<long>          base_major_faults;
+	std::atomic<long>          minor_faults;
+	std::atomic<long>          major_faults;
+	std::atomic<unsigned long> priority_violations;
+	std::atomic<unsigned long> core_violations;
+
+	// last seen by the thread itself, only changes are reported
+	uint64_t last_check_usec;
+	int      last_policy;
+	int      last_priority;
+	bool     on_core;
+};
+
+static Realtime_Config       rt_config;
+static Realtime_Thread_State rt_state[RT_THREAD_COUNT];
+
+
+// ------------------------------------------------------------------------------
+//   Configuration
+// ------------------------------------------------------------------------------
+void
+realtime_configure(const Realtime_Config &config)
+{
+	rt_config = config;
+}
+
+bool
+realtime_enabled()
+{
+	return rt_config.enabled;
+}
+
+const char*
+realtime_role_name(Realtime_Thread_Role role)
+{
+	switch (role)
+	{
+		case RT_THREAD_CAPTURE:       return "capture";
+		case RT_THREAD_MAVLINK_READ:  return "mavlink read";
+		case RT_THREAD_MAVLINK_WRITE: return "mavlink write";
+		default:                      return "unknown";
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Lock Memory
+// ------------------------------------------------------------------------------
+/*
+ * Locks every current and future page of the process into RAM and stops
+ * malloc from handing memory back to the kernel, so a page that has been
+ * touched once never has to be faulted in again.
+ */
+int
+realtime_lock_memory()
+{
+	if ( mlockall(MCL_CURRENT | MCL_FUTURE) )
+	{
+		fprintf(stderr,"WARNING: mlockall failed (%s)\n", strerror(errno));
+		return -1;
+	}
+
+	// keep freed memory in the process and never mmap large blocks
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+
+	printf("LOCKED PROCESS MEMORY\n");
+	return 0;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Prefault Stack
+// ------------------------------------------------------------------------------
+/*
+ * Touches the given number of bytes of the calling thread's stack so that
+ * the pages are resident (and locked by mlockall) before the loop starts.
+ */
+void
+realtime_prefault_stack(size_t bytes)
+{
+	volatile unsigned char *stack = (volatile unsigned char *) alloca(bytes);
+
+	for ( size_t i = 0; i < bytes; i += 4096 )
+		stack[i] = 0;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Enter Real-Time Mode
+// ------------------------------------------------------------------------------
+/*
+ * Called from inside the thread that takes on the given role. Applies the
+ * configured affinity and SCHED_FIFO priority, prefaults the stack and
+ * records the page fault counts that later checks are measured against.
+ */
+int
+realtime_enter_thread(Realtime_Thread_Role role)
+{
+	if ( not rt_config.enabled )
+		return 0;
+
+	const Realtime_Thread_Config &tc = rt_config.threads[role];
+	Realtime_Thread_State        &ts = rt_state[role];
+	int result = 0;
+
+	// --------------------------------------------------------------------------
+	//   CORE AFFINITY
+	// --------------------------------------------------------------------------
+	if ( tc.cpu_core >= 0 )
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(tc.cpu_core, &cpus);
+
+		int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if ( err )
+		{
+			fprintf(stderr,"WARNING: could not pin %s thread to core %d (%s)\n",
+					realtime_role_name(role), tc.cpu_core, strerror(err));
+			ts.core_violations++;
+			result = -1;
+		}
+	}
+
+	// --------------------------------------------------------------------------
+	//   PRIORITY
+	// --------------------------------------------------------------------------
+	if ( tc.priority > 0 )
+	{
+		struct sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = tc.priority;
+
+		int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if ( err )
+		{
+			fprintf(stderr,"WARNING: could not set %s thread to SCHED_FIFO %d (%s)\n",
+					realtime_role_name(role), tc.priority, strerror(err));
+			ts.priority_violations++;
+			result = -1;
+		}
+	}
+
+	// --------------------------------------------------------------------------
+	//   STACK
+	// --------------------------------------------------------------------------
+	realtime_prefault_stack(rt_config.prefault_stack_bytes);
+
+	// --------------------------------------------------------------------------
+	//   FAULT BASELINE
+	// --------------------------------------------------------------------------
+	struct rusage usage;
+	getrusage(RUSAGE_THREAD, &usage);
+	ts.base_minor_faults = usage.ru_minflt;
+	ts.base_major_faults = usage.ru_majflt;
+	ts.minor_faults      = 0;
+	ts.major_faults      = 0;
+
+	// --------------------------------------------------------------------------
+	//   PLACEMENT BASELINE
+	// --------------------------------------------------------------------------
+	// what the thread got, a failure above was already reported and is not
+	// counted again by every check
+	struct sched_param param;
+	int policy;
+	pthread_getschedparam(pthread_self(), &policy, &param);
+	ts.last_policy     = policy;
+	ts.last_priority   = param.sched_priority;
+	ts.on_core         = sched_getcpu() == tc.cpu_core;
+	ts.last_check_usec = 0;
+	ts.entered         = true;
+
+	printf("%s THREAD: core %d, SCHED_FIFO priority %d\n",
+			realtime_role_name(role), tc.cpu_core, tc.priority);
+
+	return result;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Check Real-Time Thread
+// ------------------------------------------------------------------------------
+/*
+ * Called periodically from inside the thread, and does nothing more often
+ * than REALTIME_CHECK_PERIOD_USEC. Reports any page faults taken since the
+ * last check, and only changes of policy, priority or core: a change away
+ * from the configuration counts as a violation, a thread that never got it
+ * is not reported again.
+ */
+void
+realtime_check_thread(Realtime_Thread_Role role)
+{
+	if ( not rt_config.enabled )
+		return;
+
+	Realtime_Thread_State &ts = rt_state[role];
+	if ( not ts.entered )
+		return;
+
+	const Realtime_Thread_Config &tc = rt_config.threads[role];
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uint64_t now_usec = (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+	if ( ts.last_check_usec && now_usec - ts.last_check_usec < REALTIME_CHECK_PERIOD_USEC )
+		return;
+	ts.last_check_usec = now_usec;
+
+	// --------------------------------------------------------------------------
+	//   PAGE FAULTS
+	// --------------------------------------------------------------------------
+	struct rusage usage;
+	getrusage(RUSAGE_THREAD, &usage);
+
+	long minor = usage.ru_minflt - ts.base_minor_faults;
+	long major = usage.ru_majflt - ts.base_major_faults;
+
+	if ( minor != ts.minor_faults || major != ts.major_faults )
+	{
+		fprintf(stderr,"WARNING: %s thread page faults, minor %ld (+%ld), major %ld (+%ld)\n",
+				realtime_role_name(role), minor, minor - ts.minor_faults,
+				major, major - ts.major_faults);
+		ts.minor_faults = minor;
+		ts.major_faults = major;
+	}
+
+	// --------------------------------------------------------------------------
+	//   PRIORITY
+	// --------------------------------------------------------------------------
+	if ( tc.priority > 0 )
+	{
+		int policy;
+		struct sched_param param;
+		pthread_getschedparam(pthread_self(), &policy, &param);
+
+		if ( policy != ts.last_policy || param.sched_priority != ts.last_priority )
+		{
+			if ( policy != SCHED_FIFO || param.sched_priority != tc.priority )
+			{
+				ts.priority_violations++;
+				fprintf(stderr,"WARNING: %s thread running with policy %d priority %d, expected SCHED_FIFO %d\n",
+						realtime_role_name(role), policy, param.sched_priority, tc.priority);
+			}
+			else
+				printf("%s THREAD: back to SCHED_FIFO priority %d\n", realtime_role_name(role), tc.priority);
+
+			ts.last_policy   = policy;
+			ts.last_priority = param.sched_priority;
+		}
+	}
+
+	// --------------------------------------------------------------------------
+	//   CORE
+	// --------------------------------------------------------------------------
+	if ( tc.cpu_core >= 0 )
+	{
+		int cpu = sched_getcpu();
+		bool on_core = cpu == tc.cpu_core;
+		if ( cpu >= 0 && on_core != ts.on_core )
+		{
+			if ( not on_core )
+			{
+				ts.core_violations++;
+				fprintf(stderr,"WARNING: %s thread running on core %d, expected %d\n",
+						realtime_role_name(role), cpu, tc.cpu_core);
+			}
+			else
+				printf("%s THREAD: back on core %d\n", realtime_role_name(role), tc.cpu_core);
+
+			ts.on_core = on_core;
+		}
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Report
+// ------------------------------------------------------------------------------
+Realtime_Thread_Stats
+realtime_get_stats(Realtime_Thread_Role role)
+{
+	Realtime_Thread_Stats stats;
+	stats.entered             = rt_state[role].entered;
+	stats.minor_faults        = rt_state[role].minor_faults;
+	stats.major_faults        = rt_state[role].major_faults;
+	stats.priority_violations = rt_state[role].priority_violations;
+	stats.core_violations     = rt_state[role].core_violations;
+	return stats;
+}
+
+void
+realtime_report()
+{
+	if ( not rt_config.enabled )
+		return;
+
+	printf("REAL-TIME REPORT\n");
+	for ( int i = 0; i < RT_THREAD_COUNT; i++ )
+	{
+		Realtime_Thread_Stats stats = realtime_get_stats((Realtime_Thread_Role) i);
+		if ( not stats.entered )
+			continue;
+
+		printf("  %-14s minor faults %ld, major faults %ld, priority violations %lu, core violations %lu\n",
+				realtime_role_name((Realtime_Thread_Role) i),
+				stats.minor_faults, stats.major_faults,
+				stats.priority_violations, stats.core_violations);
+	}
+	printf("\n");
+}
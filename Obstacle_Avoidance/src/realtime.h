@@ -0,0 +1,114 @@
+/**
+ * @file realtime.h
+ *
+ * @brief Real-time execution mode definition
+ *
+ * Functions for locking memory, prefaulting stacks, placing threads on
+ * cores with SCHED_FIFO priorities and watching for page faults or
+ * priority changes while flying
+ *
+ */
+
+#ifndef REALTIME_H_
+#define REALTIME_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// Default amount of stack touched by each thread when it enters real-time mode
+#define REALTIME_PREFAULT_STACK_BYTES (256 * 1024)
+
+// realtime_check_thread() is called on every wake of the loops, it only
+// looks at the thread this often
+#define REALTIME_CHECK_PERIOD_USEC 100000
+
+// Thread roles that can be placed on a core and given a priority
+enum Realtime_Thread_Role
+{
+	RT_THREAD_CAPTURE = 0,    // capture and analysis of the depth frames
+	RT_THREAD_MAVLINK_READ,   // Autopilot_Interface event loop
+	RT_THREAD_MAVLINK_WRITE,  // Serial_Port writer
+	RT_THREAD_COUNT
+};
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+// Placement of a single thread. A core of -1 leaves the affinity alone and a
+// priority of 0 leaves the thread on SCHED_OTHER.
+struct Realtime_Thread_Config
+{
+	int cpu_core;
+	int priority;
+};
+
+struct Realtime_Config
+{
+	Realtime_Config()
+	{
+		enabled              = false;
+		lock_memory          = true;
+		prefault_stack_bytes = REALTIME_PREFAULT_STACK_BYTES;
+
+		// Core 0 takes most of the interrupts on the Jetson, so keep off of it.
+		// The MAVLink threads run above the vision side so the offboard
+		// keep-alive is never starved, the serial writer highest of all.
+		threads[RT_THREAD_CAPTURE].cpu_core       = 2;
+		threads[RT_THREAD_CAPTURE].priority       = 70;
+		threads[RT_THREAD_MAVLINK_READ].cpu_core  = 3;
+		threads[RT_THREAD_MAVLINK_READ].priority  = 80;
+		threads[RT_THREAD_MAVLINK_WRITE].cpu_core = 3;
+		threads[RT_THREAD_MAVLINK_WRITE].priority = 85;
+	}
+
+	bool   enabled;
+	bool   lock_memory;
+	size_t prefault_stack_bytes;
+
+	Realtime_Thread_Config threads[RT_THREAD_COUNT];
+};
+
+// What has been seen for a thread since it entered real-time mode
+struct Realtime_Thread_Stats
+{
+	bool          entered;
+	long          minor_faults;
+	long          major_faults;
+	unsigned long priority_violations;
+	unsigned long core_violations;
+};
+
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+void realtime_configure(const Realtime_Config &config);
+bool realtime_enabled();
+
+int  realtime_lock_memory();
+void realtime_prefault_stack(size_t bytes);
+
+int  realtime_enter_thread(Realtime_Thread_Role role);
+void realtime_check_thread(Realtime_Thread_Role role);
+
+Realtime_Thread_Stats realtime_get_stats(Realtime_Thread_Role role);
+void realtime_report();
+
+const char* realtime_role_name(Realtime_Thread_Role role);
+
+
+#endif // REALTIME_H_
@@ -0,0 +1,123 @@
+/**
+ * @file section_motion.cpp
+ *
+ * @brief Section motion functions
+ *
+ * Keeps the near depth of each section over the last frames, so content
+ * that is coming at the vehicle faster than the vehicle flies into it can
+ * be told apart from a still obstacle
+ *
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "section_motion.h"
+
+#include <string.h>
+
+
+// ----------------------------------------------------------------------------------
+//   Section Motion Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Section_Motion::
+Section_Motion(int num_sections_)
+{
+	num_sections = num_sections_;
+
+	depths   = new float[num_sections * SECTION_MOTION_LENGTH];
+	measured = new uint8_t[num_sections * SECTION_MOTION_LENGTH];
+
+	clear();
+}
+
+Section_Motion::
+~Section_Motion()
+{
+	delete[] depths;
+	delete[] measured;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Clear
+// ------------------------------------------------------------------------------
+void
+Section_Motion::
+clear()
+{
+	memset(measured, 0, num_sections * SECTION_MOTION_LENGTH);
+	memset(times, 0, sizeof(times));
+	head   = SECTION_MOTION_LENGTH - 1;
+	frames = 0;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Add Frame
+// ------------------------------------------------------------------------------
+void
+Section_Motion::
+add_frame(uint64_t usec, const float *near_depths, const float *percentages)
+{
+	head = (head + 1) % SECTION_MOTION_LENGTH;
+	times[head] = usec;
+	if ( frames < SECTION_MOTION_LENGTH )
+		frames++;
+
+	for ( int s = 0; s < num_sections; s++ )
+	{
+		int slot = s * SECTION_MOTION_LENGTH + head;
+		depths[slot]   = near_depths[s];
+		measured[slot] = percentages[s] >= SECTION_MOTION_MIN_PERCENT;
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Closing Speed
+// ------------------------------------------------------------------------------
+/*
+ * Least squares slope of the depth over the time, with the time taken from
+ * the newest frame so the sums stay small. Zero until there are
+ * SECTION_MOTION_MIN_SAMPLES in the run.
+ */
+float
+Section_Motion::
+closing_speed(int section) const
+{
+	const float   *depth = depths   + section * SECTION_MOTION_LENGTH;
+	const uint8_t *valid = measured + section * SECTION_MOTION_LENGTH;
+
+	double sum_t = 0, sum_d = 0, sum_tt = 0, sum_td = 0;
+	int count = 0;
+
+	for ( int n = 0; n < frames; n++ )
+	{
+		int slot = (head - n + SECTION_MOTION_LENGTH) % SECTION_MOTION_LENGTH;
+		if ( not valid[slot] || times[head] - times[slot] > SECTION_MOTION_MAX_AGE_USEC )
+			break;
+
+		double t = ((double) times[slot] - (double) times[head]) / 1e6;
+		sum_t  += t;
+		sum_d  += depth[slot];
+		sum_tt += t * t;
+		sum_td += t * depth[slot];
+		count++;
+	}
+
+	if ( count < SECTION_MOTION_MIN_SAMPLES )
+		return 0;
+
+	double spread = count * sum_tt - sum_t * sum_t;
+	if ( spread <= 0 )
+		return 0;
+
+	return (float) -((count * sum_td - sum_t * sum_d) / spread);
+}
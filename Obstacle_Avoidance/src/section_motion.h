@@ -0,0 +1,84 @@
+/**
+ * @file section_motion.h
+ *
+ * @brief Section motion definition
+ *
+ * Keeps the near depth of each section over the last frames, so content
+ * that is coming at the vehicle faster than the vehicle flies into it can
+ * be told apart from a still obstacle
+ *
+ */
+
+#ifndef SECTION_MOTION_H_
+#define SECTION_MOTION_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <stdio.h>
+#include <stdint.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// Frames kept for each section
+#define SECTION_MOTION_LENGTH 8
+
+// A closing speed is only fit to at least this many frames, none older
+// than SECTION_MOTION_MAX_AGE_USEC
+#define SECTION_MOTION_MIN_SAMPLES  4
+#define SECTION_MOTION_MAX_AGE_USEC 1000000
+
+// A section with fewer near pixels than this has no depth to follow, in percent
+#define SECTION_MOTION_MIN_PERCENT 2.0
+
+
+// ----------------------------------------------------------------------------------
+//   Section Motion Class
+// ----------------------------------------------------------------------------------
+/*
+ * Section Motion Class
+ *
+ * add_frame() is called once per frame with the mean depth of the near
+ * pixels of every section and how many there were, which the pixel loop
+ * already has. Nothing per pixel is kept. The frames share one ring of
+ * times, and each section has a ring of depths with a flag for whether
+ * the depth was measured.
+ *
+ * closing_speed() fits a line to the newest run of measured depths of a
+ * section and returns how fast it is falling. A frame without enough near
+ * pixels ends the run, the mean of a section that only has a few of them
+ * jumps as they come and go. Everything is O(sections) per frame.
+ */
+class Section_Motion
+{
+
+public:
+
+	Section_Motion(int num_sections_);
+	~Section_Motion();
+
+	void clear();
+	void add_frame(uint64_t usec, const float *near_depths, const float *percentages);
+
+	// in depth units per second, positive when the depth is falling
+	float closing_speed(int section) const;
+
+	int num_sections;
+
+private:
+
+	float   *depths;     // SECTION_MOTION_LENGTH per section, section major
+	uint8_t *measured;
+	uint64_t times[SECTION_MOTION_LENGTH];
+	int      head;       // slot of the newest frame
+	int      frames;
+
+};
+
+
+#endif // SECTION_MOTION_H_
@@ -78,129 +78,15 @@ Serial_Port()
 
 Serial_Port::
 ~Serial_Port()
-{
-	// destroy mutex
-	pthread_mutex_destroy(&lock);
-}
+{}
 
 void
 Serial_Port::
 initialize_defaults()
 {
 	// Initialize attributes
-	debug  = false;
-	fd     = -1;
-	status = SERIAL_PORT_CLOSED;
-
 	uart_name = (char*)"/dev/ttyUSB0";
 	baudrate  = 57600;
-
-	// Start mutex
-	int result = pthread_mutex_init(&lock, NULL);
-	if ( result != 0 )
-	{
-		printf("\n mutex init failed\n");
-		throw 1;
-	}
-}
-
-
-// ------------------------------------------------------------------------------
-//   Read from Serial
-// ------------------------------------------------------------------------------
-int
-Serial_Port::
-read_message(mavlink_message_t &message)
-{
-	uint8_t          cp;
-	mavlink_status_t status;
-	uint8_t          msgReceived = false;
-
-	// --------------------------------------------------------------------------
-	//   READ FROM PORT
-	// --------------------------------------------------------------------------
-
-	// this function locks the port during read
-	int result = _read_port(cp);
-
-
-	// --------------------------------------------------------------------------
-	//   PARSE MESSAGE
-	// --------------------------------------------------------------------------
-	if (result > 0)
-	{
-		// the parsing
-		msgReceived = mavlink_parse_char(MAVLINK_COMM_1, cp, &message, &status);
-
-		// check for dropped packets
-		if ( (lastStatus.packet_rx_drop_count != status.packet_rx_drop_count) && debug )
-		{
-			printf("ERROR: DROPPED %d PACKETS\n", status.packet_rx_drop_count);
-			unsigned char v=cp;
-			fprintf(stderr,"%02x ", v);
-		}
-		lastStatus = status;
-	}
-
-	// Couldn't read from port
-	else
-	{
-		fprintf(stderr, "ERROR: Could not read from fd %d\n", fd);
-	}
-
-	// --------------------------------------------------------------------------
-	//   DEBUGGING REPORTS
-	// --------------------------------------------------------------------------
-	if(msgReceived && debug)
-	{
-		// Report info
-		printf("Received message from serial with ID #%d (sys:%d|comp:%d):\n", message.msgid, message.sysid, message.compid);
-
-		fprintf(stderr,"Received serial data: ");
-		unsigned int i;
-		uint8_t buffer[MAVLINK_MAX_PACKET_LEN];
-
-		// check message is write length
-		unsigned int messageLength = mavlink_msg_to_send_buffer(buffer, &message);
-
-		// message length error
-		if (messageLength > MAVLINK_MAX_PACKET_LEN)
-		{
-			fprintf(stderr, "\nFATAL ERROR: MESSAGE LENGTH IS LARGER THAN BUFFER SIZE\n");
-		}
-
-		// print out the buffer
-		else
-		{
-			for (i=0; i<messageLength; i++)
-			{
-				unsigned char v=buffer[i];
-				fprintf(stderr,"%02x ", v);
-			}
-			fprintf(stderr,"\n");
-		}
-	}
-
-	// Done!
-	return msgReceived;
-}
-
-// ------------------------------------------------------------------------------
-//   Write to Serial
-// ------------------------------------------------------------------------------
-int
-Serial_Port::
-write_message(const mavlink_message_t &message)
-{
-	char buf[300];
-
-	// Translate message to buffer
-	unsigned len = mavlink_msg_to_send_buffer((uint8_t*)buf, &message);
-
-	// Write buffer to serial port, locks port while writing
-	int bytesWritten = _write_port(buf,len);
-
-	return bytesWritten;
 }
 
 
@@ -252,7 +138,9 @@ open_serial()
 	//   CONNECTED!
 	// --------------------------------------------------------------------------
 	printf("Connected to %s with %d baud, 8 data bits, no parity, 1 stop bit (8N1)\n", uart_name, baudrate);
-	lastStatus.packet_rx_drop_count = 0;
+
+	// 8N1 takes 10 bits on the wire for every byte
+	link.capacity = baudrate / 10;
 
 	status = true;
 
@@ -287,39 +175,23 @@ close_serial()
 
 
 // ------------------------------------------------------------------------------
-//   Convenience Functions
+//   Transport Hooks
 // ------------------------------------------------------------------------------
 void
 Serial_Port::
-start()
+open_port()
 {
 	open_serial();
 }
 
 void
 Serial_Port::
-stop()
+close_port()
 {
 	close_serial();
 }
 
 
-// ------------------------------------------------------------------------------
-//   Quit Handler
-// ------------------------------------------------------------------------------
-void
-Serial_Port::
-handle_quit( int sig )
-{
-	try {
-		stop();
-	}
-	catch (int error) {
-		fprintf(stderr,"Warning, could not stop serial port\n");
-	}
-}
-
-
 // ------------------------------------------------------------------------------
 //   Helper Function - Open Serial Port File Descriptor
 // ------------------------------------------------------------------------------
@@ -496,49 +368,3 @@ _setup_port(int baud, int data_bits, int stop_bits, bool parity, bool hardware_c
 }
 
 
-
-// ------------------------------------------------------------------------------
-//   Read Port with Lock
-// ------------------------------------------------------------------------------
-int
-Serial_Port::
-_read_port(uint8_t &cp)
-{
-
-	// Lock
-	pthread_mutex_lock(&lock);
-
-	int result = read(fd, &cp, 1);
-
-	// Unlock
-	pthread_mutex_unlock(&lock);
-
-	return result;
-}
-
-
-// ------------------------------------------------------------------------------
-//   Write Port with Lock
-// ------------------------------------------------------------------------------
-int
-Serial_Port::
-_write_port(char *buf, unsigned len)
-{
-
-	// Lock
-	pthread_mutex_lock(&lock);
-
-	// Write packet via serial link
-	const int bytesWritten = static_cast<int>(write(fd, buf, len));
-
-	// Wait until all data has been written
-	tcdrain(fd);
-
-	// Unlock
-	pthread_mutex_unlock(&lock);
-
-
-	return bytesWritten;
-}
-
-
@@ -64,6 +64,8 @@
 
 #include <common/mavlink.h>
 
+#include "generic_port.h"
+
 
 // ------------------------------------------------------------------------------
 //   Defines
@@ -101,12 +103,10 @@
  * Serial Port Class
  *
  * This object handles the opening and closing of the offboard computer's
- * serial port over which we'll communicate.  It also has methods to write
- * a byte stream buffer.  MAVlink is not used in this object yet, it's just
- * a serialization interface.  To help with read and write pthreading, it
- * gaurds any port operation with a pthread mutex.
+ * serial port over which we'll communicate.  Reading, parsing and the
+ * writer thread come from Generic_Port.
  */
-class Serial_Port
+class Serial_Port: public Generic_Port
 {
 
 public:
@@ -116,37 +116,24 @@ public:
 	void initialize_defaults();
 	~Serial_Port();
 
-	bool debug;
 	const char *uart_name;
 	int  baudrate;
-	int  status;
-
-	int read_message(mavlink_message_t &message);
-	int write_message(const mavlink_message_t &message);
 
 	void open_serial();
 	void close_serial();
 
-	void start();
-	void stop();
+protected:
 
-	void handle_quit( int sig );
+	void open_port();
+	void close_port();
 
 private:
 
-	int  fd;
-	mavlink_status_t lastStatus;
-	pthread_mutex_t  lock;
-
 	int  _open_port(const char* port);
 	bool _setup_port(int baud, int data_bits, int stop_bits, bool parity, bool hardware_control);
-	int  _read_port(uint8_t &cp);
-	int _write_port(char *buf, unsigned len);
 
 };
 
 
 
 #endif // SERIAL_PORT_H_
-
-
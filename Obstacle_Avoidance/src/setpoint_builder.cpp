@@ -0,0 +1,180 @@
+/**
+ * @file setpoint_builder.cpp
+ *
+ * @brief Setpoint builder functions
+ *
+ * Composes the fields of a SET_POSITION_TARGET_LOCAL_NED and the type_mask
+ * that tells the autopilot which of them to use
+ *
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "setpoint_builder.h"
+
+#include <string.h>
+#include <cmath>
+
+
+// ----------------------------------------------------------------------------------
+//   Setpoint Builder Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Setpoint_Builder::
+Setpoint_Builder(uint8_t coordinate_frame)
+{
+	memset(&sp, 0, sizeof(sp));
+	sp.type_mask        = SETPOINT_IGNORE_ALL;
+	sp.coordinate_frame = coordinate_frame;
+}
+
+Setpoint_Builder::
+~Setpoint_Builder()
+{}
+
+
+// ------------------------------------------------------------------------------
+//   Fields
+// ------------------------------------------------------------------------------
+Setpoint_Builder&
+Setpoint_Builder::
+position(float x, float y, float z)
+{
+	sp.x = x;
+	sp.y = y;
+	sp.z = z;
+	use(SETPOINT_IGNORE_POSITION);
+	return *this;
+}
+
+Setpoint_Builder&
+Setpoint_Builder::
+velocity(float vx, float vy, float vz)
+{
+	sp.vx = vx;
+	sp.vy = vy;
+	sp.vz = vz;
+	use(SETPOINT_IGNORE_VELOCITY);
+	return *this;
+}
+
+Setpoint_Builder&
+Setpoint_Builder::
+acceleration(float ax, float ay, float az)
+{
+	sp.afx = ax;
+	sp.afy = ay;
+	sp.afz = az;
+	use(SETPOINT_IGNORE_ACCELERATION);
+	sp.type_mask &= ~SETPOINT_FORCE;
+	return *this;
+}
+
+Setpoint_Builder&
+Setpoint_Builder::
+force(float fx, float fy, float fz)
+{
+	acceleration(fx, fy, fz);
+	sp.type_mask |= SETPOINT_FORCE;
+	return *this;
+}
+
+Setpoint_Builder&
+Setpoint_Builder::
+yaw(float yaw)
+{
+	sp.yaw      = yaw;
+	sp.yaw_rate = 0;
+	use(SETPOINT_IGNORE_YAW);
+	sp.type_mask |= SETPOINT_IGNORE_YAW_RATE;
+	return *this;
+}
+
+Setpoint_Builder&
+Setpoint_Builder::
+yaw_rate(float yaw_rate)
+{
+	sp.yaw      = 0;
+	sp.yaw_rate = yaw_rate;
+	use(SETPOINT_IGNORE_YAW_RATE);
+	sp.type_mask |= SETPOINT_IGNORE_YAW;
+	return *this;
+}
+
+Setpoint_Builder&
+Setpoint_Builder::
+frame(uint8_t coordinate_frame)
+{
+	sp.coordinate_frame = coordinate_frame;
+	return *this;
+}
+
+Setpoint_Builder&
+Setpoint_Builder::
+time_boot_ms(uint32_t time_boot_ms)
+{
+	sp.time_boot_ms = time_boot_ms;
+	return *this;
+}
+
+Setpoint_Builder&
+Setpoint_Builder::
+target(uint8_t system_id, uint8_t component_id)
+{
+	sp.target_system    = system_id;
+	sp.target_component = component_id;
+	return *this;
+}
+
+void
+Setpoint_Builder::
+use(uint16_t ignore_bits)
+{
+	sp.type_mask &= ~ignore_bits;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Valid
+// ------------------------------------------------------------------------------
+bool
+Setpoint_Builder::
+valid() const
+{
+	if ( not (sp.type_mask & SETPOINT_IGNORE_POSITION) and
+	     not (std::isfinite(sp.x) and std::isfinite(sp.y) and std::isfinite(sp.z)) )
+		return false;
+
+	if ( not (sp.type_mask & SETPOINT_IGNORE_VELOCITY) and
+	     not (std::isfinite(sp.vx) and std::isfinite(sp.vy) and std::isfinite(sp.vz)) )
+		return false;
+
+	if ( not (sp.type_mask & SETPOINT_IGNORE_ACCELERATION) and
+	     not (std::isfinite(sp.afx) and std::isfinite(sp.afy) and std::isfinite(sp.afz)) )
+		return false;
+
+	if ( not (sp.type_mask & SETPOINT_IGNORE_YAW) and not std::isfinite(sp.yaw) )
+		return false;
+
+	if ( not (sp.type_mask & SETPOINT_IGNORE_YAW_RATE) and not std::isfinite(sp.yaw_rate) )
+		return false;
+
+	return true;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Encode
+// ------------------------------------------------------------------------------
+void
+Setpoint_Builder::
+encode(uint8_t system_id, uint8_t component_id, mavlink_message_t &message) const
+{
+	mavlink_msg_set_position_target_local_ned_encode(system_id, component_id, &message, &sp);
+}
@@ -0,0 +1,117 @@
+/**
+ * @file setpoint_builder.h
+ *
+ * @brief Setpoint builder definition
+ *
+ * Composes the fields of a SET_POSITION_TARGET_LOCAL_NED and the type_mask
+ * that tells the autopilot which of them to use
+ *
+ */
+
+#ifndef SETPOINT_BUILDER_H_
+#define SETPOINT_BUILDER_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <stdint.h>
+#include <math.h>
+
+#include <common/mavlink.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// type_mask bits, a field is ignored by the autopilot while its bit is set
+#define SETPOINT_IGNORE_POSITION     0x0007
+#define SETPOINT_IGNORE_VELOCITY     0x0038
+#define SETPOINT_IGNORE_ACCELERATION 0x01C0
+#define SETPOINT_FORCE               0x0200  // not ignore, afx afy afz are a force
+#define SETPOINT_IGNORE_YAW          0x0400
+#define SETPOINT_IGNORE_YAW_RATE     0x0800
+
+// Nothing is used
+#define SETPOINT_IGNORE_ALL (SETPOINT_IGNORE_POSITION | SETPOINT_IGNORE_VELOCITY | \
+                             SETPOINT_IGNORE_ACCELERATION | SETPOINT_IGNORE_YAW | \
+                             SETPOINT_IGNORE_YAW_RATE)
+
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+// The type_mask that uses exactly the fields given
+constexpr uint16_t
+setpoint_type_mask(bool position, bool velocity, bool acceleration,
+                   bool force, bool yaw, bool yaw_rate)
+{
+	return (uint16_t) ((SETPOINT_IGNORE_ALL
+		& ~(position     ? SETPOINT_IGNORE_POSITION     : 0)
+		& ~(velocity     ? SETPOINT_IGNORE_VELOCITY     : 0)
+		& ~(acceleration ? SETPOINT_IGNORE_ACCELERATION : 0)
+		& ~(yaw          ? SETPOINT_IGNORE_YAW          : 0)
+		& ~(yaw_rate     ? SETPOINT_IGNORE_YAW_RATE     : 0))
+		| (acceleration and force ? SETPOINT_FORCE : 0));
+}
+
+
+// ----------------------------------------------------------------------------------
+//   Setpoint Builder Class
+// ----------------------------------------------------------------------------------
+/*
+ * Setpoint Builder Class
+ *
+ * Starts from a setpoint that uses nothing, and each call sets one group
+ * of fields and marks it used in the type_mask, so the mask always matches
+ * the fields that were given whatever the order of the calls:
+ *
+ *     mavlink_set_position_target_local_ned_t sp =
+ *         Setpoint_Builder().velocity(0, 2.5, 0).acceleration(0, 1, 0).yaw(ip.yaw).build();
+ *
+ * Acceleration with position or velocity is a feed-forward the autopilot
+ * adds to its own controller. yaw() and yaw_rate() replace each other, the
+ * autopilot only follows one of them. force() is acceleration with the
+ * force bit set.
+ *
+ * valid() checks every used field is finite, the autopilot would reject
+ * or, worse, fly a NaN.
+ */
+class Setpoint_Builder
+{
+
+public:
+
+	Setpoint_Builder(uint8_t coordinate_frame = MAV_FRAME_BODY_NED);
+	~Setpoint_Builder();
+
+	Setpoint_Builder& position(float x, float y, float z);
+	Setpoint_Builder& velocity(float vx, float vy, float vz);
+	Setpoint_Builder& acceleration(float ax, float ay, float az);
+	Setpoint_Builder& force(float fx, float fy, float fz);
+	Setpoint_Builder& yaw(float yaw);
+	Setpoint_Builder& yaw_rate(float yaw_rate);
+
+	Setpoint_Builder& frame(uint8_t coordinate_frame);
+	Setpoint_Builder& time_boot_ms(uint32_t time_boot_ms);
+	Setpoint_Builder& target(uint8_t system_id, uint8_t component_id);
+
+	uint16_t type_mask() const { return sp.type_mask; }
+	bool valid() const;
+
+	const mavlink_set_position_target_local_ned_t& build() const { return sp; }
+	void encode(uint8_t system_id, uint8_t component_id, mavlink_message_t &message) const;
+
+private:
+
+	mavlink_set_position_target_local_ned_t sp;
+
+	void use(uint16_t ignore_bits);
+
+};
+
+
+#endif // SETPOINT_BUILDER_H_
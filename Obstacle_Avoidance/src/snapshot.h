@@ -0,0 +1,115 @@
+/**
+ * @file snapshot.h
+ *
+ * @brief Seqlock snapshot definition
+ *
+ * Lets one thread publish the latest copy of a message while other threads
+ * read consistent copies of it without taking a lock
+ *
+ */
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <string.h>
+#include <stdint.h>
+#include <atomic>
+
+
+// ----------------------------------------------------------------------------------
+//   Snapshot Class
+// ----------------------------------------------------------------------------------
+/*
+ * Snapshot Class
+ *
+ * A sequence lock around one value. The sequence is odd while publish() is
+ * copying the value in, and read() copies the value out and tries again if
+ * the sequence was odd or changed while it was copying. The writer never
+ * waits on the readers, and a reader only spins for as long as one copy of
+ * the value takes.
+ *
+ * Only one thread may publish at a time, callers with more than one writer
+ * have to serialize publish() themselves. T has to be a plain struct, like
+ * the decoded MAVLink messages, since it is copied with memcpy.
+ */
+template <typename T>
+class Snapshot
+{
+
+public:
+
+	Snapshot()
+	{
+		sequence = 0;
+		stamp    = 0;
+		memset(&value, 0, sizeof(value));
+	}
+
+	void
+	publish(const T &value_, uint64_t time_usec)
+	{
+		unsigned int seq = sequence.load(std::memory_order_relaxed);
+		sequence.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		memcpy(&value, &value_, sizeof(value));
+		stamp = time_usec;
+
+		sequence.store(seq + 2, std::memory_order_release);
+	}
+
+	// Copies the value out, returns the time it was published (0 if never)
+	uint64_t
+	read(T &value_) const
+	{
+		unsigned int before, after;
+		uint64_t time_usec;
+		do
+		{
+			before = sequence.load(std::memory_order_acquire);
+			memcpy(&value_, &value, sizeof(value));
+			time_usec = stamp;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			after = sequence.load(std::memory_order_relaxed);
+		}
+		while ( (before & 1) || before != after );
+
+		return time_usec;
+	}
+
+	// Time of the last publish, without copying the value
+	uint64_t
+	time_usec() const
+	{
+		unsigned int before, after;
+		uint64_t time_usec;
+		do
+		{
+			before = sequence.load(std::memory_order_acquire);
+			time_usec = stamp;
+			std::atomic_thread_fence(std::memory_order_acquire);
+			after = sequence.load(std::memory_order_relaxed);
+		}
+		while ( (before & 1) || before != after );
+
+		return time_usec;
+	}
+
+	// Changes every time a new value is published
+	unsigned int version() const { return sequence.load(std::memory_order_acquire) >> 1; }
+
+private:
+
+	std::atomic<unsigned int> sequence;
+	T        value;
+	uint64_t stamp;
+
+};
+
+
+#endif // SNAPSHOT_H_
@@ -0,0 +1,153 @@
+/**
+ * @file state_history.cpp
+ *
+ * @brief State history functions
+ *
+ * Keeps the last second or so of attitude, local position and IMU samples,
+ * so the state of the vehicle can be looked up at the time a camera frame
+ * was captured rather than only the latest one
+ *
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "state_history.h"
+
+#include <math.h>
+
+
+// ------------------------------------------------------------------------------
+//   Interpolation
+// ------------------------------------------------------------------------------
+
+static float
+lerp(float a, float b, float f)
+{
+	return a + (b - a) * f;
+}
+
+// Along the shorter way around, the result in -pi..pi
+static float
+lerp_angle(float a, float b, float f)
+{
+	float difference = remainderf(b - a, 2 * (float) M_PI);
+	return remainderf(a + difference * f, 2 * (float) M_PI);
+}
+
+static uint64_t
+lerp_time(uint64_t a, uint64_t b, float f)
+{
+	return a + (uint64_t) llroundf((float) (b - a) * f);
+}
+
+void
+history_interpolate(const mavlink_attitude_t &a, const mavlink_attitude_t &b,
+                    float f, mavlink_attitude_t &out)
+{
+	out = b;
+	out.time_boot_ms = (uint32_t) lerp_time(a.time_boot_ms, b.time_boot_ms, f);
+	out.roll       = lerp_angle(a.roll,  b.roll,  f);
+	out.pitch      = lerp_angle(a.pitch, b.pitch, f);
+	out.yaw        = lerp_angle(a.yaw,   b.yaw,   f);
+	out.rollspeed  = lerp(a.rollspeed,  b.rollspeed,  f);
+	out.pitchspeed = lerp(a.pitchspeed, b.pitchspeed, f);
+	out.yawspeed   = lerp(a.yawspeed,   b.yawspeed,   f);
+}
+
+void
+history_interpolate(const mavlink_local_position_ned_t &a, const mavlink_local_position_ned_t &b,
+                    float f, mavlink_local_position_ned_t &out)
+{
+	out = b;
+	out.time_boot_ms = (uint32_t) lerp_time(a.time_boot_ms, b.time_boot_ms, f);
+	out.x  = lerp(a.x,  b.x,  f);
+	out.y  = lerp(a.y,  b.y,  f);
+	out.z  = lerp(a.z,  b.z,  f);
+	out.vx = lerp(a.vx, b.vx, f);
+	out.vy = lerp(a.vy, b.vy, f);
+	out.vz = lerp(a.vz, b.vz, f);
+}
+
+// fields_updated and anything else that is not a measurement comes from b
+void
+history_interpolate(const mavlink_highres_imu_t &a, const mavlink_highres_imu_t &b,
+                    float f, mavlink_highres_imu_t &out)
+{
+	out = b;
+	out.time_usec     = lerp_time(a.time_usec, b.time_usec, f);
+	out.xacc          = lerp(a.xacc,  b.xacc,  f);
+	out.yacc          = lerp(a.yacc,  b.yacc,  f);
+	out.zacc          = lerp(a.zacc,  b.zacc,  f);
+	out.xgyro         = lerp(a.xgyro, b.xgyro, f);
+	out.ygyro         = lerp(a.ygyro, b.ygyro, f);
+	out.zgyro         = lerp(a.zgyro, b.zgyro, f);
+	out.xmag          = lerp(a.xmag,  b.xmag,  f);
+	out.ymag          = lerp(a.ymag,  b.ymag,  f);
+	out.zmag          = lerp(a.zmag,  b.zmag,  f);
+	out.abs_pressure  = lerp(a.abs_pressure,  b.abs_pressure,  f);
+	out.diff_pressure = lerp(a.diff_pressure, b.diff_pressure, f);
+	out.pressure_alt  = lerp(a.pressure_alt,  b.pressure_alt,  f);
+	out.temperature   = lerp(a.temperature,   b.temperature,   f);
+}
+
+
+// ----------------------------------------------------------------------------------
+//   Vehicle History Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Vehicle_History::
+Vehicle_History()
+{
+	clock = NULL;
+}
+
+Vehicle_History::
+~Vehicle_History()
+{}
+
+
+// ------------------------------------------------------------------------------
+//   Add
+// ------------------------------------------------------------------------------
+// A sample older than the newest (around the moment the clocks sync) is dropped
+void
+Vehicle_History::
+add(const mavlink_attitude_t &message, uint64_t arrival_usec)
+{
+	attitude.push(message, stamp((uint64_t) message.time_boot_ms * 1000, arrival_usec));
+}
+
+void
+Vehicle_History::
+add(const mavlink_local_position_ned_t &message, uint64_t arrival_usec)
+{
+	local_position_ned.push(message, stamp((uint64_t) message.time_boot_ms * 1000, arrival_usec));
+}
+
+void
+Vehicle_History::
+add(const mavlink_highres_imu_t &message, uint64_t arrival_usec)
+{
+	highres_imu.push(message, stamp(message.time_usec, arrival_usec));
+}
+
+
+// ------------------------------------------------------------------------------
+//   Stamp
+// ------------------------------------------------------------------------------
+// The local time the autopilot took the sample, it cannot be after it arrived
+uint64_t
+Vehicle_History::
+stamp(uint64_t autopilot_usec, uint64_t arrival_usec) const
+{
+	uint64_t local_usec = clock ? clock->autopilot_to_local_usec(autopilot_usec) : 0;
+	if ( not local_usec || local_usec > arrival_usec )
+		return arrival_usec;
+	return local_usec;
+}
@@ -0,0 +1,294 @@
+/**
+ * @file state_history.h
+ *
+ * @brief State history definition
+ *
+ * Keeps the last second or so of attitude, local position and IMU samples,
+ * so the state of the vehicle can be looked up at the time a camera frame
+ * was captured rather than only the latest one
+ *
+ */
+
+#ifndef STATE_HISTORY_H_
+#define STATE_HISTORY_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <string.h>
+#include <stdint.h>
+#include <atomic>
+
+#include <common/mavlink.h>
+
+#include "clock_service.h"
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// Samples kept of each message, over a second at the rates asked for
+#define HISTORY_ATTITUDE_LENGTH 64
+#define HISTORY_POSITION_LENGTH 64
+#define HISTORY_IMU_LENGTH      256
+
+// A time after the newest sample still gets the newest sample within this
+#define HISTORY_HOLD_USEC 50000
+
+// A query that keeps losing its samples to the writer gives up after this
+#define HISTORY_READ_ATTEMPTS 4
+
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+// The sample a fraction f of the way from a to b, angles take the short way
+void history_interpolate(const mavlink_attitude_t &a, const mavlink_attitude_t &b,
+                         float f, mavlink_attitude_t &out);
+void history_interpolate(const mavlink_local_position_ned_t &a, const mavlink_local_position_ned_t &b,
+                         float f, mavlink_local_position_ned_t &out);
+void history_interpolate(const mavlink_highres_imu_t &a, const mavlink_highres_imu_t &b,
+                         float f, mavlink_highres_imu_t &out);
+
+
+// ----------------------------------------------------------------------------------
+//   History Class
+// ----------------------------------------------------------------------------------
+/*
+ * History Class
+ *
+ * A ring of the last N samples of one message, each with the local time
+ * it was taken at. Every slot is a sequence lock like a Snapshot, and
+ * count is the number of samples pushed so far, so sample i is in slot
+ * i % N until sample i + N is pushed over it.
+ *
+ * at() finds the two samples around a time with a binary search over the
+ * ring and interpolates between them. That is at most log2(N) slot reads
+ * and never a lock. A read that raced the writer is retried, the writer
+ * never waits on the readers.
+ *
+ * Only one thread may push(), and the times it pushes have to increase.
+ */
+template <typename T, int N>
+class History
+{
+
+public:
+
+	History()
+	{
+		count = 0;
+		for ( int i = 0; i < N; i++ )
+		{
+			slots[i].sequence  = 0;
+			slots[i].time_usec = 0;
+			memset(&slots[i].value, 0, sizeof(T));
+		}
+	}
+
+	// Returns false if the sample is not newer than the newest one
+	bool
+	push(const T &value, uint64_t time_usec)
+	{
+		uint64_t n = count.load(std::memory_order_relaxed);
+		if ( n && time_usec <= slots[(n - 1) % N].time_usec )
+			return false;
+
+		Slot &slot = slots[n % N];
+		unsigned int seq = slot.sequence.load(std::memory_order_relaxed);
+		slot.sequence.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		slot.time_usec = time_usec;
+		memcpy(&slot.value, &value, sizeof(T));
+
+		slot.sequence.store(seq + 2, std::memory_order_release);
+		count.store(n + 1, std::memory_order_release);
+		return true;
+	}
+
+	// The state at time_usec, false if the history does not cover it
+	bool
+	at(uint64_t time_usec, T &value) const
+	{
+		for ( int attempt = 0; attempt < HISTORY_READ_ATTEMPTS; attempt++ )
+		{
+			uint64_t n = count.load(std::memory_order_acquire);
+			if ( not n )
+				return false;
+
+			// the oldest slot is left to the writer, it is the next one overwritten
+			uint64_t newest = n - 1;
+			uint64_t oldest = n > N - 1 ? n - (N - 1) : 0;
+
+			uint64_t newest_usec, oldest_usec;
+			T a, b;
+
+			if ( not read_slot(newest, newest_usec, &b) )
+				continue;
+			if ( time_usec >= newest_usec )
+			{
+				if ( time_usec - newest_usec > HISTORY_HOLD_USEC )
+					return false;
+				value = b;
+				return true;
+			}
+
+			if ( not read_slot(oldest, oldest_usec, NULL) )
+				continue;
+			if ( time_usec < oldest_usec )
+				return false;
+
+			// time(lo) <= time_usec < time(hi)
+			uint64_t lo = oldest, hi = newest, lo_usec = oldest_usec, hi_usec = newest_usec;
+			bool raced = false;
+			while ( hi - lo > 1 )
+			{
+				uint64_t mid = lo + (hi - lo) / 2, mid_usec;
+				if ( not read_slot(mid, mid_usec, NULL) )
+				{
+					raced = true;
+					break;
+				}
+				if ( mid_usec <= time_usec )
+				{
+					lo = mid;
+					lo_usec = mid_usec;
+				}
+				else
+				{
+					hi = mid;
+					hi_usec = mid_usec;
+				}
+			}
+			if ( raced )
+				continue;
+
+			if ( not read_slot(lo, lo_usec, &a) || not read_slot(hi, hi_usec, &b) )
+				continue;
+
+			float f = (float) (time_usec - lo_usec) / (float) (hi_usec - lo_usec);
+			history_interpolate(a, b, f, value);
+			return true;
+		}
+
+		return false;
+	}
+
+	// The newest sample and its time, false if there is none
+	bool
+	latest(T &value, uint64_t &time_usec) const
+	{
+		for ( int attempt = 0; attempt < HISTORY_READ_ATTEMPTS; attempt++ )
+		{
+			uint64_t n = count.load(std::memory_order_acquire);
+			if ( not n )
+				return false;
+			if ( read_slot(n - 1, time_usec, &value) )
+				return true;
+		}
+		return false;
+	}
+
+	uint64_t
+	size() const
+	{
+		uint64_t n = count.load(std::memory_order_acquire);
+		return n < N ? n : N;
+	}
+
+private:
+
+	struct Slot
+	{
+		std::atomic<unsigned int> sequence;
+		uint64_t time_usec;
+		T        value;
+	};
+
+	Slot slots[N];
+	std::atomic<uint64_t> count;
+
+	// Copies sample i out, false if it was being written or is gone
+	bool
+	read_slot(uint64_t i, uint64_t &time_usec, T *value) const
+	{
+		const Slot &slot = slots[i % N];
+
+		unsigned int before = slot.sequence.load(std::memory_order_acquire);
+		if ( before & 1 )
+			return false;
+
+		time_usec = slot.time_usec;
+		if ( value )
+			memcpy(value, &slot.value, sizeof(T));
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		unsigned int after = slot.sequence.load(std::memory_order_relaxed);
+
+		// not written while copying, and sample i + N was not in it before
+		return before == after && count.load(std::memory_order_acquire) <= i + N;
+	}
+
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Vehicle History Class
+// ----------------------------------------------------------------------------------
+/*
+ * Vehicle History Class
+ *
+ * The histories the Autopilot_Interface keeps. Each sample is stamped
+ * with the time the autopilot took it, converted to the local clock by the
+ * clock service. Until the clocks are synced the time it arrived is used,
+ * which is late by the time it spent on the link.
+ *
+ * add() is called by the event loop, the histories can be read from any
+ * thread.
+ */
+class Vehicle_History
+{
+
+public:
+
+	Vehicle_History();
+	~Vehicle_History();
+
+	const Clock_Service *clock;
+
+	History<mavlink_attitude_t,           HISTORY_ATTITUDE_LENGTH> attitude;
+	History<mavlink_local_position_ned_t, HISTORY_POSITION_LENGTH> local_position_ned;
+	History<mavlink_highres_imu_t,        HISTORY_IMU_LENGTH>      highres_imu;
+
+	void add(const mavlink_attitude_t &message, uint64_t arrival_usec);
+	void add(const mavlink_local_position_ned_t &message, uint64_t arrival_usec);
+	void add(const mavlink_highres_imu_t &message, uint64_t arrival_usec);
+
+private:
+
+	uint64_t stamp(uint64_t autopilot_usec, uint64_t arrival_usec) const;
+
+};
+
+
+// ------------------------------------------------------------------------------
+//   Router Callback
+// ------------------------------------------------------------------------------
+
+// Adds every message of one ID to the history given as the context
+template <typename T, void (*Decode)(const mavlink_message_t*, T*)>
+void
+history_callback(const mavlink_message_t &message, uint64_t time_usec, void *context)
+{
+	T decoded;
+	Decode(&message, &decoded);
+	((Vehicle_History*) context)->add(decoded, time_usec);
+}
+
+
+#endif // STATE_HISTORY_H_
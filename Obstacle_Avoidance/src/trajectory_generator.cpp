@@ -0,0 +1,198 @@
+/**
+ * @file trajectory_generator.cpp
+ *
+ * @brief Trajectory generator functions
+ *
+ * Turns the velocity setpoints of the vision decisions, which change in
+ * steps and only a few times a second, into a smooth stream of setpoints
+ * that is sent at a fixed rate
+ *
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "trajectory_generator.h"
+
+#include <string.h>
+
+
+// ----------------------------------------------------------------------------------
+//   Trajectory Generator Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Trajectory_Generator::
+Trajectory_Generator()
+{
+	max_accel     = TRAJECTORY_MAX_ACCEL;
+	max_jerk      = TRAJECTORY_MAX_JERK;
+	max_yaw_accel = TRAJECTORY_MAX_YAW_ACCEL;
+	max_yaw_jerk  = TRAJECTORY_MAX_YAW_JERK;
+	feed_forward  = true;
+
+	reset();
+}
+
+Trajectory_Generator::
+~Trajectory_Generator()
+{}
+
+
+// ------------------------------------------------------------------------------
+//   Target
+// ------------------------------------------------------------------------------
+void
+Trajectory_Generator::
+set_target(const mavlink_set_position_target_local_ned_t &setpoint, uint64_t time_usec)
+{
+	target.publish(setpoint, time_usec);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Reset
+// ------------------------------------------------------------------------------
+// Starts over from rest, the next step is not integrated
+void
+Trajectory_Generator::
+reset()
+{
+	memset(velocity, 0, sizeof(velocity));
+	memset(accel,    0, sizeof(accel));
+	memset(goal,     0, sizeof(goal));
+	last_usec = 0;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Step
+// ------------------------------------------------------------------------------
+mavlink_set_position_target_local_ned_t
+Trajectory_Generator::
+step(uint64_t now_usec)
+{
+	mavlink_set_position_target_local_ned_t sp;
+	target.read(sp);
+
+	// time since the last step, a stall is not made up for in one jump, and
+	// the time sitting on the target was not spent moving
+	uint64_t elapsed = last_usec && not settled() ? now_usec - last_usec : 0;
+	if ( elapsed > TRAJECTORY_MAX_STEP_USEC )
+		elapsed = TRAJECTORY_MAX_STEP_USEC;
+	float dt = elapsed / 1000000.0f;
+	last_usec = now_usec;
+
+	// --------------------------------------------------------------------------
+	//   VELOCITY
+	// --------------------------------------------------------------------------
+	if ( (sp.type_mask & SETPOINT_IGNORE_VELOCITY) == SETPOINT_IGNORE_VELOCITY )
+	{
+		for ( int i = 0; i < 3; i++ )
+			velocity[i] = accel[i] = goal[i] = 0;
+	}
+	else
+	{
+		goal[0] = sp.vx;
+		goal[1] = sp.vy;
+		goal[2] = sp.vz;
+
+		for ( int i = 0; i < 3; i++ )
+			follow(goal[i], velocity[i], accel[i], max_accel, max_jerk, dt);
+
+		sp.vx = velocity[0];
+		sp.vy = velocity[1];
+		sp.vz = velocity[2];
+
+		if ( feed_forward and (sp.type_mask & SETPOINT_IGNORE_ACCELERATION) )
+		{
+			sp.type_mask &= ~(SETPOINT_IGNORE_ACCELERATION | SETPOINT_FORCE);
+			sp.afx = accel[0];
+			sp.afy = accel[1];
+			sp.afz = accel[2];
+		}
+	}
+
+	// --------------------------------------------------------------------------
+	//   YAW RATE
+	// --------------------------------------------------------------------------
+	if ( sp.type_mask & SETPOINT_IGNORE_YAW_RATE )
+		velocity[3] = accel[3] = goal[3] = 0;
+	else
+	{
+		goal[3] = sp.yaw_rate;
+		follow(goal[3], velocity[3], accel[3], max_yaw_accel, max_yaw_jerk, dt);
+		sp.yaw_rate = velocity[3];
+	}
+
+	return sp;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Settled
+// ------------------------------------------------------------------------------
+// The last step reached the target in every axis
+bool
+Trajectory_Generator::
+settled() const
+{
+	for ( int i = 0; i < TRAJECTORY_AXES; i++ )
+		if ( velocity[i] != goal[i] or accel[i] != 0 )
+			return false;
+	return true;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Follow
+// ------------------------------------------------------------------------------
+/*
+ * Moves one axis towards its goal for dt seconds.
+ *
+ * Taking the acceleration a back to zero at the jerk limit j changes the
+ * velocity by a^2 / 2j more, so the acceleration wanted for an error e is
+ * sqrt(2 j e), capped at the acceleration limit. The acceleration moves
+ * towards it by at most j dt, which limits the jerk, and the velocity
+ * lands on the goal as the acceleration reaches zero. A step that would
+ * go past the goal lands on it instead, once the acceleration left is
+ * small enough to drop in one step.
+ */
+void
+Trajectory_Generator::
+follow(float goal, float &velocity, float &accel, float max_accel, float max_jerk, float dt)
+{
+	if ( dt <= 0 )
+		return;
+
+	float error  = goal - velocity;
+	float wanted = sqrtf(2 * max_jerk * fabsf(error));
+	if ( wanted > max_accel )
+		wanted = max_accel;
+	if ( error < 0 )
+		wanted = -wanted;
+
+	float change = max_jerk * dt;
+	if ( wanted > accel + change )
+		accel += change;
+	else if ( wanted < accel - change )
+		accel -= change;
+	else
+		accel = wanted;
+
+	float next = velocity + accel * dt;
+
+	// reached or passed the goal, with little enough acceleration left to
+	// drop it within the jerk limit
+	if ( (goal - next) * error <= 0 and fabsf(accel) <= change )
+	{
+		velocity = goal;
+		accel    = 0;
+	}
+	else
+		velocity = next;
+}
@@ -0,0 +1,112 @@
+/**
+ * @file trajectory_generator.h
+ *
+ * @brief Trajectory generator definition
+ *
+ * Turns the velocity setpoints of the vision decisions, which change in
+ * steps and only a few times a second, into a smooth stream of setpoints
+ * that is sent at a fixed rate
+ *
+ */
+
+#ifndef TRAJECTORY_GENERATOR_H_
+#define TRAJECTORY_GENERATOR_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <stdint.h>
+#include <math.h>
+
+#include <common/mavlink.h>
+
+#include "snapshot.h"
+#include "setpoint_builder.h"
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// Default limits of the velocity (m/s^2, m/s^3) and yaw rate (rad/s^2, rad/s^3)
+#define TRAJECTORY_MAX_ACCEL     1.5f
+#define TRAJECTORY_MAX_JERK      3.0f
+#define TRAJECTORY_MAX_YAW_ACCEL 1.0f
+#define TRAJECTORY_MAX_YAW_JERK  2.0f
+
+// Longest step that is integrated at once, a later step is taken as this long
+#define TRAJECTORY_MAX_STEP_USEC 100000
+
+// The axes that are followed: vx, vy, vz and the yaw rate
+#define TRAJECTORY_AXES 4
+
+
+// ----------------------------------------------------------------------------------
+//   Trajectory Generator Class
+// ----------------------------------------------------------------------------------
+/*
+ * Trajectory Generator Class
+ *
+ * set_target() takes the setpoint of the latest vision decision and step()
+ * returns the setpoint to send now. The velocity and the yaw rate of the
+ * output follow the target with their acceleration and jerk limited, the
+ * acceleration eases off as the velocity gets close to the target so it
+ * lands there without overshooting. Every other field of the target,
+ * including the yaw angle, is passed through as it is.
+ *
+ * With feed_forward set the acceleration of the step is sent along with
+ * its velocity, so the autopilot does not wait for a velocity error to
+ * build up before it tilts. A target with an acceleration of its own
+ * keeps it.
+ *
+ * A target that ignores the velocity (or the yaw rate) is passed through
+ * unchanged and the vehicle is taken to be at rest in that axis from then
+ * on.
+ *
+ * settled() tells the sender when the last step reached the target, so it
+ * can slow down to a keep-alive. The time spent settled is not integrated
+ * by the next step, however long it was.
+ *
+ * set_target() may be called from any one thread at a time, and step(),
+ * reset() and settled() only from the thread that sends the setpoints.
+ */
+class Trajectory_Generator
+{
+
+public:
+
+	Trajectory_Generator();
+	~Trajectory_Generator();
+
+	float max_accel;       // m/s^2
+	float max_jerk;        // m/s^3
+	float max_yaw_accel;   // rad/s^2
+	float max_yaw_jerk;    // rad/s^3
+	bool  feed_forward;    // send the acceleration of each step
+
+	void set_target(const mavlink_set_position_target_local_ned_t &setpoint, uint64_t time_usec);
+
+	mavlink_set_position_target_local_ned_t step(uint64_t now_usec);
+	void reset();
+
+	bool settled() const;
+
+private:
+
+	Snapshot<mavlink_set_position_target_local_ned_t> target;
+
+	// output of the last step, sender only
+	float    velocity[TRAJECTORY_AXES];
+	float    accel[TRAJECTORY_AXES];
+	float    goal[TRAJECTORY_AXES];
+	uint64_t last_usec;
+
+	static void follow(float goal, float &velocity, float &accel,
+	                   float max_accel, float max_jerk, float dt);
+
+};
+
+
+#endif // TRAJECTORY_GENERATOR_H_
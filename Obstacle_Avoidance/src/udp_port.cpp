@@ -0,0 +1,187 @@
+/**
+ * @file udp_port.cpp
+ *
+ * @brief UDP interface functions
+ *
+ * Talks MAVLink over UDP, to a simulated autopilot (SITL) or a MAVLink
+ * router on this computer
+ *
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "udp_port.h"
+
+
+// ----------------------------------------------------------------------------------
+//   UDP Port Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+UDP_Port::
+UDP_Port(const char *target_ip_, int rx_port_)
+{
+	initialize_defaults();
+	target_ip = target_ip_;
+	rx_port   = rx_port_;
+}
+
+UDP_Port::
+UDP_Port()
+{
+	initialize_defaults();
+}
+
+UDP_Port::
+~UDP_Port()
+{}
+
+void
+UDP_Port::
+initialize_defaults()
+{
+	// Initialize attributes
+	target_ip = "127.0.0.1";
+	rx_port   = UDP_PORT_DEFAULT_RX;
+	tx_port   = 0;
+
+	memset(&remote, 0, sizeof(remote));
+	remote_port = 0;
+	unknown_remote_reported = false;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Open UDP Port
+// ------------------------------------------------------------------------------
+/**
+ * throws EXIT_FAILURE if could not open the port
+ */
+void
+UDP_Port::
+open_port()
+{
+	printf("OPEN UDP PORT\n");
+
+	fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+	if ( fd < 0 )
+	{
+		printf("failure, could not create socket.\n");
+		throw EXIT_FAILURE;
+	}
+
+	// listen on every address of this computer
+	struct sockaddr_in local;
+	memset(&local, 0, sizeof(local));
+	local.sin_family      = AF_INET;
+	local.sin_addr.s_addr = htonl(INADDR_ANY);
+	local.sin_port        = htons(rx_port);
+
+	if ( bind(fd, (struct sockaddr *) &local, sizeof(local)) < 0 )
+	{
+		printf("failure, could not bind udp port %d.\n", rx_port);
+		close(fd);
+		fd = -1;
+		throw EXIT_FAILURE;
+	}
+
+	// send to the autopilot
+	remote.sin_family = AF_INET;
+	if ( inet_pton(AF_INET, target_ip, &remote.sin_addr) != 1 )
+	{
+		printf("failure, %s is not an IPv4 address.\n", target_ip);
+		close(fd);
+		fd = -1;
+		throw EXIT_FAILURE;
+	}
+	remote_port = tx_port;
+
+	printf("Listening on udp port %d for %s\n", rx_port, target_ip);
+
+	status = PORT_OPEN;
+
+	printf("\n");
+
+	return;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Close UDP Port
+// ------------------------------------------------------------------------------
+void
+UDP_Port::
+close_port()
+{
+	printf("CLOSE UDP PORT\n");
+
+	int result = close(fd);
+
+	if ( result )
+	{
+		fprintf(stderr,"WARNING: Error on port close (%i)\n", result );
+	}
+
+	status = PORT_CLOSED;
+
+	printf("\n");
+}
+
+
+// ------------------------------------------------------------------------------
+//   Receive Datagram
+// ------------------------------------------------------------------------------
+// One datagram per call, and remembers the port the autopilot sends from
+int
+UDP_Port::
+_receive(const struct iovec *iov, int iovcnt)
+{
+	struct sockaddr_in sender;
+	struct msghdr      header;
+	memset(&header, 0, sizeof(header));
+	header.msg_name    = &sender;
+	header.msg_namelen = sizeof(sender);
+	header.msg_iov     = (struct iovec *) iov;
+	header.msg_iovlen  = iovcnt;
+
+	int result = recvmsg(fd, &header, 0);
+
+	if ( result > 0 && not remote_port &&
+	     sender.sin_addr.s_addr == remote.sin_addr.s_addr )
+	{
+		remote_port = ntohs(sender.sin_port);
+		printf("Got autopilot at %s:%d\n", target_ip, (int) remote_port);
+	}
+
+	return result;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Send Datagram
+// ------------------------------------------------------------------------------
+int
+UDP_Port::
+_send(const uint8_t *buf, unsigned len)
+{
+	int port = remote_port;
+	if ( not port )
+	{
+		if ( not unknown_remote_reported )
+			fprintf(stderr,"WARNING: nothing received from %s yet, not sending\n", target_ip);
+		unknown_remote_reported = true;
+
+		// drop it, the autopilot has not been heard from
+		return len;
+	}
+
+	struct sockaddr_in to = remote;
+	to.sin_port = htons(port);
+
+	return static_cast<int>(sendto(fd, buf, len, 0, (struct sockaddr *) &to, sizeof(to)));
+}
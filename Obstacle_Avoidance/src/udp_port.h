@@ -0,0 +1,80 @@
+/**
+ * @file udp_port.h
+ *
+ * @brief UDP interface definition
+ *
+ * Talks MAVLink over UDP, to a simulated autopilot (SITL) or a MAVLink
+ * router on this computer
+ *
+ */
+
+#ifndef UDP_PORT_H_
+#define UDP_PORT_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <atomic>
+
+#include "generic_port.h"
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// PX4 SITL sends offboard MAVLink to this port
+#define UDP_PORT_DEFAULT_RX 14540
+
+
+// ----------------------------------------------------------------------------------
+//   UDP Port Class
+// ----------------------------------------------------------------------------------
+/*
+ * UDP Port Class
+ *
+ * Binds rx_port on this computer and listens for the autopilot. Messages
+ * are sent back to target_ip, at whichever port the autopilot sent from
+ * (or tx_port if it is set before start()), so nothing is sent until the
+ * first message has arrived.
+ */
+class UDP_Port: public Generic_Port
+{
+
+public:
+
+	UDP_Port();
+	UDP_Port(const char *target_ip_, int rx_port_);
+	void initialize_defaults();
+	~UDP_Port();
+
+	const char *target_ip;
+	int  rx_port;
+	int  tx_port;  // 0 to answer the port the autopilot sends from
+
+protected:
+
+	void open_port();
+	void close_port();
+
+	int _receive(const struct iovec *iov, int iovcnt);
+	int _send(const uint8_t *buf, unsigned len);
+
+private:
+
+	struct sockaddr_in remote;        // target_ip, the port is in remote_port
+	std::atomic<int>   remote_port;   // learned by the reader, used by the writer
+	bool unknown_remote_reported;
+
+};
+
+
+
+#endif // UDP_PORT_H_
@@ -0,0 +1,601 @@
+/**
+ * @file fake_autopilot.cpp
+ *
+ * @brief Fake autopilot functions
+ *
+ * A stand-in for the Pixhawk that talks MAVLink over any Generic_Port, so
+ * the Autopilot_Interface stack can be run and measured without the
+ * aircraft
+ *
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "fake_autopilot.h"
+#include "clock_service.h"  // get_monotonic_usec()
+
+#include <poll.h>
+#include <string.h>
+#include <math.h>
+
+
+// ----------------------------------------------------------------------------------
+//   Fake Autopilot Class
+// ----------------------------------------------------------------------------------
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Fake_Autopilot::
+Fake_Autopilot(Generic_Port *port_)
+{
+	initialize_defaults();
+	port = port_;
+}
+
+Fake_Autopilot::
+Fake_Autopilot()
+{
+	initialize_defaults();
+}
+
+Fake_Autopilot::
+~Fake_Autopilot()
+{}
+
+void
+Fake_Autopilot::
+initialize_defaults()
+{
+	// Initialize attributes
+	port = NULL;
+
+	system_id    = 1;  // like a Pixhawk out of the box
+	component_id = 1;
+
+	setpoints_received = 0;
+	commands_received  = 0;
+	messages_received  = 0;
+
+	time_to_exit = false;
+	fake_tid     = 0;
+	boot_usec    = get_monotonic_usec();
+	clock_drift_ppm = 0;
+
+	num_streams = 0;
+
+	base_mode   = MAV_MODE_FLAG_CUSTOM_MODE_ENABLED;
+	custom_mode = 0;
+
+	memset(position, 0, sizeof(position));
+	memset(velocity, 0, sizeof(velocity));
+	position_usec = 0;
+
+	// the default streams
+	set_rate(MAVLINK_MSG_ID_HEARTBEAT,           1);
+	set_rate(MAVLINK_MSG_ID_SYS_STATUS,          2);
+	set_rate(MAVLINK_MSG_ID_ATTITUDE,           50);
+	set_rate(MAVLINK_MSG_ID_LOCAL_POSITION_NED, 30);
+	set_rate(MAVLINK_MSG_ID_HIGHRES_IMU,        50);
+	set_rate(MAVLINK_MSG_ID_GLOBAL_POSITION_INT, 0);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Set Stream Rate
+// ------------------------------------------------------------------------------
+// Returns 0, or -1 if the message can not be streamed or the table is full
+int
+Fake_Autopilot::
+set_rate(uint32_t msgid, float rate_hz)
+{
+	switch ( msgid )
+	{
+		case MAVLINK_MSG_ID_HEARTBEAT:
+		case MAVLINK_MSG_ID_SYS_STATUS:
+		case MAVLINK_MSG_ID_ATTITUDE:
+		case MAVLINK_MSG_ID_LOCAL_POSITION_NED:
+		case MAVLINK_MSG_ID_HIGHRES_IMU:
+		case MAVLINK_MSG_ID_GLOBAL_POSITION_INT:
+			break;
+
+		default:
+			return -1;
+	}
+
+	if ( rate_hz < 0 )
+		rate_hz = 0;
+
+	for ( int i = 0; i < num_streams; i++ )
+	{
+		if ( streams[i].msgid == msgid )
+		{
+			streams[i].rate_hz   = rate_hz;
+			streams[i].next_usec = 0;
+			return 0;
+		}
+	}
+
+	if ( num_streams == FAKE_AUTOPILOT_MAX_STREAMS )
+		return -1;
+
+	Fake_Stream &stream = streams[num_streams++];
+	stream.msgid     = msgid;
+	stream.rate_hz   = rate_hz;
+	stream.next_usec = 0;
+	stream.sent      = 0;
+
+	return 0;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Print Statistics
+// ------------------------------------------------------------------------------
+void
+Fake_Autopilot::
+print_stats()
+{
+	printf("FAKE AUTOPILOT\n");
+	printf("    messages received  : %lu\n", (unsigned long) messages_received);
+	printf("    setpoints received : %lu\n", (unsigned long) setpoints_received);
+	printf("    commands received  : %lu\n", (unsigned long) commands_received);
+	for ( int i = 0; i < num_streams; i++ )
+	{
+		if ( streams[i].sent )
+			printf("    message %3u sent   : %lu at %.1f Hz\n", streams[i].msgid,
+			       (unsigned long) streams[i].sent, streams[i].rate_hz);
+	}
+	printf("\n");
+}
+
+
+// ------------------------------------------------------------------------------
+//   Start Fake Autopilot
+// ------------------------------------------------------------------------------
+void
+Fake_Autopilot::
+start()
+{
+	int result;
+
+	if ( not port or port->status != PORT_OPEN )
+	{
+		fprintf(stderr,"ERROR: port not open\n");
+		throw EXIT_FAILURE;
+	}
+
+	printf("START FAKE AUTOPILOT %d:%d\n", system_id, component_id);
+
+	time_to_exit = false;
+	result = pthread_create( &fake_tid, NULL, &start_fake_autopilot_thread, this );
+	if ( result ) throw result;
+
+	printf("\n");
+}
+
+
+// ------------------------------------------------------------------------------
+//   Stop Fake Autopilot
+// ------------------------------------------------------------------------------
+void
+Fake_Autopilot::
+stop()
+{
+	printf("CLOSE FAKE AUTOPILOT\n");
+
+	// the thread wakes up at least every heartbeat to check this
+	time_to_exit = true;
+
+	if ( fake_tid )
+		pthread_join(fake_tid, NULL);
+	fake_tid = 0;
+
+	printf("\n");
+}
+
+
+// ------------------------------------------------------------------------------
+//   Fake Autopilot Thread
+// ------------------------------------------------------------------------------
+void
+Fake_Autopilot::
+start_fake_thread()
+{
+	fake_thread();
+}
+
+void
+Fake_Autopilot::
+fake_thread()
+{
+	struct pollfd pfd;
+	pfd.fd     = port->file_descriptor();
+	pfd.events = POLLIN;
+
+	mavlink_message_t messages[PORT_RX_BATCH];
+
+	while ( not time_to_exit )
+	{
+		// ----------------------------------------------------------------------
+		//   WAIT FOR THE PORT OR THE NEXT STREAM
+		// ----------------------------------------------------------------------
+
+		uint64_t now  = get_monotonic_usec();
+		uint64_t next = next_due_usec();
+		uint64_t wait = next > now ? next - now : 0;
+
+		// never sleep so long that stop() has to wait on it
+		if ( wait > 100000 )
+			wait = 100000;
+
+		struct timespec timeout;
+		timeout.tv_sec  = wait / 1000000;
+		timeout.tv_nsec = (wait % 1000000) * 1000;
+
+		int result = ppoll(&pfd, 1, &timeout, NULL);
+		if ( result < 0 && errno != EINTR )
+		{
+			fprintf(stderr,"ERROR: fake autopilot could not poll the port\n");
+			return;
+		}
+
+		// ----------------------------------------------------------------------
+		//   ANSWER
+		// ----------------------------------------------------------------------
+
+		if ( result > 0 && (pfd.revents & POLLIN) )
+		{
+			do
+			{
+				int count = port->read_messages(messages, PORT_RX_BATCH);
+				for ( int i = 0; i < count; i++ )
+					handle_message(messages[i]);
+			}
+			while ( port->rx_pending() and not time_to_exit );
+		}
+
+		// ----------------------------------------------------------------------
+		//   STREAM
+		// ----------------------------------------------------------------------
+
+		send_streams(get_monotonic_usec());
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Next Due Stream
+// ------------------------------------------------------------------------------
+uint64_t
+Fake_Autopilot::
+next_due_usec()
+{
+	uint64_t next = UINT64_MAX;
+
+	for ( int i = 0; i < num_streams; i++ )
+	{
+		if ( streams[i].rate_hz > 0 && streams[i].next_usec < next )
+			next = streams[i].next_usec;
+	}
+
+	return next;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Send Due Streams
+// ------------------------------------------------------------------------------
+void
+Fake_Autopilot::
+send_streams(uint64_t now)
+{
+	integrate(now);
+
+	for ( int i = 0; i < num_streams; i++ )
+	{
+		Fake_Stream &stream = streams[i];
+
+		if ( stream.rate_hz <= 0 || stream.next_usec > now )
+			continue;
+
+		send_stream(stream.msgid, now);
+		stream.sent++;
+
+		// keep to the rate, but do not try to catch up after a stall
+		uint64_t period = (uint64_t) (1000000.0f / stream.rate_hz);
+		stream.next_usec = stream.next_usec ? stream.next_usec + period : now + period;
+		if ( stream.next_usec < now )
+			stream.next_usec = now + period;
+	}
+}
+
+void
+Fake_Autopilot::
+send_stream(uint32_t msgid, uint64_t now)
+{
+	mavlink_message_t message;
+	uint32_t time_boot_ms = (uint32_t) (boot_time_usec(now) / 1000);
+
+	switch ( msgid )
+	{
+		case MAVLINK_MSG_ID_HEARTBEAT:
+		{
+			mavlink_heartbeat_t heartbeat;
+			memset(&heartbeat, 0, sizeof(heartbeat));
+			heartbeat.type          = MAV_TYPE_QUADROTOR;
+			heartbeat.autopilot     = MAV_AUTOPILOT_PX4;
+			heartbeat.base_mode     = base_mode;
+			heartbeat.custom_mode   = custom_mode;
+			heartbeat.system_status = MAV_STATE_ACTIVE;
+			heartbeat.mavlink_version = 3;
+			mavlink_msg_heartbeat_encode_chan(system_id, component_id, port->channel(), &message, &heartbeat);
+			break;
+		}
+
+		case MAVLINK_MSG_ID_SYS_STATUS:
+		{
+			mavlink_sys_status_t sys_status;
+			memset(&sys_status, 0, sizeof(sys_status));
+			sys_status.load              = 250;    // 25%
+			sys_status.voltage_battery   = 12600;  // mV
+			sys_status.current_battery   = -1;
+			sys_status.battery_remaining = 100;
+			mavlink_msg_sys_status_encode_chan(system_id, component_id, port->channel(), &message, &sys_status);
+			break;
+		}
+
+		case MAVLINK_MSG_ID_ATTITUDE:
+		{
+			mavlink_attitude_t attitude;
+			memset(&attitude, 0, sizeof(attitude));
+			attitude.time_boot_ms = time_boot_ms;
+			mavlink_msg_attitude_encode_chan(system_id, component_id, port->channel(), &message, &attitude);
+			break;
+		}
+
+		case MAVLINK_MSG_ID_LOCAL_POSITION_NED:
+		{
+			mavlink_local_position_ned_t local_position;
+			memset(&local_position, 0, sizeof(local_position));
+			local_position.time_boot_ms = time_boot_ms;
+			local_position.x  = position[0];
+			local_position.y  = position[1];
+			local_position.z  = position[2];
+			local_position.vx = velocity[0];
+			local_position.vy = velocity[1];
+			local_position.vz = velocity[2];
+			mavlink_msg_local_position_ned_encode_chan(system_id, component_id, port->channel(), &message, &local_position);
+			break;
+		}
+
+		case MAVLINK_MSG_ID_HIGHRES_IMU:
+		{
+			mavlink_highres_imu_t highres_imu;
+			memset(&highres_imu, 0, sizeof(highres_imu));
+			highres_imu.time_usec = boot_time_usec(now);
+			highres_imu.zacc      = -9.81f;
+			highres_imu.fields_updated = 0x1fff;
+			mavlink_msg_highres_imu_encode_chan(system_id, component_id, port->channel(), &message, &highres_imu);
+			break;
+		}
+
+		case MAVLINK_MSG_ID_GLOBAL_POSITION_INT:
+		{
+			mavlink_global_position_int_t global_position;
+			memset(&global_position, 0, sizeof(global_position));
+			global_position.time_boot_ms = time_boot_ms;
+			global_position.relative_alt = (int32_t) (-position[2] * 1000);
+			global_position.vx = (int16_t) (velocity[0] * 100);
+			global_position.vy = (int16_t) (velocity[1] * 100);
+			global_position.vz = (int16_t) (velocity[2] * 100);
+			mavlink_msg_global_position_int_encode_chan(system_id, component_id, port->channel(), &message, &global_position);
+			break;
+		}
+
+		default:
+			return;
+	}
+
+	write(message);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Handle Message
+// ------------------------------------------------------------------------------
+void
+Fake_Autopilot::
+handle_message(const mavlink_message_t &message)
+{
+	messages_received++;
+
+	switch ( message.msgid )
+	{
+		case MAVLINK_MSG_ID_COMMAND_LONG:
+		{
+			mavlink_command_long_t command;
+			mavlink_msg_command_long_decode(&message, &command);
+			if ( command.target_system == system_id )
+				handle_command(command);
+			break;
+		}
+
+		case MAVLINK_MSG_ID_SET_POSITION_TARGET_LOCAL_NED:
+		{
+			mavlink_set_position_target_local_ned_t sp;
+			mavlink_msg_set_position_target_local_ned_decode(&message, &sp);
+			if ( sp.target_system == system_id )
+				handle_setpoint(sp);
+			break;
+		}
+
+		case MAVLINK_MSG_ID_TIMESYNC:
+		{
+			mavlink_timesync_t timesync;
+			mavlink_msg_timesync_decode(&message, &timesync);
+			if ( timesync.tc1 == 0 )
+				handle_timesync(timesync);
+			break;
+		}
+
+		default:
+			break;
+	}
+}
+
+// Answers a TIMESYNC request with the time since boot, in nanoseconds
+void
+Fake_Autopilot::
+handle_timesync(const mavlink_timesync_t &request)
+{
+	mavlink_timesync_t timesync;
+	timesync.tc1 = (int64_t) boot_time_usec(get_monotonic_usec()) * 1000;
+	timesync.ts1 = request.ts1;
+
+	mavlink_message_t message;
+	mavlink_msg_timesync_encode_chan(system_id, component_id, port->channel(), &message, &timesync);
+	write(message);
+}
+
+// The clock of the fake, which runs clock_drift_ppm fast
+uint64_t
+Fake_Autopilot::
+boot_time_usec(uint64_t now) const
+{
+	double elapsed = (double) (now - boot_usec);
+	return (uint64_t) (elapsed + elapsed * clock_drift_ppm / 1000000.0);
+}
+
+void
+Fake_Autopilot::
+handle_command(const mavlink_command_long_t &command)
+{
+	commands_received++;
+
+	uint8_t result = MAV_RESULT_ACCEPTED;
+
+	switch ( command.command )
+	{
+		case MAV_CMD_NAV_GUIDED_ENABLE:
+			if ( command.param1 > 0.5f )
+			{
+				base_mode  |= MAV_MODE_FLAG_CUSTOM_MODE_ENABLED;
+				custom_mode = FAKE_AUTOPILOT_PX4_OFFBOARD;
+			}
+			else
+				custom_mode = 0;
+			printf("FAKE AUTOPILOT %s OFFBOARD\n", custom_mode ? "ENTERED" : "LEFT");
+			break;
+
+		case MAV_CMD_SET_MESSAGE_INTERVAL:
+		{
+			// param2 is the interval in us, -1 to stop and 0 for the default
+			uint32_t msgid = (uint32_t) command.param1;
+			float rate_hz  = command.param2 > 0 ? 1000000.0f / command.param2 : 0;
+			if ( command.param2 == 0 )
+				rate_hz = 10;
+			if ( set_rate(msgid, rate_hz) )
+				result = MAV_RESULT_UNSUPPORTED;
+			break;
+		}
+
+		default:
+			result = MAV_RESULT_UNSUPPORTED;
+			break;
+	}
+
+	mavlink_command_ack_t ack;
+	memset(&ack, 0, sizeof(ack));
+	ack.command = command.command;
+	ack.result  = result;
+
+	mavlink_message_t message;
+	mavlink_msg_command_ack_encode_chan(system_id, component_id, port->channel(), &message, &ack);
+	write(message);
+}
+
+void
+Fake_Autopilot::
+handle_setpoint(const mavlink_set_position_target_local_ned_t &sp)
+{
+	setpoints_received++;
+
+	// follow the velocity from now on
+	integrate(get_monotonic_usec());
+	velocity[0] = sp.vx;
+	velocity[1] = sp.vy;
+	velocity[2] = sp.vz;
+
+	// echo it back at once, with the sender's time_boot_ms
+	mavlink_position_target_local_ned_t target;
+	memset(&target, 0, sizeof(target));
+	target.time_boot_ms     = sp.time_boot_ms;
+	target.coordinate_frame = sp.coordinate_frame;
+	target.type_mask        = sp.type_mask;
+	target.x        = sp.x;
+	target.y        = sp.y;
+	target.z        = sp.z;
+	target.vx       = sp.vx;
+	target.vy       = sp.vy;
+	target.vz       = sp.vz;
+	target.afx      = sp.afx;
+	target.afy      = sp.afy;
+	target.afz      = sp.afz;
+	target.yaw      = sp.yaw;
+	target.yaw_rate = sp.yaw_rate;
+
+	mavlink_message_t message;
+	mavlink_msg_position_target_local_ned_encode_chan(system_id, component_id, port->channel(), &message, &target);
+	write(message);
+}
+
+
+// ------------------------------------------------------------------------------
+//   Integrate Position
+// ------------------------------------------------------------------------------
+void
+Fake_Autopilot::
+integrate(uint64_t now)
+{
+	if ( position_usec && now > position_usec )
+	{
+		float dt = (now - position_usec) / 1000000.0f;
+		for ( int i = 0; i < 3; i++ )
+			position[i] += velocity[i] * dt;
+	}
+	position_usec = now;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Write Message
+// ------------------------------------------------------------------------------
+void
+Fake_Autopilot::
+write(mavlink_message_t &message)
+{
+	if ( port->write_message(message) <= 0 )
+		fprintf(stderr,"WARNING: fake autopilot could not send message %u\n", (unsigned) message.msgid);
+}
+
+
+// ------------------------------------------------------------------------------
+//  Pthread Starter Helper Function
+// ------------------------------------------------------------------------------
+
+void*
+start_fake_autopilot_thread(void *args)
+{
+	// takes a fake autopilot object argument
+	Fake_Autopilot *fake_autopilot = (Fake_Autopilot *)args;
+
+	// run the object's thread
+	fake_autopilot->start_fake_thread();
+
+	// done!
+	return NULL;
+}
@@ -0,0 +1,152 @@
+/**
+ * @file fake_autopilot.h
+ *
+ * @brief Fake autopilot definition
+ *
+ * A stand-in for the Pixhawk that talks MAVLink over any Generic_Port, so
+ * the Autopilot_Interface stack can be run and measured without the
+ * aircraft
+ *
+ */
+
+#ifndef FAKE_AUTOPILOT_H_
+#define FAKE_AUTOPILOT_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "generic_port.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <common/mavlink.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+// Most message IDs that can be streamed at once
+#define FAKE_AUTOPILOT_MAX_STREAMS 16
+
+// PX4 custom_mode with the main mode set to offboard
+#define FAKE_AUTOPILOT_PX4_OFFBOARD (6 << 16)
+
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+void* start_fake_autopilot_thread(void *args);
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+// One message ID sent at a fixed rate
+
+struct Fake_Stream {
+
+	uint32_t msgid;
+	float    rate_hz;
+	uint64_t next_usec;  // when it is due next, 0 to send right away
+	uint64_t sent;
+
+};
+
+
+// ----------------------------------------------------------------------------------
+//   Fake Autopilot Class
+// ----------------------------------------------------------------------------------
+/*
+ * Fake Autopilot Class
+ *
+ * Runs one thread that waits on the port until the next stream is due,
+ * sends every stream that is due and answers whatever arrived. It streams
+ * HEARTBEAT, SYS_STATUS, ATTITUDE, LOCAL_POSITION_NED, HIGHRES_IMU and
+ * GLOBAL_POSITION_INT at the rates given to set_rate(), a rate of 0 stops
+ * a stream. The defaults are roughly what PX4 sends on a companion link.
+ *
+ * COMMAND_LONG is acknowledged with COMMAND_ACK. MAV_CMD_NAV_GUIDED_ENABLE
+ * switches the heartbeat in and out of offboard mode and
+ * MAV_CMD_SET_MESSAGE_INTERVAL changes the rate of a stream, any other
+ * command is answered as unsupported.
+ *
+ * Every SET_POSITION_TARGET_LOCAL_NED is echoed right away as
+ * POSITION_TARGET_LOCAL_NED with the same time_boot_ms, so the sender can
+ * match the echo to what it sent and time the round trip. The velocity of
+ * the last setpoint is integrated into the local position that is
+ * streamed, so the vehicle appears to move.
+ *
+ * TIMESYNC requests are answered with the time since boot, which runs
+ * clock_drift_ppm fast to check the drift estimate of a Clock_Service.
+ *
+ * Messages are packed on the MAVLink channel of the port, so their
+ * sequence numbers do not mix with those of an Autopilot_Interface in the
+ * same program.
+ */
+class Fake_Autopilot
+{
+
+public:
+
+	Fake_Autopilot();
+	Fake_Autopilot(Generic_Port *port_);
+	~Fake_Autopilot();
+
+	int system_id;
+	int component_id;
+
+	uint64_t setpoints_received;
+	uint64_t commands_received;
+	uint64_t messages_received;
+
+	double clock_drift_ppm;   // of the time since boot against the local clock
+
+	int  set_rate(uint32_t msgid, float rate_hz);
+	void print_stats();
+
+	void start();
+	void stop();
+
+	void start_fake_thread();
+
+private:
+
+	Generic_Port *port;
+
+	bool      time_to_exit;
+	pthread_t fake_tid;
+	uint64_t  boot_usec;
+
+	Fake_Stream streams[FAKE_AUTOPILOT_MAX_STREAMS];
+	int         num_streams;
+
+	uint8_t  base_mode;
+	uint32_t custom_mode;
+
+	float    position[3];       // local NED, integrated from the setpoint
+	float    velocity[3];       // of the last setpoint, body frame is taken as NED
+	uint64_t position_usec;
+
+	void initialize_defaults();
+	void fake_thread();
+	uint64_t next_due_usec();
+	void send_streams(uint64_t now);
+	void send_stream(uint32_t msgid, uint64_t now);
+	void handle_message(const mavlink_message_t &message);
+	void handle_command(const mavlink_command_long_t &command);
+	void handle_setpoint(const mavlink_set_position_target_local_ned_t &sp);
+	void handle_timesync(const mavlink_timesync_t &request);
+	uint64_t boot_time_usec(uint64_t now) const;
+	void integrate(uint64_t now);
+	void write(mavlink_message_t &message);
+
+};
+
+
+
+#endif // FAKE_AUTOPILOT_H_
@@ -0,0 +1,413 @@
+/**
+ * @file mavlink_benchmark.cpp
+ *
+ * @brief MAVLink round trip benchmark
+ *
+ * Runs the Autopilot_Interface stack against a Fake_Autopilot over a
+ * pseudo-terminal or UDP, and measures how long a setpoint takes to come
+ * back from the autopilot and how much telemetry gets through. With -s
+ * only the fake autopilot is run, for the main program to connect to.
+ *
+ *   mavlink_benchmark [-l pty|udp] [-n setpoints] [-r rate_hz] [-t telemetry_hz] [-s]
+ *
+ */
+
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "autopilot_interface.h"
+#include "serial_port.h"
+#include "udp_port.h"
+#include "pty_port.h"
+#include "fake_autopilot.h"
+
+#include <vector>
+#include <algorithm>
+#include <string.h>
+
+
+// ------------------------------------------------------------------------------
+//   Defines
+// ------------------------------------------------------------------------------
+
+#define LINK_UDP 1  //Both sides talk over UDP on this computer
+#define LINK_PTY 2  //The fake autopilot opens the pseudo-terminal as a serial port
+
+#define PTY_LINK "/tmp/obstacle_avoidance_pty"  //Same path as multipleOverlap.cpp
+#define PTY_BAUDRATE 921600                     //Ignored by a pseudo-terminal
+
+#define UDP_TARGET "127.0.0.1"
+#define UDP_FAKE_RX 14580                       //PX4 SITL listens on this port
+
+#define TELEMETRY_IDS 5
+
+#define FAKE_CLOCK_DRIFT_PPM 40                 //How fast the clock of the fake autopilot runs, for the TIMESYNC fit
+
+
+// ------------------------------------------------------------------------------
+//   Data Structures
+// ------------------------------------------------------------------------------
+
+// Filled in by the event loop of the interface, read once it has stopped
+
+struct Echo_Stats {
+
+	std::vector<uint64_t> sent_usec;  // by sequence number, 0 if not sent
+	std::vector<uint64_t> latency;    // round trip of each setpoint echoed
+	uint64_t duplicates;              // keep-alive resends echoed again
+
+};
+
+struct Telemetry_Counter {
+
+	uint32_t msgid;
+	const char *name;
+	uint64_t count;
+
+};
+
+
+// ------------------------------------------------------------------------------
+//   Prototypes
+// ------------------------------------------------------------------------------
+
+void parse_commandline(int argc, char **argv, int &link, int &count, float &rate, float &telemetry, bool &serve);
+void echo_callback(const mavlink_message_t &message, uint64_t time_usec, void *context);
+void count_callback(const mavlink_message_t &message, uint64_t time_usec, void *context);
+int  serve(int link, float telemetry);
+int  benchmark(int link, int count, float rate, float telemetry);
+void quit_handler( int sig );
+
+bool time_to_exit = false;
+
+
+// ------------------------------------------------------------------------------
+//   Main
+// ------------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+	int   link      = LINK_PTY;
+	int   count     = 1000;
+	float rate      = 100;
+	float telemetry = 50;
+	bool  serve_only = false;
+
+	parse_commandline(argc, argv, link, count, rate, telemetry, serve_only);
+
+	signal(SIGINT,quit_handler);	//Handles when the user hits "CTL+C"
+
+	try
+	{
+		if ( serve_only )
+			return serve(link, telemetry);
+		return benchmark(link, count, rate, telemetry);
+	}
+	catch ( int error )
+	{
+		fprintf(stderr,"mavlink_benchmark threw exception %i \n" , error);
+		return error;
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Parse Command Line
+// ------------------------------------------------------------------------------
+void parse_commandline(int argc, char **argv, int &link, int &count, float &rate, float &telemetry, bool &serve)
+{
+	const char *usage = "usage: mavlink_benchmark [-l pty|udp] [-n setpoints] [-r rate_hz] [-t telemetry_hz] [-s]";
+
+	for ( int i = 1; i < argc; i++ )
+	{
+		if ( strcmp(argv[i], "-s") == 0 )
+			serve = true;
+		else if ( i + 1 < argc && strcmp(argv[i], "-l") == 0 )
+		{
+			i++;
+			if ( strcmp(argv[i], "udp") == 0 )
+				link = LINK_UDP;
+			else if ( strcmp(argv[i], "pty") == 0 )
+				link = LINK_PTY;
+			else
+			{
+				printf("%s\n", usage);
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if ( i + 1 < argc && strcmp(argv[i], "-n") == 0 )
+			count = atoi(argv[++i]);
+		else if ( i + 1 < argc && strcmp(argv[i], "-r") == 0 )
+			rate = atof(argv[++i]);
+		else if ( i + 1 < argc && strcmp(argv[i], "-t") == 0 )
+			telemetry = atof(argv[++i]);
+		else
+		{
+			printf("%s\n", usage);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if ( count < 1 || rate <= 0 || telemetry < 0 )
+	{
+		printf("%s\n", usage);
+		exit(EXIT_FAILURE);
+	}
+}
+
+
+// ------------------------------------------------------------------------------
+//   Callbacks
+// ------------------------------------------------------------------------------
+
+// The fake autopilot echoes time_boot_ms, which carries the sequence number
+void echo_callback(const mavlink_message_t &message, uint64_t time_usec, void *context)
+{
+	uint64_t now = get_monotonic_usec();
+	Echo_Stats *stats = (Echo_Stats *) context;
+
+	mavlink_position_target_local_ned_t target;
+	mavlink_msg_position_target_local_ned_decode(&message, &target);
+
+	uint32_t sequence = target.time_boot_ms;
+	if ( sequence >= stats->sent_usec.size() || not stats->sent_usec[sequence] )
+		return;
+
+	// the keep-alive resends the last setpoint, only time the first echo
+	if ( stats->sent_usec[sequence] == UINT64_MAX )
+	{
+		stats->duplicates++;
+		return;
+	}
+
+	stats->latency.push_back(now - stats->sent_usec[sequence]);
+	stats->sent_usec[sequence] = UINT64_MAX;
+}
+
+void count_callback(const mavlink_message_t &message, uint64_t time_usec, void *context)
+{
+	((Telemetry_Counter *) context)->count++;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Serve
+// ------------------------------------------------------------------------------
+// Only the fake autopilot, until Ctrl+C
+int serve(int link, float telemetry)
+{
+	Serial_Port serial_port(PTY_LINK, PTY_BAUDRATE);
+	UDP_Port    udp_port(UDP_TARGET, UDP_FAKE_RX);
+	udp_port.tx_port = UDP_PORT_DEFAULT_RX;
+
+	Generic_Port *port = (link == LINK_UDP) ? (Generic_Port *) &udp_port : (Generic_Port *) &serial_port;
+
+	Fake_Autopilot fake_autopilot(port);
+	fake_autopilot.set_rate(MAVLINK_MSG_ID_ATTITUDE,           telemetry);
+	fake_autopilot.set_rate(MAVLINK_MSG_ID_HIGHRES_IMU,        telemetry);
+	fake_autopilot.set_rate(MAVLINK_MSG_ID_LOCAL_POSITION_NED, telemetry);
+
+	port->start();
+	fake_autopilot.start();
+
+	while ( not time_to_exit )
+		usleep(100000);
+
+	fake_autopilot.stop();
+	port->stop();
+
+	fake_autopilot.print_stats();
+
+	return 0;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Benchmark
+// ------------------------------------------------------------------------------
+int benchmark(int link, int count, float rate, float telemetry)
+{
+	// --------------------------------------------------------------------------
+	//   PORTS
+	// --------------------------------------------------------------------------
+
+	// the interface owns the pseudo-terminal like the main program does, and
+	// the fake autopilot opens the other end as if it were a Pixhawk
+	PTY_Port    pty_port(PTY_LINK);
+	Serial_Port serial_port(PTY_LINK, PTY_BAUDRATE);
+
+	UDP_Port    udp_port(UDP_TARGET, UDP_PORT_DEFAULT_RX);
+	UDP_Port    fake_udp_port(UDP_TARGET, UDP_FAKE_RX);
+	fake_udp_port.tx_port = UDP_PORT_DEFAULT_RX;
+
+	Generic_Port *port      = (link == LINK_UDP) ? (Generic_Port *) &udp_port      : (Generic_Port *) &pty_port;
+	Generic_Port *fake_port = (link == LINK_UDP) ? (Generic_Port *) &fake_udp_port : (Generic_Port *) &serial_port;
+
+	Fake_Autopilot fake_autopilot(fake_port);
+	fake_autopilot.clock_drift_ppm = FAKE_CLOCK_DRIFT_PPM;
+
+	// the interface asks the fake for these rates on start()
+	Autopilot_Interface autopilot_interface(port);
+	autopilot_interface.print_setpoints = false;
+	autopilot_interface.set_message_rate(MAVLINK_MSG_ID_ATTITUDE,           telemetry);
+	autopilot_interface.set_message_rate(MAVLINK_MSG_ID_HIGHRES_IMU,        telemetry);
+	autopilot_interface.set_message_rate(MAVLINK_MSG_ID_LOCAL_POSITION_NED, telemetry);
+
+	Echo_Stats echo;
+	echo.sent_usec.assign(count + 1, 0);
+	echo.latency.reserve(count);
+	echo.duplicates = 0;
+	autopilot_interface.subscribe(MAVLINK_MSG_ID_POSITION_TARGET_LOCAL_NED, echo_callback, &echo);
+
+	Telemetry_Counter counters[TELEMETRY_IDS] = {
+		{ MAVLINK_MSG_ID_HEARTBEAT,          "HEARTBEAT",          0 },
+		{ MAVLINK_MSG_ID_SYS_STATUS,         "SYS_STATUS",         0 },
+		{ MAVLINK_MSG_ID_ATTITUDE,           "ATTITUDE",           0 },
+		{ MAVLINK_MSG_ID_LOCAL_POSITION_NED, "LOCAL_POSITION_NED", 0 },
+		{ MAVLINK_MSG_ID_HIGHRES_IMU,        "HIGHRES_IMU",        0 },
+	};
+	for ( int i = 0; i < TELEMETRY_IDS; i++ )
+		autopilot_interface.subscribe(counters[i].msgid, count_callback, &counters[i]);
+
+
+	// --------------------------------------------------------------------------
+	//   START
+	// --------------------------------------------------------------------------
+
+	// the pseudo-terminal has to exist before the fake autopilot opens it
+	port->start();
+	fake_port->start();
+	fake_autopilot.start();
+
+	uint64_t start_usec = get_monotonic_usec();
+	autopilot_interface.start();
+	uint64_t connect_usec = get_monotonic_usec() - start_usec;
+
+	autopilot_interface.enable_offboard_control();
+
+
+	// --------------------------------------------------------------------------
+	//   SEND SETPOINTS
+	// --------------------------------------------------------------------------
+
+	printf("SENDING %d SETPOINTS AT %.1f Hz\n", count, rate);
+
+	// only count the telemetry that arrives while sending
+	uint64_t counts_at_start[TELEMETRY_IDS];
+	for ( int i = 0; i < TELEMETRY_IDS; i++ )
+		counts_at_start[i] = counters[i].count;
+
+	uint64_t period = (uint64_t) (1000000.0f / rate);
+	uint64_t send_start_usec = get_monotonic_usec();
+	uint64_t next_usec = send_start_usec;
+	int sent = 0;
+
+	for ( int sequence = 1; sequence <= count && not time_to_exit; sequence++ )
+	{
+		mavlink_set_position_target_local_ned_t sp;
+		memset(&sp, 0, sizeof(sp));
+		set_velocity(0.5f, 0, 0, sp);
+		sp.time_boot_ms = sequence;
+
+		echo.sent_usec[sequence] = get_monotonic_usec();
+		autopilot_interface.update_setpoint(sp);
+		sent++;
+
+		next_usec += period;
+		uint64_t now = get_monotonic_usec();
+		if ( next_usec > now )
+			usleep(next_usec - now);
+	}
+
+	// let the last echoes come back
+	usleep(200000);
+	uint64_t duration_usec = get_monotonic_usec() - send_start_usec;
+
+	autopilot_interface.disable_offboard_control();
+	autopilot_interface.stop();
+	fake_autopilot.stop();
+	fake_port->stop();
+	port->stop();
+
+
+	// --------------------------------------------------------------------------
+	//   REPORT
+	// --------------------------------------------------------------------------
+
+	printf("\n");
+	printf("MAVLINK BENCHMARK OVER %s\n", link == LINK_UDP ? "UDP" : "PTY");
+	printf("    connect          : %.1f ms until start() returned\n", connect_usec / 1000.0);
+	printf("    setpoints sent   : %d\n", sent);
+	printf("    setpoints echoed : %lu (%lu keep-alive echoes)\n",
+	       (unsigned long) echo.latency.size(), (unsigned long) echo.duplicates);
+
+	// setpoints given faster than the loop writes them are merged, so some
+	// sequence numbers are never sent and never echoed
+	if ( not echo.latency.empty() )
+	{
+		std::vector<uint64_t> &latency = echo.latency;
+		std::sort(latency.begin(), latency.end());
+
+		uint64_t total = 0;
+		for ( size_t i = 0; i < latency.size(); i++ )
+			total += latency[i];
+
+		printf("    round trip (us)  : min %lu  mean %lu  p50 %lu  p99 %lu  max %lu\n",
+		       (unsigned long) latency.front(),
+		       (unsigned long) (total / latency.size()),
+		       (unsigned long) latency[latency.size() / 2],
+		       (unsigned long) latency[(latency.size() * 99) / 100],
+		       (unsigned long) latency.back());
+	}
+
+	Clock_Estimate clock = autopilot_interface.clock.estimate();
+	if ( clock.synced )
+		printf("    clock sync       : drift %+.1f ppm (fake runs %+d ppm), round trip %.2f ms\n",
+		       clock.drift * 1e6, FAKE_CLOCK_DRIFT_PPM, clock.rtt_usec / 1000.0);
+	else
+		printf("    clock sync       : no TIMESYNC replies\n");
+
+	// the attitude at times over the last half second, as the frames would ask
+	mavlink_attitude_t attitude;
+	uint64_t newest_usec;
+	if ( autopilot_interface.history.attitude.latest(attitude, newest_usec) )
+	{
+		int lookups = 100000, found = 0;
+		uint64_t lookup_start = get_monotonic_usec();
+		for ( int i = 0; i < lookups; i++ )
+			found += autopilot_interface.history.attitude.at(newest_usec - 10000 - i % 500000, attitude);
+		uint64_t lookup_usec = get_monotonic_usec() - lookup_start;
+		printf("    attitude history : %lu samples, %d of %d lookups found, %.0f ns each\n",
+		       (unsigned long) autopilot_interface.history.attitude.size(), found, lookups,
+		       lookup_usec * 1000.0 / lookups);
+	}
+
+	printf("    telemetry over %.2f s\n", duration_usec / 1000000.0);
+	for ( int i = 0; i < TELEMETRY_IDS; i++ )
+	{
+		uint64_t received = counters[i].count - counts_at_start[i];
+		printf("        %-18s : %lu messages, %.1f Hz\n", counters[i].name,
+		       (unsigned long) received, received * 1000000.0 / duration_usec);
+	}
+	printf("\n");
+
+	fake_autopilot.print_stats();
+
+	return 0;
+}
+
+
+// ------------------------------------------------------------------------------
+//   Quit Signal Handler
+// ------------------------------------------------------------------------------
+// this function is called when you press Ctrl-C
+void quit_handler( int sig )
+{
+	printf("\n");
+	printf("TERMINATING AT USER REQUEST\n");
+	printf("\n");
+
+	time_to_exit = true;
+}